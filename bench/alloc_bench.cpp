@@ -0,0 +1,297 @@
+/**
+ * @file alloc_bench.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Micro-benchmark that measures the per-call cost of the allocation
+ *        calls under a few workloads, it is meant to be run with and without
+ *        MemSafi preloaded (see 'make bench', 'make bench-sizes' and
+ *        bench/bench_suite.sh)
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <vector>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define DEFAULT_ITERATIONS 2000000
+#define DEFAULT_LIVE_WINDOW 64
+
+// Blocks of the 'large' workload, around glibc's default mmap threshold (128 kB)
+#define LARGE_MIN_SIZE (16 * 1024)
+#define LARGE_MAX_SIZE (512 * 1024)
+
+// A 'grow' block is reallocated from 16 bytes up to this size, then freed
+#define GROW_MAX_SIZE (8 * 1024)
+
+// Blocks in flight between a producer and its consumer in the 'cross' workload
+#define CROSS_QUEUE_SIZE 1024
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// One op of every workload: a malloc + free pair, a realloc, or a new + delete pair
+enum Workload
+{
+  WORKLOAD_SMALL = 0, // malloc/free of 16 to 527 bytes
+  WORKLOAD_LARGE, // malloc/free of 16 kB to 512 kB
+  WORKLOAD_REALLOC, // realloc of the window's blocks to random small sizes
+  WORKLOAD_GROW, // realloc growth by 1.5x, a vector's pattern
+  WORKLOAD_NEW, // operator new/delete of small objects and arrays
+  WORKLOAD_CROSS, // every thread's blocks are freed by its own consumer thread
+  NUM_WORKLOADS
+};
+
+
+static const char* const s_workload_names[NUM_WORKLOADS] = {"small", "large", "realloc", "grow", "new", "cross"};
+
+
+/**
+ * @brief Single producer single consumer ring of blocks, the consumer frees them
+ */
+struct CrossQueue
+{
+ public:
+  void* slots[CROSS_QUEUE_SIZE] = {};
+  alignas(64) std::atomic<long> head {0}; // Next slot the consumer reads
+  alignas(64) std::atomic<long> tail {0}; // Next slot the producer writes
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Allocate 'iterations' small blocks keeping a window of them alive
+ *
+ * A small window keeps every chunk header in cache, a large one (millions of
+ * blocks) makes the wrappers pay for their metadata lookups on cold memory.
+ *
+ * @param use_realloc Resize the window's blocks instead of freeing them
+ */
+static void __alloc_loop(long iterations, long live_window, bool use_realloc)
+{
+  std::vector<void*> window(live_window, nullptr);
+  unsigned int seed = 42;
+
+  for (long i = 0; i < iterations; i++) {
+    seed = seed * 1103515245 + 12345;
+    void*& slot = window[i % live_window];
+    if (use_realloc) {
+      slot = realloc(slot, 16 + (seed >> 16) % 512);
+      continue;
+    }
+    free(slot);
+    slot = malloc(16 + (seed >> 16) % 512);
+  }
+
+  for (void* p : window) {
+    free(p);
+  }
+}
+
+
+/**
+ * @brief Allocate 'iterations' blocks of random sizes between 'min_size' and
+ *        'max_size', keeping a window of them alive
+ */
+static void __sized_loop(long iterations, long live_window, size_t min_size, size_t max_size)
+{
+  std::vector<void*> window(live_window, nullptr);
+  unsigned int seed = 42;
+
+  for (long i = 0; i < iterations; i++) {
+    seed = seed * 1103515245 + 12345;
+    void*& slot = window[i % live_window];
+    free(slot);
+    slot = malloc(min_size + (seed >> 8) % (max_size - min_size + 1));
+  }
+
+  for (void* p : window) {
+    free(p);
+  }
+}
+
+
+/**
+ * @brief Grow the window's blocks by 1.5x with realloc, like a vector does,
+ *        one op per realloc
+ */
+static void __grow_loop(long iterations, long live_window)
+{
+  std::vector<void*> window(live_window, nullptr);
+  std::vector<size_t> sizes(live_window, 0);
+
+  for (long i = 0; i < iterations; i++) {
+    long slot = i % live_window;
+    size_t size = sizes[slot] < 16 ? 16 : sizes[slot] + sizes[slot] / 2;
+    if (size > GROW_MAX_SIZE) {
+      free(window[slot]);
+      window[slot] = nullptr;
+      size = 16;
+    }
+    window[slot] = realloc(window[slot], size);
+    sizes[slot] = size;
+  }
+
+  for (void* p : window) {
+    free(p);
+  }
+}
+
+
+/**
+ * @brief operator new/delete churn, alternating sized objects and arrays
+ */
+static void __new_loop(long iterations, long live_window)
+{
+  struct Object
+  {
+    long values[6];
+  };
+  std::vector<Object*> objects(live_window, nullptr);
+  std::vector<char*> arrays(live_window, nullptr);
+  unsigned int seed = 42;
+
+  for (long i = 0; i < iterations; i++) {
+    long slot = i % live_window;
+    if (i & 1) {
+      delete objects[slot];
+      objects[slot] = new Object();
+    } else {
+      seed = seed * 1103515245 + 12345;
+      delete[] arrays[slot];
+      arrays[slot] = new char[16 + (seed >> 16) % 256];
+    }
+  }
+
+  for (long slot = 0; slot < live_window; slot++) {
+    delete objects[slot];
+    delete[] arrays[slot];
+  }
+}
+
+
+// Free what the producer of 'queue' sends until it sends nullptr
+static void __cross_consumer(CrossQueue* queue)
+{
+  long head = 0;
+  while (true) {
+    while (queue->tail.load(std::memory_order_acquire) == head) {
+      std::this_thread::yield();
+    }
+    void* p = queue->slots[head % CROSS_QUEUE_SIZE];
+    queue->head.store(++head, std::memory_order_release);
+    if (p == nullptr) {
+      return;
+    }
+    free(p);
+  }
+}
+
+
+/**
+ * @brief Allocate 'iterations' small blocks freed by another thread, one op per block
+ */
+static void __cross_loop(long iterations)
+{
+  CrossQueue queue;
+  std::thread consumer(__cross_consumer, &queue);
+  unsigned int seed = 42;
+
+  for (long i = 0; i <= iterations; i++) {
+    seed = seed * 1103515245 + 12345;
+    void* p = i == iterations ? nullptr : malloc(16 + (seed >> 16) % 512);
+    while (i - queue.head.load(std::memory_order_acquire) >= CROSS_QUEUE_SIZE) {
+      std::this_thread::yield();
+    }
+    queue.slots[i % CROSS_QUEUE_SIZE] = p;
+    queue.tail.store(i + 1, std::memory_order_release);
+  }
+  consumer.join();
+}
+
+
+static void __run_workload(Workload workload, long iterations, long live_window)
+{
+  switch (workload) {
+    case WORKLOAD_SMALL: __alloc_loop(iterations, live_window, false); break;
+    case WORKLOAD_LARGE: __sized_loop(iterations, live_window, LARGE_MIN_SIZE, LARGE_MAX_SIZE); break;
+    case WORKLOAD_REALLOC: __alloc_loop(iterations, live_window, true); break;
+    case WORKLOAD_GROW: __grow_loop(iterations, live_window); break;
+    case WORKLOAD_NEW: __new_loop(iterations, live_window); break;
+    case WORKLOAD_CROSS: __cross_loop(iterations); break;
+    default: break;
+  }
+}
+
+
+// 'free' is the historical name of the 'small' workload
+static int __parse_workload(const char* name)
+{
+  if (strcmp(name, "free") == 0) {
+    return WORKLOAD_SMALL;
+  }
+  for (int workload = 0; workload < NUM_WORKLOADS; workload++) {
+    if (strcmp(name, s_workload_names[workload]) == 0) {
+      return workload;
+    }
+  }
+  return -1;
+}
+
+
+/**
+ * @brief Usage: alloc_bench [threads] [iterations per thread] [live window] [small|large|realloc|grow|new|cross]
+ *
+ * 'free' is accepted for 'small'. With 'cross' every thread has its own consumer thread.
+ */
+int main(int argc, char** argv)
+{
+  int threads = argc > 1 ? atoi(argv[1]) : 1;
+  long iterations = argc > 2 ? atol(argv[2]) : DEFAULT_ITERATIONS;
+  long live_window = argc > 3 ? atol(argv[3]) : DEFAULT_LIVE_WINDOW;
+  int workload = argc > 4 ? __parse_workload(argv[4]) : WORKLOAD_SMALL;
+  if (threads < 1 || live_window < 1 || workload < 0) {
+    fprintf(stderr, "Usage: %s [threads] [iterations per thread] [live window] [small|large|realloc|grow|new|cross]\n",
+            argv[0]);
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back(__run_workload, (Workload)workload, iterations, live_window);
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+  // ns_per_op is the latency seen by each thread
+  long ops = threads * iterations;
+  printf("workload=%s threads=%d ops=%ld ns_per_op=%.1f mops_per_sec=%.2f\n", s_workload_names[workload], threads, ops,
+         iterations == 0 ? 0.0 : ns / iterations, ns == 0 ? 0.0 : ops * 1e3 / ns);
+
+  return 0;
+}
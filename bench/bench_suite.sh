@@ -0,0 +1,128 @@
+#!/bin/bash
+# Author       : Osama Attia (osama.gma@gmail.com)
+# Latest update: Wed Oct 14 2026
+#
+# Overhead suite: runs every alloc_bench workload at every thread count, bare
+# and under each MemSafi mode, and prints one JSON object per run (JSON lines):
+#
+#   {"workload":"small","threads":4,"mode":"sharded","ns_per_op":61.2,"mops_per_sec":65.3,"overhead":1.42}
+#
+# 'overhead' is ns_per_op over the bare run of the same workload and threads.
+# With BENCH_BASELINE=<a previous output> every run is also compared to the
+# baseline's, runs slower by more than BENCH_TOLERANCE percent are flagged
+# "regression":true and the script exits with 1.
+#
+# Everything is set from the environment (see 'make bench-suite'):
+#   BENCH_BIN, BENCH_LIB           alloc_bench and memsafi.so
+#   BENCH_WORKLOADS, BENCH_MODES   subsets of the lists below
+#   BENCH_THREAD_COUNTS            e.g. "1 2 4 8", default powers of two up to the number of CPUs
+#   BENCH_ITERATIONS               ops per thread and run
+#   BENCH_RUNS                     runs per measure, the fastest one is kept
+
+BENCH_BIN=${BENCH_BIN:-build/alloc_bench}
+BENCH_LIB=${BENCH_LIB:-build/memsafi.so}
+BENCH_WORKLOADS=${BENCH_WORKLOADS:-small large realloc grow new cross}
+BENCH_MODES=${BENCH_MODES:-bare default sharded sampling sites header trace latency cache scopes}
+BENCH_ITERATIONS=${BENCH_ITERATIONS:-100000}
+BENCH_RUNS=${BENCH_RUNS:-3}
+BENCH_TOLERANCE=${BENCH_TOLERANCE:-10}
+
+if [ -z "$BENCH_THREAD_COUNTS" ]; then
+  cpus=$(nproc)
+  for (( n = 1; n <= cpus && n <= 64; n *= 2 )); do
+    BENCH_THREAD_COUNTS="$BENCH_THREAD_COUNTS $n"
+  done
+fi
+
+TRACE_FILE=$(mktemp /tmp/memsafi-bench.XXXXXX)
+trap 'rm -f "$TRACE_FILE"' EXIT
+
+# Environment of each mode, 'bare' runs without the library
+mode_env() {
+  case $1 in
+    default)  echo "" ;;
+    sharded)  echo "MEM_SAFI_SHARDED=1" ;;
+    sampling) echo "MEM_SAFI_SITES=1 MEM_SAFI_SAMPLE_BYTES=524288" ;;
+    sites)    echo "MEM_SAFI_SITES=1" ;;
+    header)   echo "MEM_SAFI_HEADER=1" ;;
+    trace)    echo "MEM_SAFI_TRACE=$TRACE_FILE" ;;
+    latency)  echo "MEM_SAFI_LATENCY=1" ;;
+    cache)    echo "MEM_SAFI_CACHE=1" ;;
+    scopes)   echo "MEM_SAFI_SCOPES=1" ;; # No thread enabled: the cost of the passthrough
+    *)        return 1 ;;
+  esac
+}
+
+# Fastest ns_per_op and its mops_per_sec of BENCH_RUNS runs: "<ns> <mops>"
+measure() {
+  local mode=$1 workload=$2 threads=$3
+  local best_ns="" best_mops="" line ns mops
+  for (( run = 0; run < BENCH_RUNS; run++ )); do
+    if [ "$mode" = bare ]; then
+      line=$("$BENCH_BIN" "$threads" "$BENCH_ITERATIONS" 64 "$workload" 2> /dev/null)
+    else
+      line=$(env MEM_SAFI_REPORT_INTERVAL_MS=0 $(mode_env "$mode") LD_PRELOAD="$BENCH_LIB" \
+             "$BENCH_BIN" "$threads" "$BENCH_ITERATIONS" 64 "$workload" 2> /dev/null)
+    fi
+    ns=$(sed -n 's/.*ns_per_op=\([0-9.]*\).*/\1/p' <<< "$line")
+    mops=$(sed -n 's/.*mops_per_sec=\([0-9.]*\).*/\1/p' <<< "$line")
+    if [ -z "$ns" ]; then
+      continue
+    fi
+    if [ -z "$best_ns" ] || awk -v a="$ns" -v b="$best_ns" 'BEGIN { exit !(a < b) }'; then
+      best_ns=$ns
+      best_mops=$mops
+    fi
+  done
+  echo "$best_ns $best_mops"
+}
+
+# ns_per_op of the same run in the baseline file, empty if it has none
+baseline_ns() {
+  [ -n "$BENCH_BASELINE" ] || return
+  grep -F "\"workload\":\"$1\",\"threads\":$2,\"mode\":\"$3\"," "$BENCH_BASELINE" | \
+    sed -n 's/.*"ns_per_op":\([0-9.]*\).*/\1/p' | head -n 1
+}
+
+for mode in $BENCH_MODES; do
+  if [ "$mode" != bare ] && ! mode_env "$mode" > /dev/null; then
+    echo "Unknown mode '$mode'" >&2
+    exit 2
+  fi
+done
+
+regressions=0
+for workload in $BENCH_WORKLOADS; do
+  for threads in $BENCH_THREAD_COUNTS; do
+    read -r bare_ns bare_mops <<< "$(measure bare "$workload" "$threads")"
+    for mode in $BENCH_MODES; do
+      if [ "$mode" = bare ]; then
+        ns=$bare_ns
+        mops=$bare_mops
+      else
+        read -r ns mops <<< "$(measure "$mode" "$workload" "$threads")"
+      fi
+      if [ -z "$ns" ]; then
+        echo "{\"workload\":\"$workload\",\"threads\":$threads,\"mode\":\"$mode\",\"error\":\"failed\"}"
+        regressions=$((regressions + 1))
+        continue
+      fi
+
+      record="{\"workload\":\"$workload\",\"threads\":$threads,\"mode\":\"$mode\",\"ns_per_op\":$ns,\"mops_per_sec\":$mops"
+      record="$record,\"overhead\":$(awk -v a="$ns" -v b="$bare_ns" 'BEGIN { printf "%.2f", (b > 0 ? a / b : 0) }')"
+      base=$(baseline_ns "$workload" "$threads" "$mode")
+      if [ -n "$base" ]; then
+        change=$(awk -v a="$ns" -v b="$base" 'BEGIN { printf "%.1f", (b > 0 ? (a / b - 1) * 100 : 0) }')
+        regression=$(awk -v c="$change" -v t="$BENCH_TOLERANCE" 'BEGIN { print (c > t ? "true" : "false") }')
+        [ "$regression" = true ] && regressions=$((regressions + 1))
+        record="$record,\"baseline_ns_per_op\":$base,\"change_percent\":$change,\"regression\":$regression"
+      fi
+      echo "$record}"
+    done
+  done
+done
+
+if [ -n "$BENCH_BASELINE" ]; then
+  echo "$regressions regression(s) over $BENCH_TOLERANCE% against $BENCH_BASELINE" >&2
+fi
+[ "$regressions" -eq 0 ]
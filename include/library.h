@@ -14,19 +14,30 @@
 // Includes
 ////////////////////////////////////////////////////////////////////////////////
 #include <dlfcn.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <ctime>
 #include <locale>
+#include <mutex>
 #include <vector>
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Local Includes
 ////////////////////////////////////////////////////////////////////////////////
+#include "memsafi.h"
+#include "safi_call.h"
+#include "safi_histogram.h"
+#include "safi_snapshot.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Function Prototypes
 ////////////////////////////////////////////////////////////////////////////////
+void __log_msg(const char* format, ...) __attribute__((format(printf, 1, 2)));
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -36,24 +47,68 @@ using MallocFnType = void* (*)(size_t size);
 using CallocFnType = void* (*)(size_t num, size_t size);
 using ReallocFnType = void* (*)(void* ptr, size_t size);
 using FreeFnType = void (*)(void*);
+using PosixMemalignFnType = int (*)(void** memptr, size_t alignment, size_t size);
+using MemalignFnType = void* (*)(size_t alignment, size_t size); // aligned_alloc and memalign
+using UsableSizeFnType = size_t (*)(void* ptr);
 using MainFnTpe = int (*)(int, char **, char **);
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Pre-processor constants
 ////////////////////////////////////////////////////////////////////////////////
-#define TIME_STR_BUFFER_SIZE 80
+// Logging levels, MEM_SAFI_LOG_LEVEL is picked at compile time (see Makefile)
+#define SAFI_LOG_LEVEL_NONE 0
+#define SAFI_LOG_LEVEL_ERROR 1
+#define SAFI_LOG_LEVEL_INFO 2
+
+#ifndef MEM_SAFI_LOG_LEVEL
+#define MEM_SAFI_LOG_LEVEL SAFI_LOG_LEVEL_ERROR
+#endif
+
+#if MEM_SAFI_LOG_LEVEL >= SAFI_LOG_LEVEL_ERROR
+#define SAFI_LOG_ERROR(...) __log_msg(__VA_ARGS__)
+#else
+#define SAFI_LOG_ERROR(...) do {} while (0)
+#endif
+
+// Info messages are also gated at runtime by MEM_SAFI_DEBUG=1
+#if MEM_SAFI_LOG_LEVEL >= SAFI_LOG_LEVEL_INFO
+#define SAFI_LOG_INFO(...) do { if (safiControl.debug) { __log_msg(__VA_ARGS__); } } while (0)
+#else
+#define SAFI_LOG_INFO(...) do {} while (0)
+#endif
+#define SAFI_CACHE_LINE_SIZE 64
+
+// The library is built with -fvisibility=hidden, only the hooked symbols are exported
+#define SAFI_EXPORT __attribute__((visibility("default")))
+
+// Max un-flushed 'reserved' bytes a shard keeps before pushing them to the global counter
+#define DEFAULT_SHARD_FLUSH_BYTES (64 * 1024)
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Global Variables
 ////////////////////////////////////////////////////////////////////////////////
+struct SafiShard;
+
+// The shard of the calling thread (nullptr until its first allocation in sharded mode)
+extern __thread SafiShard* t_safi_shard __attribute__((tls_model("initial-exec")));
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Functions
 ////////////////////////////////////////////////////////////////////////////////
 
+/**
+ * @brief Cheap monotonic timestamp (vDSO, a few ns) with jiffy resolution
+ */
+inline uint64_t safi_now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Classes
@@ -68,29 +123,102 @@ struct SafiControl
 {
  public:
   bool debug = false;
-  bool pending_init = false;
+  std::atomic<bool> init_started {false}; // Set by the thread running __init_safi()
+  std::atomic<bool> finish_started {false}; // Set by the thread running __finish_safi()
+  bool side_table = false; // Track every live pointer in safiTable
+  bool sites = false; // Capture the call stack of every allocation (needs side_table)
+  int stack_depth = 0;
+  int top_sites = 0;
+  int64_t sample_bytes = 0; // Mean bytes between two tracked allocations (0: track all)
+  bool trace = false; // Record every event in safiTracer
+  bool timeline = false; // Sample the counters into safiTimeline from the reporting thread
+  bool memory = false; // Break the process memory down in the report (see SafiMemoryStats)
+  bool cache = false; // Serve small malloc/calloc from the freed blocks of safiCache (default mode only)
+  bool scopes = false; // Only track the enabled threads and the scopes of memsafi.h (needs side_table)
+  bool header = false; // Prefix every block with a SafiHeader instead of using side_table
+  bool lifetimes = false; // Time to free per size class and short-lived churn per site
+  uint64_t short_lived_ns = 0; // Blocks freed within this time count as short-lived
+  bool latency = false; // Time the original allocator calls (see SafiLatencyTable)
+  bool threads = false; // Live and total bytes per thread, kept after it exits (see SafiThreadTable)
+  int top_threads = 0;
+  bool leaks = false; // Report the blocks never freed at exit (see SafiLeakTable)
+  int top_leaks = 0;
+  int leak_jobs = 1; // Threads walking the side table at exit
+  SafiReportFormat report_format = SAFI_FORMAT_TEXT;
+  double ns_per_tsc = 1.0; // Calibrated at init, converts safi_tsc() deltas
+  uint64_t start_tsc = 0;
 
   MallocFnType orig_malloc = nullptr;
   CallocFnType orig_calloc = nullptr;
   ReallocFnType orig_realloc = nullptr;
   FreeFnType orig_free = nullptr;
+  PosixMemalignFnType orig_posix_memalign = nullptr;
+  MemalignFnType orig_aligned_alloc = nullptr;
+  MemalignFnType orig_memalign = nullptr;
+  MallocFnType orig_valloc = nullptr;
+  MallocFnType orig_pvalloc = nullptr;
+  UsableSizeFnType orig_malloc_usable_size = nullptr;
   MainFnTpe orig_main = nullptr;
 
+  uintptr_t self_begin = 0; // Text of this library, skipped when capturing sites
+  uintptr_t self_end = 0;
+  int64_t init_ns = 0; // Time spent in __init_safi()
+
   /**
    * @brief Capture the pointers to the original pointers using dlsym
    */
   void init() {
-    pending_init = true;
     orig_malloc = (MallocFnType) dlsym(RTLD_NEXT, "malloc");
     orig_calloc = (CallocFnType) dlsym(RTLD_NEXT, "calloc");
     orig_realloc = (ReallocFnType) dlsym(RTLD_NEXT, "realloc");
     orig_free = (FreeFnType) dlsym(RTLD_NEXT, "free");
-
-    if (orig_malloc == nullptr || orig_calloc == nullptr || orig_realloc == nullptr || orig_free == nullptr) {
-      fprintf(stderr, "[ERROR] Failed to hook calls: %s\n", dlerror());
+    orig_posix_memalign = (PosixMemalignFnType) dlsym(RTLD_NEXT, "posix_memalign");
+    orig_aligned_alloc = (MemalignFnType) dlsym(RTLD_NEXT, "aligned_alloc");
+    orig_memalign = (MemalignFnType) dlsym(RTLD_NEXT, "memalign");
+    orig_valloc = (MallocFnType) dlsym(RTLD_NEXT, "valloc");
+    orig_pvalloc = (MallocFnType) dlsym(RTLD_NEXT, "pvalloc");
+    orig_malloc_usable_size = (UsableSizeFnType) dlsym(RTLD_NEXT, "malloc_usable_size");
+
+    if (orig_malloc == nullptr || orig_calloc == nullptr || orig_realloc == nullptr || orig_free == nullptr ||
+        orig_posix_memalign == nullptr || orig_aligned_alloc == nullptr || orig_memalign == nullptr ||
+        orig_valloc == nullptr || orig_pvalloc == nullptr || orig_malloc_usable_size == nullptr) {
+      SAFI_LOG_ERROR("[ERROR] Failed to hook calls: %s\n", dlerror());
       exit(1);
     }
-    pending_init = false;
+  }
+};
+
+
+/**
+ * @brief Per-thread slice of the SafiStats counters (sharded mode only)
+ *
+ * Only the owning thread writes to a shard, so updates are relaxed load/store
+ * pairs instead of locked read-modify-writes, and the alignment keeps shards of
+ * different threads off each other's cache lines. The reporter thread reads
+ * the counters concurrently, hence the relaxed atomics.
+ */
+struct alignas(SAFI_CACHE_LINE_SIZE) SafiShard
+{
+ public:
+  std::atomic<int64_t> reserved {0}; // Bytes not yet flushed to SafiStats::m_reserved
+  std::atomic<int64_t> total_reserved {0}; // Bytes
+  std::atomic<int64_t> freed {0}; // Bytes
+
+  std::atomic<int64_t> num_calls[SAFI_NUM_CALLS] = {}; // Indexed by SafiCall
+
+  std::atomic<int64_t> total_requested {0}; // Bytes before alignment (side table only)
+  std::atomic<int64_t> freed_requested {0}; // Bytes before alignment (side table only)
+
+  SafiHistogram sizes; // Requested bytes of every allocation (histograms only)
+  SafiHistogram lifetimes; // ns between allocation and free (histograms + side table only)
+
+  SafiShard* next = nullptr; // List of every shard ever created
+  SafiShard* next_free = nullptr; // List of shards released by exited threads
+
+  // Single-writer increment: no lock prefix, no cache line bouncing
+  static void add(std::atomic<int64_t>& counter, const int64_t value)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
   }
 };
 
@@ -101,96 +229,224 @@ struct SafiControl
 struct SafiStats
 {
  public:
-  // Thread-safe
-  void log_malloc(const size_t size)
+  // Thread-safe, 'call' is one of the allocating entry points (a realloc logs the size difference)
+  void log_alloc(const SafiCall call, const size_t size)
   {
+    if (m_sharded) {
+      SafiShard* shard = local_shard();
+      log_alloc_helper(shard, size);
+      SafiShard::add(shard->num_calls[call], 1);
+      return;
+    }
     log_alloc_helper(size);
-    ++m_num_mallocs;
+    ++m_num_calls[call];
   }
 
-  // Thread-safe
-  void log_calloc(const size_t size)
+  // Thread-safe, 'call' is free or one of the delete operators
+  void log_free(const SafiCall call, const size_t size)
   {
-    log_alloc_helper(size);
-    ++m_num_callocs;
+    if (m_sharded) {
+      SafiShard* shard = local_shard();
+      SafiShard::add(shard->reserved, -(int64_t)size);
+      SafiShard::add(shard->freed, size);
+      SafiShard::add(shard->num_calls[call], 1);
+      if (shard->reserved.load(std::memory_order_relaxed) < -m_flush_bytes) {
+        flush_shard(shard);
+      }
+      return;
+    }
+    m_reserved -= size;
+    m_freed += size;
+    ++m_num_calls[call];
   }
 
-  // Thread-safe
-  void log_realloc(const size_t size)
+  /**
+   * @brief Log requested (pre-alignment) bytes, they are only known when the
+   *        side table is enabled. A realloc frees the old size and allocates the new one
+   */
+  void log_requested(const size_t allocated, const size_t freed)
   {
-    log_alloc_helper(size);
-    ++m_num_reallocs;
+    if (m_sharded) {
+      SafiShard* shard = local_shard();
+      SafiShard::add(shard->total_requested, allocated);
+      SafiShard::add(shard->freed_requested, freed);
+      return;
+    }
+    m_total_requested += allocated;
+    m_freed_requested += freed;
   }
 
-  // Thread-safe
-  void log_free(const size_t size)
+  // Thread-safe, requested size of a new block (or of a resized one)
+  void log_size(const size_t size)
   {
-    m_reserved -= size;
-    m_freed += size;
-    ++m_num_frees;
+    if (!m_histograms) {
+      return;
+    }
+    if (m_sharded) {
+      local_shard()->sizes.add_local(size);
+      return;
+    }
+    m_sizes.add(size);
   }
 
+  // Thread-safe, 'count' blocks freed 'ns' after their allocation (sampled blocks weigh more than one)
+  void log_lifetime(const uint64_t ns, const int64_t count)
+  {
+    if (!m_histograms) {
+      return;
+    }
+    if (m_sharded) {
+      local_shard()->lifetimes.add_local(ns, count);
+      return;
+    }
+    m_lifetimes.add(ns, count);
+  }
+
+  void enable_histograms() { m_histograms = true; }
 
-  void print(FILE* stream=stderr) const
+  // sample_bytes != 0 flags the requested bytes as estimated from samples
+  void enable_requested(int64_t sample_bytes=0)
   {
-    char time_buffer[TIME_STR_BUFFER_SIZE];
-    std::time_t current_time = std::time(nullptr);
-    std::strftime(time_buffer, TIME_STR_BUFFER_SIZE, "%c %Z", std::localtime(&current_time));
+    m_track_requested = true;
+    m_sample_bytes = sample_bytes;
+  }
 
-    auto print_size = [stream] (const char* prefix, int64_t size) {
-      const char* units[] = {"B", "kB", "MB", "GB", "TB"};
-      int length = sizeof(units) / sizeof(units[0]);
+  // Track the peak of every timeline interval, see take_interval_peak()
+  void enable_interval_peaks() { m_interval_peaks = true; }
 
-      int i = 0;
-      for (i = 0; (size / 1024) > 0 && i < length - 1; i++) {
-          size /= 1024;
-      }
-      fprintf(stream, "%s %ld %s\n", prefix, size, units[i]);
-    };
+  /**
+   * @brief Highest reserved bytes since the previous call, the next interval
+   *        starts from the current value (sharded: from the flushed bytes)
+   */
+  int64_t take_interval_peak()
+  {
+    int64_t reserved = m_reserved.load(std::memory_order_relaxed);
+    return std::max(m_interval_peak.exchange(reserved, std::memory_order_relaxed), reserved);
+  }
 
-    fprintf(stream, "\n\n>>>>>>>>>>>>> %s <<<<<<<<<<<\n", time_buffer);
-    fprintf(stream, "Overall stats (with alignement):\n");
+  /**
+   * @brief Switch to per-thread counters, must be called before any allocation is logged
+   *
+   * @param flush_bytes Max drift of a shard's reserved bytes before it is flushed
+   */
+  void enable_sharding(int64_t flush_bytes);
 
-    print_size("Currently reserved:", m_reserved.load());
-    fprintf(stream, "\n");
+  /**
+   * @brief Fold the counters of an exiting thread into the global totals and
+   *        recycle its shard
+   */
+  void retire_shard(SafiShard* shard);
 
-    print_size("Peak memory:", m_real_peak.load());
-    print_size("Total reserved:", m_total_reserved.load());
-    print_size("Total freed:", m_freed.load());
-    fprintf(stream, "\n");
+  // Held across fork() so the child's copy of the shard lists is consistent
+  void lock_shards() { m_shards_mutex.lock(); }
+  void unlock_shards() { m_shards_mutex.unlock(); }
 
-    fprintf(stream, "Number of mallocs: %ld\n", m_num_mallocs.load());
-    fprintf(stream, "Number of callocs: %ld\n", m_num_callocs.load());
-    fprintf(stream, "Number of reallocs: %ld\n", m_num_reallocs.load());
-    fprintf(stream, "Number of frees: %ld\n", m_num_frees.load());
+  /**
+   * @brief Restart the counters from the live heap, in a child right after
+   *        fork() while it is single-threaded
+   *
+   * The blocks inherited from the parent stay live (the child may free them)
+   * and count as its first allocations; the calls, the frees, the histograms
+   * and the peak only cover the child.
+   */
+  void rebase();
 
-    fprintf(stream, "\n");
-  }
-  
-  void disablePrint() { m_disable_print = true; }
-  bool isPrintEnabled() const { return m_disable_print; }
+
+  /**
+   * @brief Copy the counters (summed over the shards) into 'snapshot', see
+   *        safi_snapshot.h for the formatters. The caller fills init_ns
+   */
+  void snapshot(SafiSnapshot& snapshot) const;
 
  private:
   std::atomic<int64_t> m_reserved {0}; // Bytes
   std::atomic<int64_t> m_total_reserved {0}; // Bytes
   std::atomic<int64_t> m_real_peak {0}; // Bytes
+  std::atomic<int64_t> m_interval_peak {0}; // Bytes, since the last take_interval_peak()
+  bool m_interval_peaks {false};
   std::atomic<int64_t> m_freed {0}; // Bytes
 
-  std::atomic<int64_t> m_num_mallocs {0};
-  std::atomic<int64_t> m_num_callocs {0};
-  std::atomic<int64_t> m_num_reallocs {0};
-  std::atomic<int64_t> m_num_frees {0};
+  std::atomic<int64_t> m_num_calls[SAFI_NUM_CALLS] = {}; // Indexed by SafiCall
+
+  std::atomic<int64_t> m_total_requested {0}; // Bytes
+  std::atomic<int64_t> m_freed_requested {0}; // Bytes
+
+  bool m_histograms {false};
+  SafiHistogram m_sizes;
+  SafiHistogram m_lifetimes;
 
+  bool m_track_requested {false};
+  int64_t m_sample_bytes {0};
   bool m_enable_trace {false};
-  bool m_disable_print {false};
 
-  // Thread-safe except peak calculations!
+  // Sharded mode: the atomics above hold the totals of exited threads (and the
+  // flushed reserved bytes), the live threads' counters sit in their shards
+  bool m_sharded {false};
+  int64_t m_flush_bytes {DEFAULT_SHARD_FLUSH_BYTES};
+  pthread_key_t m_shard_key {0};
+  SafiShard* m_shards {nullptr};
+  SafiShard* m_free_shards {nullptr};
+  int64_t m_num_shards {0};
+  mutable std::mutex m_shards_mutex; // Guards the shard lists, never taken on the hot path
+
+  // Thread-safe
   void log_alloc_helper(const size_t size)
   {
-    m_reserved += size;
     m_total_reserved += size;
+    update_peak(m_reserved.fetch_add(size) + size);
+  }
+
+  /**
+   * @brief Lock-free atomic max of the peak
+   *
+   * Every value m_reserved ever takes is returned by exactly one fetch_add, and
+   * that caller pushes it here, so the peak is the exact max of the counter.
+   * The CAS is only attempted when the value is a new high, so in steady state
+   * this is a single relaxed load and a branch.
+   */
+  void update_peak(const int64_t value)
+  {
+    if (m_interval_peaks) {
+      int64_t interval_peak = m_interval_peak.load(std::memory_order_relaxed);
+      while (value > interval_peak &&
+             !m_interval_peak.compare_exchange_weak(interval_peak, value, std::memory_order_relaxed)) {
+      }
+    }
+    int64_t peak = m_real_peak.load(std::memory_order_relaxed);
+    while (value > peak && !m_real_peak.compare_exchange_weak(peak, value, std::memory_order_relaxed)) {
+    }
+  }
 
-    // TODO Probaly need a mutex for this instead of std::atomic to be truly thread-safe!
-    m_real_peak = std::max(m_real_peak.load(), m_reserved.load());
+  // Sharded version of the helper above
+  void log_alloc_helper(SafiShard* shard, const size_t size)
+  {
+    SafiShard::add(shard->reserved, size);
+    SafiShard::add(shard->total_reserved, size);
+    if (shard->reserved.load(std::memory_order_relaxed) > m_flush_bytes) {
+      flush_shard(shard);
+    }
+  }
+
+  SafiShard* local_shard()
+  {
+    SafiShard* shard = t_safi_shard;
+    if (shard == nullptr) {
+      shard = acquire_shard();
+    }
+    return shard;
   }
+
+  // Push the shard's pending reserved bytes to the global counter (owner thread only)
+  void flush_shard(SafiShard* shard)
+  {
+    int64_t pending = shard->reserved.load(std::memory_order_relaxed);
+    shard->reserved.store(0, std::memory_order_relaxed);
+    update_peak(m_reserved.fetch_add(pending) + pending);
+  }
+
+  // Get a recycled shard or create a new one for the calling thread
+  SafiShard* acquire_shard();
+
+  // Sum the global counters and all the shards into 'totals'
+  void collect(SafiShard& totals) const;
 };
@@ -0,0 +1,70 @@
+/**
+ * @file memsafi.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Profiling scopes, the API a program calls to pick the allocations
+ *        MemSafi tracks when it runs with MEM_SAFI_SCOPES=1
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * The only MemSafi header meant for programs, it has no dependency and builds
+ * as C or C++. The symbols are weak: a program links and runs without
+ * memsafi.so, the MEMSAFI_* macros and MemSafiScope then do nothing.
+ *
+ *   void handle_request(...)
+ *   {
+ *     MemSafiScope scope("checkout");
+ *     ...
+ *   }
+ *
+ * With MEM_SAFI_SCOPES=1 a thread is tracked while it is enabled or inside a
+ * scope, the other threads go straight to glibc. Blocks are attributed to the
+ * innermost scope of the thread that allocates (or resizes) them.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Track the calling thread's allocations until the matching
+ *        memsafi_scope_end(), attributing them to 'tag'. Scopes nest
+ *
+ * @param tag Name of the scope, copied (tags over 31 characters are cut)
+ */
+void memsafi_scope_begin(const char* tag) __attribute__((weak));
+
+// End the innermost scope of the calling thread
+void memsafi_scope_end(void) __attribute__((weak));
+
+// Track (non-zero) or stop tracking all the calling thread's allocations, outside scopes they have no tag
+void memsafi_thread_enable(int enable) __attribute__((weak));
+
+#ifdef __cplusplus
+}
+#endif
+
+
+// Calls that are no-ops when memsafi.so is not preloaded
+#define MEMSAFI_SCOPE_BEGIN(tag) do { if (memsafi_scope_begin) { memsafi_scope_begin(tag); } } while (0)
+#define MEMSAFI_SCOPE_END() do { if (memsafi_scope_end) { memsafi_scope_end(); } } while (0)
+#define MEMSAFI_THREAD_ENABLE(enable) do { if (memsafi_thread_enable) { memsafi_thread_enable(enable); } } while (0)
+
+
+#ifdef __cplusplus
+/**
+ * @brief Scope of the enclosing block
+ */
+class MemSafiScope
+{
+ public:
+  explicit MemSafiScope(const char* tag) { MEMSAFI_SCOPE_BEGIN(tag); }
+  ~MemSafiScope() { MEMSAFI_SCOPE_END(); }
+
+  MemSafiScope(const MemSafiScope&) = delete;
+  MemSafiScope& operator=(const MemSafiScope&) = delete;
+};
+#endif
@@ -0,0 +1,84 @@
+/**
+ * @file safi_bootstrap.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Allocator that serves the allocations made before the original malloc
+ *        is resolved (dlsym may allocate while MemSafi looks it up)
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define SAFI_BOOTSTRAP_BUFFER_SIZE 80000
+
+// Once the static buffer is full, blocks come from up to this many mmap regions
+#define SAFI_BOOTSTRAP_MAX_REGIONS 16
+#define SAFI_BOOTSTRAP_REGION_SIZE (1024 * 1024)
+
+// Room before each block for its size, keeps malloc's 16 bytes alignment
+#define SAFI_BOOTSTRAP_HEADER_SIZE 16
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Lock-free bump allocator, blocks are never reused
+ *
+ * Memory is never handed out twice so it is always zero-filled (the static
+ * buffer is in .bss, the regions come from mmap), calloc gets it as is. Each
+ * block keeps its size right before it for the bootstrap realloc.
+ */
+struct SafiBootstrap
+{
+ public:
+  /**
+   * @brief Thread-safe, lock-free
+   *
+   * @param alignment Power of two, at least 16 bytes are used
+   * @return void* Zero-filled block, nullptr if mmap failed or the regions are exhausted
+   */
+  void* alloc(size_t size, size_t alignment);
+
+  /**
+   * @brief Whether 'p' was returned by alloc(), a relaxed load and a branch
+   *        until the bootstrap allocator is first used
+   */
+  bool owns(const void* p) const
+  {
+    return m_used.load(std::memory_order_relaxed) && owns_slow(p);
+  }
+
+  // Requested size of a block returned by alloc()
+  static size_t size_of(const void* p) { return ((const uint64_t*)p)[-1]; }
+
+ private:
+  std::atomic<bool> m_used {false};
+  std::atomic<size_t> m_buffer_used {0};
+
+  // Each region starts with its size, the cursor follows it
+  std::atomic<uintptr_t> m_regions[SAFI_BOOTSTRAP_MAX_REGIONS] = {};
+  std::atomic<size_t> m_regions_used[SAFI_BOOTSTRAP_MAX_REGIONS] = {};
+
+  alignas(64) char m_buffer[SAFI_BOOTSTRAP_BUFFER_SIZE] = {};
+
+  bool owns_slow(const void* p) const;
+
+  // Carve a block out of [base, base + capacity) with a CAS on 'used'
+  static void* bump(uintptr_t base, size_t capacity, std::atomic<size_t>& used, size_t size, size_t alignment);
+};
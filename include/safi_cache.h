@@ -0,0 +1,233 @@
+/**
+ * @file safi_cache.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Per-thread cache of small freed blocks in front of glibc
+ *        (MEM_SAFI_CACHE=1), to measure how much a caching layer would save
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * Blocks are binned by glibc's chunk size (request2size(), 16 bytes steps), so
+ * a cached block has exactly the usable size glibc would have returned for the
+ * request and the accounting does not change: a cached block counts as freed,
+ * a hit as a new allocation. The lists are linked through the freed blocks.
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// Largest cached chunk, and one list per 16 bytes chunk size up to it
+#define SAFI_CACHE_MAX_CHUNK 1024
+#define SAFI_CACHE_CLASSES (SAFI_CACHE_MAX_CHUNK / 16 + 1)
+#define SAFI_CACHE_MAX_USABLE (SAFI_CACHE_MAX_CHUNK - sizeof(size_t))
+
+// Per-thread bounds: blocks per size class (MEM_SAFI_CACHE_BLOCKS) and bytes held (MEM_SAFI_CACHE_KB)
+#define DEFAULT_CACHE_BLOCKS 64
+#define DEFAULT_CACHE_KB 256
+
+// Frees between two scavenges, which return the blocks a list did not need since the last one
+#define SAFI_CACHE_SCAVENGE_FREES 65536
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+struct SafiThreadCache;
+
+using SafiCacheFreeFnType = void (*)(void*);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+extern __thread SafiThreadCache* t_safi_cache __attribute__((tls_model("initial-exec")));
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+// List of a request of 'size' bytes (<= SAFI_CACHE_MAX_USABLE), from glibc's request2size() on x86_64
+inline int safi_cache_class(size_t size)
+{
+  size_t chunk = (size + sizeof(size_t) + 15) & ~(size_t)15;
+  return (chunk < 32 ? 32 : chunk) >> 4;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Lists of one thread. Only the owner touches the lists, the counters
+ *        are single-writer relaxed atomics (like SafiShard) read by the reporter
+ */
+struct SafiThreadCache
+{
+ public:
+  void* heads[SAFI_CACHE_CLASSES] = {};
+  uint32_t counts[SAFI_CACHE_CLASSES] = {};
+  uint32_t low_marks[SAFI_CACHE_CLASSES] = {}; // Lowest count since the last scavenge
+  int64_t frees_to_scavenge = SAFI_CACHE_SCAVENGE_FREES;
+
+  std::atomic<int64_t> hits {0};
+  std::atomic<int64_t> misses {0}; // Cacheable requests glibc had to serve
+  std::atomic<int64_t> cached_frees {0};
+  std::atomic<int64_t> returned {0}; // Blocks given back to glibc
+  std::atomic<int64_t> held_blocks {0};
+  std::atomic<int64_t> held_bytes {0};
+
+  SafiThreadCache* next = nullptr; // List of every cache ever created
+  SafiThreadCache* next_free = nullptr; // List of caches released by exited threads
+
+  static void add(std::atomic<int64_t>& counter, const int64_t value)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+};
+
+
+/**
+ * @brief Owner of the thread caches. Caches of exited threads are emptied and
+ *        handed to the next new thread with their counters
+ */
+struct SafiCache
+{
+ public:
+  /**
+   * @brief Must be called before the first pop() or push()
+   *
+   * @param release Original free(), where the blocks go back
+   * @return false if the thread-exit key could not be created
+   */
+  bool init(SafiCacheFreeFnType release, int64_t max_blocks, int64_t max_bytes);
+
+  /**
+   * @brief Take a block for a malloc of 'size' bytes
+   *
+   * @param usable Set to the block's usable size on a hit
+   * @return nullptr on a miss, glibc must serve the request
+   */
+  void* pop(size_t size, size_t& usable)
+  {
+    if (size > SAFI_CACHE_MAX_USABLE) {
+      return nullptr;
+    }
+    SafiThreadCache* cache = local_cache();
+    if (cache == nullptr) {
+      return nullptr;
+    }
+    int size_class = safi_cache_class(size);
+    void* block = cache->heads[size_class];
+    if (block == nullptr) {
+      SafiThreadCache::add(cache->misses, 1);
+      return nullptr;
+    }
+
+    cache->heads[size_class] = *static_cast<void**>(block);
+    uint32_t count = --cache->counts[size_class];
+    if (count < cache->low_marks[size_class]) {
+      cache->low_marks[size_class] = count;
+    }
+    usable = ((size_t)size_class << 4) - sizeof(size_t);
+    SafiThreadCache::add(cache->hits, 1);
+    SafiThreadCache::add(cache->held_blocks, -1);
+    SafiThreadCache::add(cache->held_bytes, -(int64_t)usable);
+    return block;
+  }
+
+  /**
+   * @brief Keep a freed block of 'usable' bytes for a later pop()
+   *
+   * @return false if the block does not fit a list (too large, or mmapped), the caller frees it
+   */
+  bool push(void* block, size_t usable)
+  {
+    // Chunks of the heap are 8 bytes past a multiple of 16, mmapped ones are not
+    if (usable > SAFI_CACHE_MAX_USABLE || ((usable + sizeof(size_t)) & 15) != 0) {
+      return false;
+    }
+    SafiThreadCache* cache = local_cache();
+    if (cache == nullptr) {
+      return false;
+    }
+    int size_class = (usable + sizeof(size_t)) >> 4;
+    if (cache->counts[size_class] >= m_max_blocks) {
+      trim(cache, size_class, (cache->counts[size_class] + 1) / 2);
+    }
+    if (cache->held_bytes.load(std::memory_order_relaxed) + (int64_t)usable > m_max_bytes) {
+      trim_all(cache);
+    }
+
+    *static_cast<void**>(block) = cache->heads[size_class];
+    cache->heads[size_class] = block;
+    cache->counts[size_class]++;
+    SafiThreadCache::add(cache->cached_frees, 1);
+    SafiThreadCache::add(cache->held_blocks, 1);
+    SafiThreadCache::add(cache->held_bytes, usable);
+    if (--cache->frees_to_scavenge == 0) {
+      scavenge(cache);
+    }
+    return true;
+  }
+
+  // Thread-exit hook, the blocks go back to glibc and the cache to the free list
+  void retire_cache(SafiThreadCache* cache);
+
+  // Held across fork() so the child's copy of the cache lists is consistent
+  void lock_for_fork() { m_mutex.lock(); }
+  void unlock_after_fork() { m_mutex.unlock(); }
+
+  /**
+   * @brief In a forked child (single-threaded), return the blocks the other
+   *        threads' caches held, recycle those caches and zero the counters
+   */
+  void restart_in_child();
+
+  // Print the hit rate and what the caches hold
+  void print(FILE* stream) const;
+
+ private:
+  SafiCacheFreeFnType m_release {nullptr};
+  uint32_t m_max_blocks {DEFAULT_CACHE_BLOCKS};
+  int64_t m_max_bytes {DEFAULT_CACHE_KB * 1024};
+  pthread_key_t m_key {0};
+  SafiThreadCache* m_caches {nullptr};
+  SafiThreadCache* m_free_caches {nullptr};
+  mutable std::mutex m_mutex; // Guards the cache lists, never taken on the hot path
+
+  SafiThreadCache* local_cache()
+  {
+    SafiThreadCache* cache = t_safi_cache;
+    return cache != nullptr ? cache : acquire_cache();
+  }
+
+  // Get a recycled cache or map a new one for the calling thread (nullptr if out of memory)
+  SafiThreadCache* acquire_cache();
+
+  // Give the first 'count' blocks of a list back to glibc (owner thread only)
+  void trim(SafiThreadCache* cache, int size_class, uint32_t count);
+
+  // Halve every list, when the thread holds too many bytes
+  void trim_all(SafiThreadCache* cache);
+
+  // Return the blocks every list kept unused since the last scavenge
+  void scavenge(SafiThreadCache* cache);
+};
@@ -0,0 +1,63 @@
+/**
+ * @file safi_call.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Hooked entry points, shared by the call counters and the latency histograms
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Every hooked entry point has its own call counter
+enum SafiCall : int
+{
+  SAFI_CALL_MALLOC = 0,
+  SAFI_CALL_CALLOC,
+  SAFI_CALL_REALLOC,
+  SAFI_CALL_REALLOCARRAY,
+  SAFI_CALL_POSIX_MEMALIGN,
+  SAFI_CALL_ALIGNED_ALLOC,
+  SAFI_CALL_MEMALIGN,
+  SAFI_CALL_VALLOC,
+  SAFI_CALL_PVALLOC,
+  SAFI_CALL_NEW,
+  SAFI_CALL_NEW_ARRAY,
+  SAFI_CALL_FREE,
+  SAFI_CALL_DELETE,
+  SAFI_CALL_DELETE_ARRAY,
+  SAFI_NUM_CALLS
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Plural name used in the reports, e.g. "mallocs"
+inline const char* safi_call_name(int call)
+{
+  static const char* const names[SAFI_NUM_CALLS] = {
+    "mallocs", "callocs", "reallocs", "reallocarrays", "posix_memaligns", "aligned_allocs",
+    "memaligns", "vallocs", "pvallocs", "operator news", "operator new[]s", "frees",
+    "operator deletes", "operator delete[]s"
+  };
+  return names[call];
+}
+
+
+// Identifier used by the machine-readable formats, e.g. "new_array"
+inline const char* safi_call_key(int call)
+{
+  static const char* const keys[SAFI_NUM_CALLS] = {
+    "malloc", "calloc", "realloc", "reallocarray", "posix_memalign", "aligned_alloc",
+    "memalign", "valloc", "pvalloc", "new", "new_array", "free",
+    "delete", "delete_array"
+  };
+  return keys[call];
+}
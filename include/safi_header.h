@@ -0,0 +1,103 @@
+/**
+ * @file safi_header.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Inline size header of the header mode (MEM_SAFI_HEADER=1). Every block
+ *        is allocated a few bytes larger and its metadata sits right before the
+ *        pointer given to the program, so free reads it in O(1) without a table.
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// Keeps the 16 bytes alignment of malloc, aligned blocks use a prefix of their alignment
+#define SAFI_HEADER_SIZE 16
+
+// Prefix with MEM_SAFI_LIFETIMES=1 or MEM_SAFI_THREADS=1, a SafiHeaderExt sits right before the SafiHeader
+#define SAFI_HEADER_EXT_SIZE 32
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Metadata stored in the last 16 bytes before the program's pointer
+ *
+ * The chunk starts 'prefix' bytes before the program's pointer: SAFI_HEADER_SIZE
+ * (SAFI_HEADER_EXT_SIZE when lifetimes or threads are tracked), or the alignment of
+ * the memalign family so the pointer stays aligned.
+ */
+struct SafiHeader
+{
+ public:
+  uint64_t requested; // Bytes asked for by the caller
+  uint32_t site; // Allocation site id in safiSites (0: unknown or not sampled)
+  uint16_t slack; // Usable bytes - requested bytes
+  uint8_t type; // SafiAllocType
+  uint8_t align_shift; // log2 of the prefix, 0 for SAFI_HEADER_SIZE
+
+  uint64_t usable() const { return requested + slack; }
+
+  size_t prefix() const { return align_shift == 0 ? SAFI_HEADER_SIZE : (size_t)1 << align_shift; }
+
+  // Start of the underlying chunk, what the original free() expects
+  void* base(void* user) const { return (char*)user - prefix(); }
+};
+
+static_assert(sizeof(SafiHeader) == SAFI_HEADER_SIZE, "SafiHeader must fill the prefix exactly");
+
+
+/**
+ * @brief Extra metadata in the 16 bytes before the SafiHeader, only with
+ *        prefixes of at least SAFI_HEADER_EXT_SIZE
+ */
+struct SafiHeaderExt
+{
+ public:
+  uint64_t birth; // safi_tsc() at allocation
+  uint32_t thread; // Allocating thread id in safiThreads
+  uint32_t unused;
+};
+
+static_assert(sizeof(SafiHeaderExt) + SAFI_HEADER_SIZE == SAFI_HEADER_EXT_SIZE, "SafiHeaderExt must fill the prefix exactly");
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+inline SafiHeader* safi_header_of(void* user)
+{
+  return (SafiHeader*)((char*)user - SAFI_HEADER_SIZE);
+}
+
+
+inline SafiHeaderExt* safi_header_ext(void* user)
+{
+  return (SafiHeaderExt*)((char*)user - SAFI_HEADER_EXT_SIZE);
+}
+
+
+/**
+ * @brief Prefix that keeps a block aligned to 'alignment' (a power of two)
+ *
+ * @param min_prefix SAFI_HEADER_SIZE, or SAFI_HEADER_EXT_SIZE to make room for a SafiHeaderExt
+ */
+inline size_t safi_header_prefix(size_t alignment, size_t min_prefix)
+{
+  return alignment <= min_prefix ? min_prefix : alignment;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file safi_heap.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief On-demand heap profiles (MEM_SAFI_HEAP_SIGNAL), in the legacy heap
+ *        profile text format read by pprof
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <limits.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_report.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// MEM_SAFI_HEAP_PREFIX, profiles are written to "<prefix>.<pid>.<n>.heap"
+#define DEFAULT_HEAP_PREFIX "/tmp/memsafi"
+
+// Stdio buffer of the profile stream, mapped once at start
+#define SAFI_HEAP_BUFFER_SIZE (64 * 1024)
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Writes heap profiles when the signal arrives, from its own thread
+ *
+ * The signal handler only posts a semaphore (one of the few async-signal-safe
+ * wake ups), the dumping thread does the walk and the writing. The profile is
+ * printed to a fopencookie() stream over the output fd, with a buffer mapped
+ * at start so stdio never allocates while dumping.
+ */
+struct SafiHeapProfiler
+{
+ public:
+  /**
+   * @brief Create the stream and, if 'signo' is not 0, install the handler and spawn the thread
+   *
+   * @param dump Prints one profile
+   * @return false if the stream or the handler could not be set up
+   */
+  bool start(SafiReportFnType dump, int signo, const char* prefix);
+
+  // Restore the previous handler and join the thread
+  void stop();
+
+  // Write one profile to 'fd' now, thread-safe
+  void dump_to(int fd, bool is_socket);
+
+  // Held across fork() like SafiReporter's
+  void lock_for_fork() { m_dump_mutex.lock(); }
+  void unlock_after_fork() { m_dump_mutex.unlock(); }
+
+  // Respawn the dumping thread in a forked child, the handler stays installed
+  void restart_in_child();
+
+ private:
+  SafiReportFnType m_dump = nullptr;
+  int m_signo = 0;
+  struct sigaction m_old_action = {};
+  char m_prefix[PATH_MAX] = {0};
+  int m_count = 0; // Profiles written to files
+
+  std::thread* m_thread = nullptr;
+  sem_t m_wakeup = {};
+  std::atomic<bool> m_stop {false};
+
+  FILE* m_stream = nullptr;
+  char* m_buffer = nullptr;
+  std::mutex m_dump_mutex; // Guards m_stream and the output below
+  int m_out_fd = -1;
+  bool m_out_socket = false;
+
+  // The instance the signal handler wakes up
+  static SafiHeapProfiler* s_active;
+
+  static void on_signal(int signo);
+
+  void dumper_loop();
+
+  // Opens the next "<prefix>.<pid>.<n>.heap" and dumps to it
+  void dump_to_file();
+
+  // fopencookie() write function, sends to m_out_fd
+  static ssize_t stream_write(void* cookie, const char* data, size_t size);
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Function Prototypes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Parse a signal given by number, or by name with or without "SIG" (e.g. "USR2")
+ *
+ * @return int The signal number, 0 if unknown
+ */
+int safi_parse_signal(const char* name);
@@ -0,0 +1,263 @@
+/**
+ * @file safi_histogram.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Log-linear (HDR style) histogram of the allocation sizes and object
+ *        lifetimes (MEM_SAFI_HISTOGRAMS=1). Every power of two is split in
+ *        SAFI_HIST_SUB_BUCKETS linear sub-buckets, so a bucket is at most 12.5%
+ *        wide and its index is a clz and two shifts.
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define SAFI_HIST_SUB_BITS 3
+#define SAFI_HIST_SUB_BUCKETS (1 << SAFI_HIST_SUB_BITS)
+
+// Values from 2^SAFI_HIST_MAX_BITS (256 TB, or 78 hours in ns) share the last bucket
+#define SAFI_HIST_MAX_BITS 48
+#define SAFI_HIST_BUCKETS ((SAFI_HIST_MAX_BITS - SAFI_HIST_SUB_BITS + 1) * SAFI_HIST_SUB_BUCKETS)
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Bucket of a value: values below SAFI_HIST_SUB_BUCKETS have their own,
+ *        then each power of two 2^e is split on the SAFI_HIST_SUB_BITS bits below e
+ */
+inline int safi_hist_index(uint64_t value)
+{
+  if (value < SAFI_HIST_SUB_BUCKETS) {
+    return (int)value;
+  }
+  if (value >= (1ull << SAFI_HIST_MAX_BITS)) {
+    return SAFI_HIST_BUCKETS - 1;
+  }
+  int exponent = 63 - __builtin_clzll(value);
+  int sub = (value >> (exponent - SAFI_HIST_SUB_BITS)) & (SAFI_HIST_SUB_BUCKETS - 1);
+  return (exponent - SAFI_HIST_SUB_BITS + 1) * SAFI_HIST_SUB_BUCKETS + sub;
+}
+
+
+// Smallest value of a bucket
+inline uint64_t safi_hist_lower(int index)
+{
+  if (index < SAFI_HIST_SUB_BUCKETS) {
+    return index;
+  }
+  int exponent = index / SAFI_HIST_SUB_BUCKETS + SAFI_HIST_SUB_BITS - 1;
+  uint64_t sub = index % SAFI_HIST_SUB_BUCKETS;
+  return (SAFI_HIST_SUB_BUCKETS + sub) << (exponent - SAFI_HIST_SUB_BITS);
+}
+
+
+// First value past a bucket
+inline uint64_t safi_hist_upper(int index)
+{
+  return index == SAFI_HIST_BUCKETS - 1 ? UINT64_MAX : safi_hist_lower(index + 1);
+}
+
+
+// Class k holds [2^(k-1), 2^k), class 0 holds 0, the last one everything above
+inline int safi_pow2_class(uint64_t value, int num_classes)
+{
+  int k = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  return k < num_classes ? k : num_classes - 1;
+}
+
+
+/**
+ * @brief Format bytes (B to TB) or a duration in ns (ns to s), values keep at least two digits
+ */
+inline void safi_format_value(char* buffer, size_t length, uint64_t value, bool in_ns)
+{
+  const char* byte_units[] = {"B", "kB", "MB", "GB", "TB"};
+  const char* time_units[] = {"ns", "us", "ms", "s"};
+  const char* const* units = in_ns ? time_units : byte_units;
+  int num_units = in_ns ? 4 : 5;
+  uint64_t divisor = in_ns ? 1000 : 1024;
+
+  int i = 0;
+  for (i = 0; value >= divisor * 10 && i < num_units - 1; i++) {
+    value /= divisor;
+  }
+  snprintf(buffer, length, "%lu %s", value, units[i]);
+}
+
+
+/**
+ * @brief Upper bound of the bucket holding the q-th quantile of the first
+ *        'num_buckets' buckets of the log-linear scheme above
+ *
+ * @param counts Plain or atomic counters
+ * @param q In [0, 1]
+ */
+template <typename Counter>
+inline uint64_t safi_hist_quantile(const Counter* counts, int num_buckets, double q)
+{
+  int64_t sum = 0;
+  for (int i = 0; i < num_buckets; i++) {
+    sum += (int64_t)counts[i];
+  }
+
+  int64_t rank = (int64_t)(q * sum);
+  int64_t seen = 0;
+  for (int i = 0; i < num_buckets; i++) {
+    seen += (int64_t)counts[i];
+    if (seen > rank) {
+      return safi_hist_upper(i) - 1;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Print the quantiles and one row per power of two (its sub-buckets
+ *        summed up), nothing if the histogram is empty
+ *
+ * @param counts SAFI_HIST_BUCKETS plain or atomic counters
+ * @param in_ns Values are durations in ns, else bytes
+ */
+template <typename Counter>
+inline void safi_hist_print(FILE* stream, const char* title, const Counter* counts, bool in_ns)
+{
+  int64_t sum = 0;
+  for (int i = 0; i < SAFI_HIST_BUCKETS; i++) {
+    sum += (int64_t)counts[i];
+  }
+  if (sum == 0) {
+    return;
+  }
+
+  char lower[32];
+  char upper[32];
+  fprintf(stream, "\n%s:\n", title);
+  const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  for (double q : quantiles) {
+    safi_format_value(lower, sizeof(lower), safi_hist_quantile(counts, SAFI_HIST_BUCKETS, q), in_ns);
+    fprintf(stream, "p%-5g <= %s\n", q * 100, lower);
+  }
+
+  int64_t cumulative = 0;
+  for (int first = 0; first < SAFI_HIST_BUCKETS; first += SAFI_HIST_SUB_BUCKETS) {
+    int64_t count = 0;
+    for (int i = first; i < first + SAFI_HIST_SUB_BUCKETS; i++) {
+      count += (int64_t)counts[i];
+    }
+    if (count == 0) {
+      continue;
+    }
+    cumulative += count;
+    safi_format_value(lower, sizeof(lower), safi_hist_lower(first), in_ns);
+    safi_format_value(upper, sizeof(upper), safi_hist_upper(first + SAFI_HIST_SUB_BUCKETS - 1) - 1, in_ns);
+    fprintf(stream, "  [%10s, %10s] %12ld %6.2f%% %6.2f%%\n", lower, upper, count, 100.0 * count / sum,
+            100.0 * cumulative / sum);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Counts per bucket, updated either by a single thread (stats shards)
+ *        or concurrently (global counters), read concurrently by the reporter
+ */
+struct SafiHistogram
+{
+ public:
+  std::atomic<int64_t> counts[SAFI_HIST_BUCKETS] = {};
+  std::atomic<int64_t> sum {0}; // Of the values, exact (the buckets are not)
+
+  // Thread-safe
+  void add(uint64_t value, int64_t count=1)
+  {
+    counts[safi_hist_index(value)].fetch_add(count, std::memory_order_relaxed);
+    sum.fetch_add(value * count, std::memory_order_relaxed);
+  }
+
+  // Single writer version, no locked read-modify-write (see SafiShard::add)
+  void add_local(uint64_t value, int64_t count=1)
+  {
+    std::atomic<int64_t>& bucket = counts[safi_hist_index(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    sum.store(sum.load(std::memory_order_relaxed) + value * count, std::memory_order_relaxed);
+  }
+
+  // Add the counts of 'other'
+  void merge(const SafiHistogram& other)
+  {
+    for (int i = 0; i < SAFI_HIST_BUCKETS; i++) {
+      int64_t count = other.counts[i].load(std::memory_order_relaxed);
+      if (count != 0) {
+        counts[i].fetch_add(count, std::memory_order_relaxed);
+      }
+    }
+    sum.fetch_add(other.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+
+  // Move the counts of 'other' here
+  void take(SafiHistogram& other)
+  {
+    for (int i = 0; i < SAFI_HIST_BUCKETS; i++) {
+      int64_t count = other.counts[i].exchange(0);
+      if (count != 0) {
+        counts[i].fetch_add(count, std::memory_order_relaxed);
+      }
+    }
+    sum.fetch_add(other.sum.exchange(0), std::memory_order_relaxed);
+  }
+
+  // Single writer, or no concurrent writer
+  void clear()
+  {
+    for (int i = 0; i < SAFI_HIST_BUCKETS; i++) {
+      counts[i].store(0, std::memory_order_relaxed);
+    }
+    sum.store(0, std::memory_order_relaxed);
+  }
+
+  int64_t total() const
+  {
+    int64_t count = 0;
+    for (int i = 0; i < SAFI_HIST_BUCKETS; i++) {
+      count += counts[i].load(std::memory_order_relaxed);
+    }
+    return count;
+  }
+
+  /**
+   * @brief Upper bound of the bucket holding the q-th quantile
+   *
+   * @param q In [0, 1]
+   */
+  uint64_t quantile(double q) const
+  {
+    return safi_hist_quantile(counts, SAFI_HIST_BUCKETS, q);
+  }
+
+  // See safi_hist_print()
+  void print(FILE* stream, const char* title, bool in_ns) const
+  {
+    safi_hist_print(stream, title, counts, in_ns);
+  }
+};
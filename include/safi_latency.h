@@ -0,0 +1,135 @@
+/**
+ * @file safi_latency.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Time spent inside the original allocator calls (MEM_SAFI_LATENCY=1),
+ *        per call type and per size class, in per-thread histograms of TSC ticks
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_call.h"
+#include "safi_histogram.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// First buckets of the log-linear scheme, calls of 2^32 ticks (about a second) and more share the last one
+#define SAFI_LATENCY_MAX_BITS 32
+#define SAFI_LATENCY_BUCKETS ((SAFI_LATENCY_MAX_BITS - SAFI_HIST_SUB_BITS + 1) * SAFI_HIST_SUB_BUCKETS)
+
+// Power of two classes of the block size, 4 MB and more share the last one
+#define SAFI_LATENCY_SIZE_CLASSES 24
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+struct SafiLatencyShard;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+extern __thread SafiLatencyShard* t_safi_latency_shard __attribute__((tls_model("initial-exec")));
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Latency histograms of one thread, single writer (relaxed load/store
+ *        pairs like SafiShard), read concurrently by the reporter
+ */
+struct SafiLatencyShard
+{
+ public:
+  std::atomic<int64_t> by_call[SAFI_NUM_CALLS][SAFI_LATENCY_BUCKETS] = {};
+  std::atomic<int64_t> by_size[SAFI_LATENCY_SIZE_CLASSES][SAFI_LATENCY_BUCKETS] = {};
+  std::atomic<int64_t> call_ticks[SAFI_NUM_CALLS] = {}; // Sum, for the means
+  std::atomic<int64_t> size_ticks[SAFI_LATENCY_SIZE_CLASSES] = {};
+
+  SafiLatencyShard* next = nullptr; // List of every shard ever created
+  SafiLatencyShard* next_free = nullptr; // List of shards released by exited threads
+
+  static void add(std::atomic<int64_t>& counter, const int64_t value)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+};
+
+
+/**
+ * @brief Owner of the latency shards. Shards of exited threads keep their
+ *        counts and are handed to the next new thread, so nothing is folded
+ */
+struct SafiLatencyTable
+{
+ public:
+  /**
+   * @brief Must be called before the first log()
+   *
+   * @return false if the thread-exit key could not be created
+   */
+  bool init();
+
+  // Thread-safe, 'size' is the requested (or freed) block size
+  void log(SafiCall call, size_t size, uint64_t ticks)
+  {
+    SafiLatencyShard* shard = t_safi_latency_shard;
+    if (shard == nullptr) {
+      shard = acquire_shard();
+      if (shard == nullptr) {
+        return;
+      }
+    }
+    int bucket = safi_hist_index(ticks);
+    bucket = bucket < SAFI_LATENCY_BUCKETS ? bucket : SAFI_LATENCY_BUCKETS - 1;
+    int size_class = safi_pow2_class(size, SAFI_LATENCY_SIZE_CLASSES);
+    SafiLatencyShard::add(shard->by_call[call][bucket], 1);
+    SafiLatencyShard::add(shard->by_size[size_class][bucket], 1);
+    SafiLatencyShard::add(shard->call_ticks[call], ticks);
+    SafiLatencyShard::add(shard->size_ticks[size_class], ticks);
+  }
+
+  // Thread-exit hook, the shard goes back to the free list
+  void retire_shard(SafiLatencyShard* shard);
+
+  /**
+   * @brief Print p50/p99/p99.9 and the mean per call type and per size class
+   *
+   * @param ns_per_tick Converts the TSC ticks
+   * @param elapsed_s Process time the calls happened in, for the share of time in the allocator
+   */
+  void print(FILE* stream, double ns_per_tick, double elapsed_s) const;
+
+ private:
+  pthread_key_t m_key {0};
+  SafiLatencyShard* m_shards {nullptr};
+  SafiLatencyShard* m_free_shards {nullptr};
+  mutable std::mutex m_mutex; // Guards the shard lists, never taken on the hot path
+
+  // Get a recycled shard or map a new one for the calling thread (nullptr if out of memory)
+  SafiLatencyShard* acquire_shard();
+};
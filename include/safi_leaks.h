@@ -0,0 +1,103 @@
+/**
+ * @file safi_leaks.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Leak report at exit (MEM_SAFI_LEAKS=1): the blocks never freed,
+ *        grouped by allocation site
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_sites.h"
+#include "safi_table.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// MEM_SAFI_LEAK_FILE, "%d" is the pid
+#define SAFI_LEAK_FILE_FORMAT "/tmp/memsafi.%d.leaks"
+
+#define DEFAULT_TOP_LEAKS 20 // MEM_SAFI_TOP_LEAKS, 0 prints every leaking site
+
+// The side table is walked by several threads past this many live blocks
+#define SAFI_LEAK_PARALLEL_BLOCKS (1 << 20)
+#define SAFI_MAX_LEAK_JOBS 16
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Blocks a tracked block stands for when sampled (see __sample_weight)
+typedef double (*SafiWeightFnType)(size_t requested);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+// Blocks still allocated from one site
+struct SafiLeakSite
+{
+ public:
+  int64_t blocks;
+  int64_t bytes; // Requested
+  uint64_t largest; // Requested bytes of the largest block, 0 when unknown
+};
+
+
+/**
+ * @brief Leaked blocks and bytes per site, gathered once at exit
+ *
+ * There is no reachability analysis: every block still allocated when the
+ * report is made counts as leaked, objects freed by static destructors are
+ * not since the report is made after them.
+ */
+struct SafiLeakTable
+{
+ public:
+  /**
+   * @brief Walk the side table, in parallel across shards when it is large
+   *
+   * @param jobs Walking threads, at most SAFI_MAX_LEAK_JOBS
+   * @return false if the memory could not be mapped
+   */
+  bool collect(SafiAllocTable& table, SafiWeightFnType weight, int jobs);
+
+  // Without the side table (headers), read the live counters of the sites
+  bool collect(const SafiSiteTable& sites);
+
+  /**
+   * @brief Print the 'count' sites with the most leaked bytes (all of them if 0)
+   *
+   * @param estimated The counters are scaled up from samples
+   */
+  void print(FILE* stream, const SafiSiteTable& sites, size_t count, bool estimated) const;
+
+ private:
+  SafiLeakSite* m_sites = nullptr; // SAFI_MAX_SITES entries, indexed by site id
+  uint32_t* m_order = nullptr; // Site ids by decreasing leaked bytes
+  size_t m_leaking = 0; // Sites in m_order
+  int m_jobs = 1; // Threads that walked the table
+
+  bool map();
+
+  // Fill and sort m_order
+  void sort();
+};
@@ -0,0 +1,119 @@
+/**
+ * @file safi_lifetime.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Time to free per size class (MEM_SAFI_LIFETIMES=1), to find the
+ *        short-lived allocations that could come from an arena or a pool
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_histogram.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// Power of two classes of the requested size, and of the lifetime in ns
+#define SAFI_LIFETIME_SIZE_CLASSES 48
+#define SAFI_LIFETIME_BUCKETS 48
+
+// Blocks freed within this time count as short-lived
+#define DEFAULT_SHORT_LIVED_US 100
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Lifetime buckets of every size class, updated concurrently with
+ *        relaxed atomics and read by the reporter
+ */
+struct SafiLifetimeTable
+{
+ public:
+  /**
+   * @param count Number of blocks this free stands for (more than 1 when sampled)
+   */
+  void log(size_t requested, uint64_t ns, int64_t count, bool short_lived)
+  {
+    int size_class = safi_pow2_class(requested, SAFI_LIFETIME_SIZE_CLASSES);
+    m_counts[size_class][safi_pow2_class(ns, SAFI_LIFETIME_BUCKETS)].fetch_add(count, std::memory_order_relaxed);
+    if (short_lived) {
+      m_short_lived[size_class].fetch_add(count, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief One row per size class: freed blocks, short-lived share and rate,
+   *        median and p99 lifetime (upper bounds of their power of two)
+   *
+   * @param elapsed_s Time the counts were gathered over
+   */
+  void print(FILE* stream, uint64_t short_lived_ns, double elapsed_s, bool estimated) const
+  {
+    char threshold[32];
+    safi_format_value(threshold, sizeof(threshold), short_lived_ns, true);
+    fprintf(stream, "\nLifetimes per size class%s (short-lived: freed within %s):\n",
+            estimated ? " (estimated from samples)" : "", threshold);
+
+    for (int size_class = 0; size_class < SAFI_LIFETIME_SIZE_CLASSES; size_class++) {
+      int64_t freed = 0;
+      for (int bucket = 0; bucket < SAFI_LIFETIME_BUCKETS; bucket++) {
+        freed += m_counts[size_class][bucket].load(std::memory_order_relaxed);
+      }
+      if (freed == 0) {
+        continue;
+      }
+
+      char lower[32];
+      char upper[32];
+      char p50[32];
+      char p99[32];
+      safi_format_value(lower, sizeof(lower), size_class == 0 ? 0 : 1ull << (size_class - 1), false);
+      safi_format_value(upper, sizeof(upper), (1ull << size_class) - 1, false);
+      safi_format_value(p50, sizeof(p50), quantile(size_class, freed, 0.5), true);
+      safi_format_value(p99, sizeof(p99), quantile(size_class, freed, 0.99), true);
+
+      int64_t short_lived = m_short_lived[size_class].load(std::memory_order_relaxed);
+      fprintf(stream, "  [%8s, %8s] freed: %10ld short-lived: %6.2f%% (%.0f/s) p50 < %s p99 < %s\n", lower, upper,
+              freed, 100.0 * short_lived / freed, short_lived / elapsed_s, p50, p99);
+    }
+  }
+
+ private:
+  std::atomic<int64_t> m_counts[SAFI_LIFETIME_SIZE_CLASSES][SAFI_LIFETIME_BUCKETS] = {};
+  std::atomic<int64_t> m_short_lived[SAFI_LIFETIME_SIZE_CLASSES] = {};
+
+  // Upper bound of the lifetime bucket holding the q-th quantile of a size class
+  uint64_t quantile(int size_class, int64_t freed, double q) const
+  {
+    int64_t rank = (int64_t)(q * freed);
+    int64_t seen = 0;
+    for (int bucket = 0; bucket < SAFI_LIFETIME_BUCKETS; bucket++) {
+      seen += m_counts[size_class][bucket].load(std::memory_order_relaxed);
+      if (seen > rank) {
+        return 1ull << bucket;
+      }
+    }
+    return 1ull << (SAFI_LIFETIME_BUCKETS - 1);
+  }
+};
@@ -0,0 +1,107 @@
+/**
+ * @file safi_memory.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Memory the malloc counters do not see: the program's own mappings
+ *        (mmap, munmap, mremap) and break (brk, sbrk), glibc's free bytes
+ *        (mallinfo2) and the resident size (MEM_SAFI_MEMORY=1)
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * glibc maps its large chunks and grows its arenas with internal calls, so the
+ * hooks only see the mappings made by the program and its libraries. Thread
+ * stacks and loaded libraries are not counted either, they only show in the RSS.
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Counters of the hooked mapping calls, and the /proc files read at
+ *        report time (opened once, read with pread so nothing is allocated)
+ */
+struct SafiMemoryStats
+{
+ public:
+  // Thread-safe, 'bytes' rounded up to pages
+  void log_map(size_t bytes)
+  {
+    ++m_mmap_calls;
+    update_peak(m_mapped.fetch_add(bytes) + bytes);
+  }
+
+  void log_unmap(size_t bytes)
+  {
+    ++m_munmap_calls;
+    m_mapped -= bytes;
+  }
+
+  void log_remap(size_t old_bytes, size_t new_bytes)
+  {
+    ++m_mremap_calls;
+    int64_t delta = (int64_t)new_bytes - (int64_t)old_bytes;
+    update_peak(m_mapped.fetch_add(delta) + delta);
+  }
+
+  // Thread-safe, 'delta' is the change of the program break
+  void log_brk(int64_t delta)
+  {
+    ++m_brk_calls;
+    m_brk_bytes += delta;
+  }
+
+  /**
+   * @brief Open /proc/self/statm (and /proc/self/smaps_rollup with 'pss', the
+   *        kernel walks the page tables to read it)
+   *
+   * @return false if the RSS cannot be read
+   */
+  bool init(bool pss);
+
+  // In a forked child, reopen the files: the old ones still describe the parent
+  void restart_in_child();
+
+  /**
+   * @brief Print the breakdown of the process memory
+   *
+   * @param live_heap Usable bytes of the live blocks (SafiStats)
+   */
+  void print(FILE* stream, int64_t live_heap) const;
+
+ private:
+  std::atomic<int64_t> m_mapped {0}; // Bytes mapped minus unmapped
+  std::atomic<int64_t> m_peak_mapped {0};
+  std::atomic<int64_t> m_brk_bytes {0};
+  std::atomic<int64_t> m_mmap_calls {0};
+  std::atomic<int64_t> m_munmap_calls {0};
+  std::atomic<int64_t> m_mremap_calls {0};
+  std::atomic<int64_t> m_brk_calls {0};
+
+  bool m_pss {false};
+  int m_statm_fd {-1};
+  int m_rollup_fd {-1};
+
+  void update_peak(const int64_t value)
+  {
+    int64_t peak = m_peak_mapped.load(std::memory_order_relaxed);
+    while (value > peak && !m_peak_mapped.compare_exchange_weak(peak, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  // Open the /proc files of the calling process
+  void open_files();
+};
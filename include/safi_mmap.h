@@ -0,0 +1,86 @@
+/**
+ * @file safi_mmap.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Page allocator used by MemSafi's own data structures. It goes straight
+ *        to mmap so it never re-enters the hooked malloc.
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * mmap and munmap are hooked too (see safi_memory.h), MemSafi's mappings make
+ * the system calls themselves and are counted apart from the program's.
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+
+// Bytes MemSafi currently has mapped for itself
+extern std::atomic<int64_t> safi_own_mapped;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief mmap() for MemSafi's own mappings, bypasses the hooked one
+ *
+ * @return void* MAP_FAILED on failure
+ */
+inline void* safi_sys_mmap(void* addr, size_t size, int prot, int flags, int fd, off_t offset)
+{
+  void* p = (void*)syscall(SYS_mmap, addr, size, prot, flags, fd, offset);
+  if (p != MAP_FAILED) {
+    safi_own_mapped.fetch_add(size, std::memory_order_relaxed);
+  }
+  return p;
+}
+
+
+// munmap() of a safi_sys_mmap() mapping (same size)
+inline int safi_sys_munmap(void* p, size_t size)
+{
+  int ret = syscall(SYS_munmap, p, size);
+  if (ret == 0) {
+    safi_own_mapped.fetch_sub(size, std::memory_order_relaxed);
+  }
+  return ret;
+}
+
+
+/**
+ * @brief Map 'size' bytes of zero-filled memory
+ *
+ * @return void* nullptr on failure
+ */
+inline void* safi_mmap_alloc(size_t size)
+{
+  void* p = safi_sys_mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return p == MAP_FAILED ? nullptr : p;
+}
+
+
+/**
+ * @brief Unmap memory returned by safi_mmap_alloc (same size)
+ */
+inline void safi_mmap_free(void* p, size_t size)
+{
+  if (p != nullptr) {
+    safi_sys_munmap(p, size);
+  }
+}
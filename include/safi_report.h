@@ -0,0 +1,132 @@
+/**
+ * @file safi_report.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Periodic reporter: formats the report into a preallocated buffer and
+ *        emits it with a single write(2) to the chosen fd or file
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+#include <thread>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// MEM_SAFI_REPORT_INTERVAL_MS, 0 disables the periodic reports (the one at exit stays)
+#define DEFAULT_REPORT_INTERVAL_MS 5000
+
+// Longer reports are cut, MEM_SAFI_REPORT_BUFFER_KB raises it
+#define DEFAULT_REPORT_BUFFER_SIZE (1024 * 1024)
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Prints one full report
+typedef void (*SafiReportFnType)(FILE* stream);
+
+// Takes one sample of the counters, from the reporting thread
+typedef void (*SafiSampleFnType)();
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Owner of the report output and of the periodic reporting thread
+ *
+ * The report functions print to a FILE, here a fmemopen() stream over a
+ * buffer mapped once at start. It is unbuffered so stdio never allocates
+ * on our behalf, and the whole report leaves with one write(2): it does
+ * not interleave with the program's own logs line by line.
+ */
+struct SafiReporter
+{
+ public:
+  /**
+   * @brief Map the buffer and, if 'interval_ms' is not 0, spawn the reporting thread
+   *
+   * @param fd Where the reports go, left open at stop() (the program may share it)
+   * @return false if the buffer could not be created, reports then go to stderr through stdio
+   */
+  bool start(SafiReportFnType report, int fd, int64_t interval_ms, size_t buffer_size);
+
+  /**
+   * @brief Also call 'sample' every 'interval_ms' from the reporting thread
+   *        (spawned for it even without periodic reports), must be called before start()
+   */
+  void set_sampler(SafiSampleFnType sample, int64_t interval_ms)
+  {
+    m_sample = sample;
+    m_sample_ms = interval_ms;
+  }
+
+  // Wake the reporting thread up and join it
+  void stop();
+
+  // Held across fork(), a report must not be half-written in the child's copy of the buffer
+  void lock_for_fork() { m_emit_mutex.lock(); }
+  void unlock_after_fork() { m_emit_mutex.unlock(); }
+
+  /**
+   * @brief Respawn the reporting thread in a forked child, threads do not survive fork()
+   *
+   * @param fd Output of the child
+   */
+  void restart_in_child(int fd);
+
+  int fd() const { return m_fd; }
+
+  // Print one report now, thread-safe
+  void emit() { emit_to(m_fd, m_report, false); }
+
+  /**
+   * @brief Print 'report' to 'fd' through the buffer, thread-safe
+   *
+   * @param is_socket Send with MSG_NOSIGNAL: a client that went away must not kill the process
+   */
+  void emit_to(int fd, SafiReportFnType report, bool is_socket);
+
+  // write(2) (or send(2)) the whole buffer, retried on partial writes and EINTR
+  static void write_all(int fd, const char* data, size_t size, bool is_socket);
+
+ private:
+  SafiReportFnType m_report = nullptr;
+  int m_fd = 2;
+  int64_t m_interval_ms = 0;
+  SafiSampleFnType m_sample = nullptr;
+  int64_t m_sample_ms = 0;
+
+  char* m_buffer = nullptr;
+  size_t m_buffer_size = 0;
+  FILE* m_stream = nullptr; // Over m_buffer
+  std::mutex m_emit_mutex; // Guards m_stream
+
+  // A pthread condition variable: std::condition_variable is not constant-initialized
+  std::thread* m_thread = nullptr;
+  pthread_mutex_t m_stop_mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t m_stop_cond = PTHREAD_COND_INITIALIZER; // Re-initialized on CLOCK_MONOTONIC at start()
+  bool m_stop = false; // Guarded by m_stop_mutex
+
+  // Spawn the reporting thread, its condition variable waits on CLOCK_MONOTONIC
+  void spawn();
+
+  void reporter_loop();
+};
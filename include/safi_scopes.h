@@ -0,0 +1,142 @@
+/**
+ * @file safi_scopes.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Profiling scopes (MEM_SAFI_SCOPES=1, see memsafi.h): the scope stack
+ *        of every thread and the live and total bytes of every tag
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// Distinct tags, the ones past it share SAFI_OTHER_TAGS
+#define SAFI_MAX_TAGS 64
+#define SAFI_TAG_NAME_SIZE 32
+
+// Allocations of an enabled thread outside any scope
+#define SAFI_NO_TAG 0
+#define SAFI_OTHER_TAGS 1
+
+// Nested scopes past this depth keep the tag of the deepest one
+#define SAFI_MAX_SCOPE_DEPTH 16
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Scope stack of one thread, only the owner touches it
+struct SafiThreadScope
+{
+ public:
+  uint32_t depth; // Scopes begun and not ended, possibly deeper than the stack
+  bool enabled; // memsafi_thread_enable()
+  uint8_t tags[SAFI_MAX_SCOPE_DEPTH];
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+extern __thread SafiThreadScope t_safi_scope __attribute__((tls_model("initial-exec")));
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Whether the calling thread's allocations are tracked, the check behind every scoped wrapper
+inline bool safi_scope_active()
+{
+  return t_safi_scope.depth != 0 || t_safi_scope.enabled;
+}
+
+
+// Tag of the calling thread's next allocation
+inline uint8_t safi_scope_tag()
+{
+  uint32_t depth = t_safi_scope.depth;
+  if (depth == 0) {
+    return SAFI_NO_TAG;
+  }
+  return t_safi_scope.tags[(depth < SAFI_MAX_SCOPE_DEPTH ? depth : SAFI_MAX_SCOPE_DEPTH) - 1];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief One tag and the bytes allocated under it
+ */
+struct SafiTag
+{
+ public:
+  // 0: empty, 1: being written by the thread that claimed it, 2: ready
+  std::atomic<int> state {0};
+  char name[SAFI_TAG_NAME_SIZE] = {0};
+
+  std::atomic<int64_t> live_bytes {0};
+  std::atomic<int64_t> live_blocks {0};
+  std::atomic<int64_t> total_bytes {0};
+  std::atomic<int64_t> total_allocs {0};
+};
+
+
+/**
+ * @brief Fixed, insert-only table of the tags. It is small and static, so
+ *        scopes work before the init and without any mapping
+ */
+struct SafiTagTable
+{
+ public:
+  /**
+   * @brief Find or insert a tag, lock-free like SafiSiteTable::intern()
+   *
+   * @return uint8_t Tag id (SAFI_OTHER_TAGS if the table is full)
+   */
+  uint8_t intern(const char* name);
+
+  // Thread-safe, requested bytes of a block entering or leaving the side table
+  void log_alloc(uint8_t tag, int64_t bytes)
+  {
+    SafiTag& t = m_tags[tag];
+    t.live_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    t.live_blocks.fetch_add(1, std::memory_order_relaxed);
+    t.total_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    t.total_allocs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void log_free(uint8_t tag, int64_t bytes)
+  {
+    SafiTag& t = m_tags[tag];
+    t.live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    t.live_blocks.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // After fork() in the child, the live blocks become its only allocations (see SafiStats::rebase)
+  void rebase();
+
+  // Print every tag that allocated, by decreasing live bytes
+  void print(FILE* stream) const;
+
+ private:
+  SafiTag m_tags[SAFI_MAX_TAGS];
+};
@@ -0,0 +1,91 @@
+/**
+ * @file safi_shm.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Publisher of the live stats in a shared-memory segment (MEM_SAFI_SHM=1),
+ *        read by memsafi-top without any help from the profiled process
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <pthread.h>
+#include <stdint.h>
+
+#include <thread>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_shm_format.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// MEM_SAFI_SHM_INTERVAL_MS, period of the copies while a reader is attached
+#define DEFAULT_SHM_INTERVAL_MS 100
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Fills the stats of the segment, called with the sequence lock held
+typedef void (*SafiPublishFnType)(SafiShmSegment* segment);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Owner of the segment and of the publishing thread
+ *
+ * The thread wakes up every interval, and only copies the counters (under
+ * the sequence lock of safi_shm_format.h) while a reader's heartbeat is
+ * recent: an unobserved process pays one clock read per interval.
+ */
+struct SafiShmPublisher
+{
+ public:
+  /**
+   * @brief Create "/memsafi.<pid>" and spawn the publishing thread
+   *
+   * @return false if the segment could not be created
+   */
+  bool start(SafiPublishFnType publish, int64_t interval_ms);
+
+  // Join the thread and remove the segment
+  void stop();
+
+  /**
+   * @brief In a forked child, drop the parent's mapping and thread (left to
+   *        the parent) and publish to a new "/memsafi.<pid>" if it was running
+   */
+  void restart_in_child();
+
+ private:
+  SafiPublishFnType m_publish = nullptr;
+  SafiShmSegment* m_segment = nullptr;
+  char m_name[32] = {0};
+  int64_t m_interval_ms = DEFAULT_SHM_INTERVAL_MS;
+
+  // Same stop protocol as SafiReporter
+  std::thread* m_thread = nullptr;
+  pthread_mutex_t m_stop_mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t m_stop_cond = PTHREAD_COND_INITIALIZER; // Re-initialized on CLOCK_MONOTONIC at start()
+  bool m_stop = false; // Guarded by m_stop_mutex
+
+  void publisher_loop();
+
+  // One copy under the sequence lock, if a reader is attached
+  void publish();
+};
@@ -0,0 +1,94 @@
+/**
+ * @file safi_shm_format.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Layout of the shared-memory stats segment (MEM_SAFI_SHM=1), shared by
+ *        the library and memsafi-top
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * The segment is the POSIX shared memory object "/memsafi.<pid>", a single
+ * SafiShmSegment. The library is the only writer and guards the stats with
+ * a sequence lock: 'seq' is odd while a copy is in progress, a reader copies
+ * the segment and retries if 'seq' was odd or changed in between.
+ *
+ * Publishing is only done on demand: readers store the time they read at in
+ * 'reader_heartbeat_ns', and the library stops copying its counters once no
+ * reader has shown up for SAFI_SHM_READER_TIMEOUT_NS.
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_call.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define SAFI_SHM_MAGIC 0x314D485349464153ull // "SAFISHM1"
+#define SAFI_SHM_VERSION 1
+#define SAFI_SHM_NAME_FORMAT "/memsafi.%d"
+
+#define SAFI_SHM_TOP_SITES 32
+#define SAFI_SHM_SITE_FRAMES 4 // Innermost frames of a site
+
+#define SAFI_SHM_READER_TIMEOUT_NS 3000000000ll
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+// One of the sites with the most live bytes
+struct SafiShmSite
+{
+ public:
+  uint32_t id;
+  uint32_t depth; // Frames set in 'frames'
+  int64_t live_bytes;
+  int64_t live_blocks;
+  int64_t total_bytes;
+  int64_t total_allocs;
+  uint64_t frames[SAFI_SHM_SITE_FRAMES]; // Return addresses in the target process
+};
+
+
+struct SafiShmSegment
+{
+ public:
+  // Constant after creation
+  uint64_t magic;
+  uint32_t version;
+  uint32_t size; // sizeof(SafiShmSegment)
+  int64_t pid;
+  int64_t interval_ms; // Publishing period while a reader is active
+
+  // Written by the readers (CLOCK_MONOTONIC)
+  int64_t reader_heartbeat_ns;
+
+  // Written by the library under the sequence lock
+  uint64_t seq;
+  int64_t publish_ns; // CLOCK_REALTIME of the copy
+  int64_t reserved; // Bytes
+  int64_t peak; // Bytes
+  int64_t peak_accuracy; // +/- bytes, 0 when exact
+  int64_t total_reserved; // Bytes
+  int64_t freed; // Bytes
+  int64_t num_calls[SAFI_NUM_CALLS]; // Indexed by SafiCall
+  int64_t requested; // Live requested bytes, -1 without the side table or the headers
+  int64_t sample_bytes; // The requested bytes and the sites are estimated when not 0
+  uint32_t num_sites; // 0 without MEM_SAFI_SITES=1
+  uint32_t unused;
+  SafiShmSite sites[SAFI_SHM_TOP_SITES]; // By decreasing live bytes
+};
@@ -0,0 +1,150 @@
+/**
+ * @file safi_sites.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Allocation-site (call stack) interning and per-site accounting
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define SAFI_MAX_STACK_DEPTH 16
+#define DEFAULT_STACK_DEPTH 8
+
+// Number of distinct stacks that can be interned, must be a power of two
+#define SAFI_MAX_SITES (1 << 16)
+
+// Site used when the stack is unknown or the site table is full
+#define SAFI_UNKNOWN_SITE 0
+
+#define DEFAULT_TOP_SITES 10
+#define SAFI_MAX_TOP_SITES 100
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief One interned call stack and the bytes allocated from it
+ */
+struct SafiSite
+{
+ public:
+  // 0: empty, 1: being written by the thread that claimed it, else the stack hash
+  std::atomic<uint64_t> key {0};
+  uint32_t depth = 0;
+  void* frames[SAFI_MAX_STACK_DEPTH] = {nullptr};
+
+  std::atomic<int64_t> live_bytes {0};
+  std::atomic<int64_t> live_blocks {0};
+  std::atomic<int64_t> total_bytes {0};
+  std::atomic<int64_t> total_allocs {0};
+  std::atomic<int64_t> short_lived {0}; // Blocks freed within the short-lived threshold (MEM_SAFI_LIFETIMES=1)
+};
+
+
+/**
+ * @brief Lock-free, insert-only hash set of call stacks
+ *
+ * A stack is interned once (the slot is claimed with a CAS and published by
+ * storing its hash), after that the hot path only hashes the frames and finds
+ * the slot. Frames are stored as raw return addresses, symbolization is done
+ * by print_top() at report time.
+ */
+struct SafiSiteTable
+{
+ public:
+  /**
+   * @brief Map the site table, must be called before intern()
+   *
+   * @return false if the memory could not be mapped
+   */
+  bool init();
+
+  /**
+   * @brief Find or insert a call stack
+   *
+   * @return uint32_t Site id (SAFI_UNKNOWN_SITE if the table is full)
+   */
+  uint32_t intern(void* const* frames, int depth);
+
+  // 'blocks' is more than 1 when a sampled allocation stands for several ones
+  void log_alloc(uint32_t site, int64_t bytes, int64_t blocks=1)
+  {
+    SafiSite& s = m_sites[site];
+    s.live_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    s.live_blocks.fetch_add(blocks, std::memory_order_relaxed);
+    s.total_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    s.total_allocs.fetch_add(blocks, std::memory_order_relaxed);
+  }
+
+  void log_free(uint32_t site, int64_t bytes, int64_t blocks=1)
+  {
+    SafiSite& s = m_sites[site];
+    s.live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    s.live_blocks.fetch_sub(blocks, std::memory_order_relaxed);
+  }
+
+  void log_short_lived(uint32_t site, int64_t blocks=1)
+  {
+    m_sites[site].short_lived.fetch_add(blocks, std::memory_order_relaxed);
+  }
+
+  // nullptr for ids that were never interned
+  const SafiSite* get(uint32_t site) const
+  {
+    if (m_sites == nullptr || site == SAFI_UNKNOWN_SITE || site >= SAFI_MAX_SITES) {
+      return nullptr;
+    }
+    const SafiSite& s = m_sites[site];
+    return s.key.load(std::memory_order_acquire) > 1 ? &s : nullptr;
+  }
+
+  /**
+   * @brief Ids of the 'count' (at most SAFI_MAX_TOP_SITES) sites with the most live bytes
+   *
+   * @return size_t Number of ids written to 'top'
+   */
+  size_t top_live(uint32_t* top, size_t count) const;
+
+  // After fork() in the child, the live blocks become its only allocations (see SafiStats::rebase)
+  void rebase();
+
+  // Print the frames of a site symbolized with dladdr, one per line
+  void print_frames(FILE* stream, uint32_t site) const;
+
+  /**
+   * @brief Print the 'count' sites with the most live bytes, symbolized with dladdr
+   *
+   * @param estimated The counters are scaled up from samples
+   */
+  void print_top(FILE* stream, size_t count, bool estimated=false) const;
+
+  /**
+   * @brief Print the 'count' sites with the most short-lived blocks, a worklist
+   *        of allocations to move to an arena or a pool
+   *
+   * @param threshold_us Lifetime under which a block is short-lived
+   * @param elapsed_s Time the counters were gathered over, for the rates
+   */
+  void print_churn(FILE* stream, size_t count, uint64_t threshold_us, double elapsed_s, bool estimated=false) const;
+
+ private:
+  SafiSite* m_sites = nullptr; // SAFI_MAX_SITES entries, slot 0 is SAFI_UNKNOWN_SITE
+};
@@ -0,0 +1,96 @@
+/**
+ * @file safi_snapshot.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Plain copy of the SafiStats counters and its formatters: the human
+ *        report, JSON lines and the Prometheus text exposition format
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <stdio.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_call.h"
+#include "safi_histogram.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// MEM_SAFI_REPORT_FORMAT=text|json|prometheus
+enum SafiReportFormat
+{
+  SAFI_FORMAT_TEXT = 0,
+  SAFI_FORMAT_JSON,
+  SAFI_FORMAT_PROMETHEUS,
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Exact values of the statistics at one point in time, bytes are not rounded
+ *
+ * Filled by SafiStats::snapshot(), the counters are read one by one with
+ * relaxed loads so they can be off by the calls that raced with the copy.
+ */
+struct SafiSnapshot
+{
+ public:
+  int64_t timestamp_ns = 0; // CLOCK_REALTIME
+  int64_t pid = 0;
+  int64_t init_ns = 0; // Time spent in the library's init
+
+  int64_t reserved = 0; // Bytes
+  int64_t peak = 0; // Bytes
+  bool sharded = false;
+  int64_t peak_accuracy = 0; // +/- bytes of the peak, 0 when exact
+  int64_t total_reserved = 0; // Bytes
+  int64_t freed = 0; // Bytes
+
+  int64_t num_calls[SAFI_NUM_CALLS] = {}; // Indexed by SafiCall
+
+  bool track_requested = false; // The requested stats below are valid
+  int64_t sample_bytes = 0; // Requested bytes are estimated from samples when not 0
+  int64_t total_requested = 0; // Bytes
+  int64_t freed_requested = 0; // Bytes
+
+  bool histograms = false; // The histograms below are valid
+  int64_t sizes[SAFI_HIST_BUCKETS] = {}; // Requested bytes of every allocation
+  int64_t sizes_sum = 0;
+  int64_t lifetimes[SAFI_HIST_BUCKETS] = {}; // ns between allocation and free
+  int64_t lifetimes_sum = 0;
+
+  int64_t requested() const { return total_requested - freed_requested; }
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Function Prototypes
+////////////////////////////////////////////////////////////////////////////////
+
+// The human readable report
+void safi_print_text(FILE* stream, const SafiSnapshot& snapshot);
+
+// One JSON object on a single line
+void safi_print_json(FILE* stream, const SafiSnapshot& snapshot);
+
+// Prometheus text exposition format, the histograms have one bucket per power of two
+void safi_print_prometheus(FILE* stream, const SafiSnapshot& snapshot);
+
+// Parse MEM_SAFI_REPORT_FORMAT, text for nullptr or an unknown name
+SafiReportFormat safi_report_format(const char* name);
@@ -0,0 +1,85 @@
+/**
+ * @file safi_socket.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Unix domain socket taking on-demand commands (MEM_SAFI_SOCKET), e.g.
+ *        `echo json | nc -U /tmp/memsafi.<pid>.sock`
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <sys/un.h>
+
+#include <atomic>
+#include <thread>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// Socket path for MEM_SAFI_SOCKET=1
+#define SAFI_SOCKET_PATH_FORMAT "/tmp/memsafi.%d.sock"
+
+// Longest command line, and how long a client has to send it
+#define SAFI_COMMAND_SIZE 128
+#define SAFI_COMMAND_TIMEOUT_MS 1000
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Runs one command (without its line feed) and writes the answer to 'fd'
+typedef void (*SafiCommandFnType)(const char* command, int fd);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Listens on the socket and runs one command per connection, one
+ *        connection at a time, from its own thread
+ */
+struct SafiCommandServer
+{
+ public:
+  /**
+   * @brief Bind the socket (an existing file at 'path' is replaced) and spawn the thread
+   *
+   * @return false if the socket could not be created
+   */
+  bool start(const char* path, SafiCommandFnType handler);
+
+  // Wake the thread up from accept(), join it and remove the socket
+  void stop();
+
+  bool running() const { return m_thread != nullptr; }
+
+  /**
+   * @brief In a forked child, close the parent's socket (left to the parent)
+   *        and listen on 'path' if it was running
+   *
+   * @param path nullptr to not listen in the child
+   */
+  void restart_in_child(const char* path);
+
+ private:
+  SafiCommandFnType m_handler = nullptr;
+  int m_fd = -1;
+  std::atomic<bool> m_stop {false};
+  std::thread* m_thread = nullptr;
+  struct sockaddr_un m_address = {};
+
+  void server_loop();
+
+  // Read one command line from a client and run it
+  void serve(int client);
+};
@@ -0,0 +1,219 @@
+/**
+ * @file safi_table.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Concurrent pointer -> allocation metadata side table
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define SAFI_TABLE_SHARD_BITS 6
+#define SAFI_TABLE_SHARDS (1 << SAFI_TABLE_SHARD_BITS)
+
+// Entries per shard, must be a power of two
+#define SAFI_TABLE_INITIAL_CAPACITY 1024
+
+// Grow a shard when it is more than 70% full
+#define SAFI_TABLE_MAX_LOAD_PERCENT 70
+
+// Busy-wait iterations before a waiting thread yields
+#define SAFI_SPIN_LIMIT 100
+
+// Counters of the optional presence filter, must be a power of two
+#define SAFI_FILTER_SIZE (1 << 20)
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+enum SafiAllocType : uint8_t
+{
+  SAFI_ALLOC_MALLOC = 0,
+  SAFI_ALLOC_CALLOC,
+  SAFI_ALLOC_REALLOC,
+  SAFI_ALLOC_MEMALIGN, // posix_memalign, aligned_alloc, memalign, valloc and pvalloc
+  SAFI_ALLOC_NEW, // Every operator new
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Metadata recorded for every live allocation
+ */
+struct SafiAllocEntry
+{
+ public:
+  uintptr_t ptr = 0; // 0 marks an empty slot
+  uint64_t requested = 0; // Bytes asked for by the caller
+  uint64_t timestamp = 0; // safi_tsc() at allocation
+  uint32_t slack = 0; // Usable bytes - requested bytes
+  uint32_t site = 0; // Allocation site id in safiSites (0: unknown)
+  SafiAllocType type = SAFI_ALLOC_MALLOC;
+  uint8_t tag = 0; // Scope tag in safiTags (MEM_SAFI_SCOPES=1)
+  uint32_t thread = 0; // Allocating thread id in safiThreads (MEM_SAFI_THREADS=1)
+
+  uint64_t usable() const { return requested + slack; }
+};
+
+
+/**
+ * @brief Test-and-test-and-set lock, the critical sections it guards are a few
+ *        probes long so spinning beats parking the thread
+ */
+struct SafiSpinLock
+{
+ public:
+  void lock()
+  {
+    while (m_locked.exchange(true, std::memory_order_acquire)) {
+      for (int spins = 0; m_locked.load(std::memory_order_relaxed); spins++) {
+        // The owner may have been preempted, give it the CPU back
+        if (spins >= SAFI_SPIN_LIMIT) {
+          sched_yield();
+          spins = 0;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+      }
+    }
+  }
+
+  void unlock() { m_locked.store(false, std::memory_order_release); }
+
+ private:
+  std::atomic<bool> m_locked {false};
+};
+
+
+/**
+ * @brief One open-addressing (linear probing) hash table, guarded by its lock
+ */
+struct alignas(64) SafiTableShard
+{
+ public:
+  SafiSpinLock lock;
+  SafiAllocEntry* entries = nullptr;
+  size_t capacity = 0;
+  size_t size = 0;
+};
+
+
+/**
+ * @brief Pointer -> SafiAllocEntry table, sharded by pointer hash
+ *
+ * Every shard is an independent open-addressing table with its own lock, so
+ * threads only contend when their pointers hash to the same shard. Deletion
+ * uses backward shifting, hence there are no tombstones and the probe
+ * sequences stay short. All memory comes from safi_mmap_alloc.
+ */
+struct SafiAllocTable
+{
+ public:
+  /**
+   * @brief Record a new allocation (the pointer must not be in the table)
+   *
+   * @return false if the table could not grow (out of memory)
+   */
+  bool insert(const SafiAllocEntry& entry);
+
+  /**
+   * @brief Remove a pointer from the table
+   *
+   * @param entry Receives the removed metadata
+   * @return false if the pointer is unknown
+   */
+  bool remove(uintptr_t ptr, SafiAllocEntry& entry);
+
+  // Whether a pointer is in the table, unknown pointers usually only cost a filter load
+  bool contains(uintptr_t ptr);
+
+  // Number of live entries (racy snapshot)
+  size_t size() const;
+
+  /**
+   * @brief Call 'visit(entry)' on every live entry of the shards [first, last),
+   *        one shard at a time: an allocation only waits for the walk of its
+   *        own shard, never the whole table
+   */
+  template <typename Visitor>
+  void for_each(Visitor visit, size_t first=0, size_t last=SAFI_TABLE_SHARDS)
+  {
+    for (size_t s = first; s < last; s++) {
+      SafiTableShard& shard = m_shards[s];
+      std::lock_guard<SafiSpinLock> guard(shard.lock);
+      for (size_t i = 0; i < shard.capacity; i++) {
+        if (shard.entries[i].ptr != 0) {
+          visit(shard.entries[i]);
+        }
+      }
+    }
+  }
+
+  // Held across fork(): a shard locked by another thread would stay locked in the child
+  void lock_all()
+  {
+    for (SafiTableShard& shard : m_shards) {
+      shard.lock.lock();
+    }
+  }
+
+  void unlock_all()
+  {
+    for (SafiTableShard& shard : m_shards) {
+      shard.lock.unlock();
+    }
+  }
+
+  /**
+   * @brief Enable a counting filter that lets remove() reject unknown pointers
+   *        without taking a lock. Worth it when only a few of the pointers are
+   *        in the table (sampling), must be called before the first insert()
+   *
+   * @return false if the filter could not be mapped
+   */
+  bool enable_filter();
+
+ private:
+  SafiTableShard m_shards[SAFI_TABLE_SHARDS];
+  std::atomic<uint16_t>* m_filter = nullptr;
+
+  static uint64_t hash(uintptr_t ptr)
+  {
+    // MurmurHash3 finalizer, heap pointers share most of their bits
+    uint64_t h = ptr;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+
+  SafiTableShard& shard_of(uint64_t h) { return m_shards[h >> (64 - SAFI_TABLE_SHARD_BITS)]; }
+
+  // Uses hash bits that select neither the shard nor (usually) the slot
+  std::atomic<uint16_t>& filter_of(uint64_t h) { return m_filter[(h >> 24) & (SAFI_FILTER_SIZE - 1)]; }
+
+  bool grow(SafiTableShard& shard);
+};
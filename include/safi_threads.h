@@ -0,0 +1,161 @@
+/**
+ * @file safi_threads.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Per-thread memory breakdown (MEM_SAFI_THREADS=1): live and total bytes
+ *        of every thread, kept after it exits, and the cross-thread frees
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <mutex>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// Threads past this number share SAFI_OTHER_THREADS
+#define SAFI_MAX_THREADS 4096
+#define SAFI_OTHER_THREADS 0
+
+#define SAFI_THREAD_NAME_SIZE 16 // Same as the kernel's comm
+#define DEFAULT_TOP_THREADS 10
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+
+// Record of the calling thread, 0 until its first allocation
+extern __thread uint32_t t_safi_thread __attribute__((tls_model("initial-exec")));
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Counters of one thread
+ *
+ * The owner is the only writer of its own counters, so they are relaxed
+ * load/store pairs like SafiShard. Only the bytes other threads free are
+ * locked read-modify-writes, they are the rare (and interesting) case.
+ */
+struct alignas(64) SafiThreadRecord
+{
+ public:
+  std::atomic<int64_t> allocated_bytes {0};
+  std::atomic<int64_t> allocs {0};
+  std::atomic<int64_t> freed_bytes {0}; // Own blocks freed by the owner
+  std::atomic<int64_t> remote_frees {0}; // Blocks of other threads freed by the owner
+  std::atomic<int64_t> remote_freed_bytes {0};
+
+  std::atomic<int64_t> freed_by_others {0}; // Own blocks freed by other threads
+  std::atomic<int64_t> freed_by_others_bytes {0};
+
+  std::atomic<int32_t> tid {0};
+  std::atomic<bool> exited {false};
+  pthread_t handle {};
+  char name[SAFI_THREAD_NAME_SIZE] = {0}; // Guarded by SafiThreadTable::m_names_mutex
+
+  int64_t live_bytes() const
+  {
+    return allocated_bytes.load(std::memory_order_relaxed) - freed_bytes.load(std::memory_order_relaxed) -
+           freed_by_others_bytes.load(std::memory_order_relaxed);
+  }
+};
+
+
+/**
+ * @brief Fixed table of thread records, a record is never reused so the
+ *        counters of exited threads stay in the report
+ */
+struct SafiThreadTable
+{
+ public:
+  /**
+   * @brief Map the records and create the thread-exit key, must be called before log_alloc()
+   *
+   * @return false on failure
+   */
+  bool init();
+
+  /**
+   * @brief Account for 'count' blocks (more than 1 when sampled) allocated by the calling thread
+   *
+   * @return uint32_t Record of the calling thread, to be stored with the block
+   */
+  uint32_t log_alloc(int64_t bytes, int64_t count)
+  {
+    uint32_t id = t_safi_thread;
+    if (id == SAFI_OTHER_THREADS) {
+      id = register_thread();
+    }
+    SafiThreadRecord& record = m_records[id];
+    add(record.allocated_bytes, bytes, id);
+    add(record.allocs, count, id);
+    return id;
+  }
+
+  // Thread-safe, 'owner' is what log_alloc returned for the block
+  void log_free(uint32_t owner, int64_t bytes, int64_t count)
+  {
+    uint32_t id = t_safi_thread;
+    if (id == SAFI_OTHER_THREADS) {
+      id = register_thread();
+    }
+    if (owner == id) {
+      add(m_records[id].freed_bytes, bytes, id);
+      return;
+    }
+
+    // Cross-thread free
+    add(m_records[id].remote_frees, count, id);
+    add(m_records[id].remote_freed_bytes, bytes, id);
+    m_records[owner].freed_by_others.fetch_add(count, std::memory_order_relaxed);
+    m_records[owner].freed_by_others_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  // Thread-exit hook: the record keeps its counters and the final thread name
+  void retire_thread(SafiThreadRecord* record);
+
+  /**
+   * @brief Print the 'count' threads and thread names with the most live bytes,
+   *        and the cross-thread frees
+   *
+   * @param estimated The counters are scaled up from samples
+   */
+  void print(FILE* stream, size_t count, bool estimated) const;
+
+ private:
+  SafiThreadRecord* m_records {nullptr}; // SAFI_MAX_THREADS records, 0 is SAFI_OTHER_THREADS
+  std::atomic<uint32_t> m_num_records {1};
+  pthread_key_t m_key {0};
+  mutable std::mutex m_names_mutex; // Never taken on the hot path
+
+  // Single writer increment, except on the shared record
+  static void add(std::atomic<int64_t>& counter, const int64_t value, uint32_t id)
+  {
+    if (id == SAFI_OTHER_THREADS) {
+      counter.fetch_add(value, std::memory_order_relaxed);
+      return;
+    }
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  // Claim a record for the calling thread (SAFI_OTHER_THREADS once the table is full)
+  uint32_t register_thread();
+};
@@ -0,0 +1,116 @@
+/**
+ * @file safi_timeline.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Time series of the allocation rates and of the live bytes
+ *        (MEM_SAFI_TIMELINE_MS=<interval>), in a ring that never grows
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_snapshot.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+
+// Samples kept (MEM_SAFI_TIMELINE_SAMPLES), the oldest are overwritten
+#define DEFAULT_TIMELINE_SAMPLES 600
+
+// Most recent samples printed in the text report
+#define SAFI_TIMELINE_REPORT_ROWS 10
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Deltas of the counters over one interval
+struct SafiTimelineSample
+{
+ public:
+  int64_t timestamp_ns; // CLOCK_REALTIME at the end of the interval
+  int64_t interval_ns;
+  int64_t allocs; // Allocating calls, a realloc included
+  int64_t frees;
+  int64_t alloc_bytes;
+  int64_t freed_bytes;
+  int64_t live_bytes; // At the end of the interval
+  int64_t peak_bytes; // Highest live bytes within the interval
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Ring of the samples, written by the reporting thread and read by the
+ *        reports, the socket and the heap profiles under a mutex
+ */
+struct SafiTimeline
+{
+ public:
+  /**
+   * @brief Map the ring of 'capacity' samples
+   *
+   * @return false if it could not be mapped
+   */
+  bool init(size_t capacity);
+
+  /**
+   * @brief Append the deltas of 'snapshot' since the previous sample
+   *
+   * @param interval_peak Highest reserved bytes since the previous sample
+   */
+  void sample(const SafiSnapshot& snapshot, int64_t interval_peak);
+
+  // In a forked child, drop the parent's samples and restart from the rebased counters
+  void restart_in_child(const SafiSnapshot& snapshot);
+
+  // Rates of the most recent samples, and the busiest interval
+  void print_text(FILE* stream) const;
+
+  // One JSON object per sample (JSON lines), oldest first
+  void print_json(FILE* stream) const;
+
+  // The samples as '#' comment lines, skipped by pprof, for the heap profiles
+  void print_comments(FILE* stream) const;
+
+ private:
+  SafiTimelineSample* m_ring {nullptr};
+  size_t m_capacity {0};
+  uint64_t m_count {0}; // Samples ever taken, the next one goes to m_count % m_capacity
+  mutable std::mutex m_mutex;
+
+  // Counters of the previous sample
+  int64_t m_last_ns {0}; // CLOCK_MONOTONIC
+  int64_t m_last_allocs {0};
+  int64_t m_last_frees {0};
+  int64_t m_last_alloc_bytes {0};
+  int64_t m_last_freed_bytes {0};
+
+  // Remember the counters the next sample starts from
+  void set_origin(const SafiSnapshot& snapshot);
+
+  // i-th sample still in the ring, oldest first (lock held)
+  const SafiTimelineSample& at(size_t i) const;
+  size_t size() const { return m_count < m_capacity ? m_count : m_capacity; }
+};
@@ -0,0 +1,242 @@
+/**
+ * @file safi_trace.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Binary allocation event trace: per-thread rings drained by a
+ *        background writer thread
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_sites.h"
+#include "safi_trace_format.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+// Events per thread ring, must be a power of two (56 bytes each, 3.5 MB per ring)
+#define DEFAULT_TRACE_RING_EVENTS (1 << 16)
+
+// Encoded bytes after which the writer closes a block
+#define TRACE_BLOCK_TARGET_SIZE (256 * 1024)
+
+// The trace file is extended (and remapped) by this many bytes at a time
+#define TRACE_FILE_CHUNK_SIZE (64 * 1024 * 1024)
+
+// Longest sleep of the idle writer, a ring passing half full wakes it early
+#define TRACE_WRITER_SLEEP_MS 10
+#define TRACE_CALIBRATION_MS 100
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+struct SafiTraceRing;
+
+extern __thread SafiTraceRing* t_safi_trace_ring __attribute__((tls_model("initial-exec")));
+
+// Set for the writer thread, its own allocations are not traced
+extern __thread bool t_safi_no_trace __attribute__((tls_model("initial-exec")));
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Timestamp of trace events, the TSC where available
+ */
+inline uint64_t safi_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Single-producer (owner thread) single-consumer (writer) event ring
+ */
+struct SafiTraceRing
+{
+ public:
+  enum State : int { ACTIVE, RETIRED, FREE };
+
+  alignas(64) std::atomic<uint64_t> head {0}; // Written by the owner
+  uint64_t cached_tail = 0; // Owner's copy of 'tail'
+  std::atomic<int64_t> dropped {0}; // Written by the owner
+
+  alignas(64) std::atomic<uint64_t> tail {0}; // Written by the writer
+  int64_t dropped_reported = 0; // Writer only
+
+  std::atomic<int> state {ACTIVE};
+  uint32_t tid = 0;
+  uint64_t capacity = 0;
+  SafiTraceEvent* events = nullptr;
+
+  SafiTraceRing* next = nullptr; // List of every ring ever created
+  SafiTraceRing* next_free = nullptr;
+};
+
+
+/**
+ * @brief Records the malloc/calloc/realloc/free events of every thread
+ *
+ * Producers only touch their own ring and wake the writer when it passes half
+ * full, so a thread allocating in a tight loop does not have to outrun a
+ * sleeping writer. The writer thread takes a TSC watermark, drains every ring, sorts the drained events and encodes
+ * those older than the watermark; the rest wait for the next round. Wrappers
+ * record frees before the block is released, so a free is always written
+ * before the allocation that reuses its address.
+ *
+ * Blocks are copied into a shared mapping of the trace file (no stdio
+ * locking or buffers), so they reach the page cache immediately and survive
+ * a crash of the profiled process. Nothing on the write path calls the
+ * hooked allocator.
+ */
+struct SafiTracer
+{
+ public:
+  /**
+   * @brief Open the trace file and spawn the writer thread
+   *
+   * @param block_when_full Wait for the writer instead of dropping events
+   * @param sites Site table dumped at the end of the trace (nullptr: none)
+   * @return false if the file or the buffers could not be created
+   */
+  bool start(const char* path, bool block_when_full, uint64_t ring_events, const SafiSiteTable* sites);
+
+  // Drain everything, stop the writer and close the file
+  void stop();
+
+  bool active() const { return m_active.load(std::memory_order_relaxed); }
+
+  // In a forked child: stop recording, the file and the writer belong to the parent
+  void abandon_in_child()
+  {
+    m_active.store(false, std::memory_order_relaxed);
+    m_writer = nullptr;
+  }
+
+  void record(SafiTraceEventType type, const void* ptr, size_t size, uint32_t site=0,
+              const void* old_ptr=nullptr, size_t old_size=0)
+  {
+    if (t_safi_no_trace || !active()) {
+      return;
+    }
+    SafiTraceRing* ring = t_safi_trace_ring;
+    if (ring == nullptr && (ring = acquire_ring()) == nullptr) {
+      return;
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->cached_tail >= ring->capacity && !wait_for_space(ring, head)) {
+      ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return;
+    }
+
+    SafiTraceEvent& ev = ring->events[head & (ring->capacity - 1)];
+    ev.tsc = safi_tsc();
+    ev.ptr = (uintptr_t)ptr;
+    ev.old_ptr = (uintptr_t)old_ptr;
+    ev.size = size;
+    ev.old_size = old_size;
+    ev.tid = ring->tid;
+    ev.site = site;
+    ev.type = type;
+    ring->head.store(head + 1, std::memory_order_release);
+
+    // Once per half ring, with the stale tail: the exact fill is checked out of line
+    if (head + 1 - ring->cached_tail == ring->capacity / 2) {
+      half_full(ring, head + 1);
+    }
+  }
+
+  // Print the written and dropped event counts, for the text report
+  void print(FILE* stream) const;
+
+  // Thread-exit hook, the writer recycles the ring once it is drained
+  static void retire_ring(SafiTraceRing* ring);
+
+ private:
+  std::atomic<bool> m_active {false};
+  std::atomic<bool> m_stop {false};
+  std::atomic<uint32_t> m_wake {0}; // Futex word, bumped to wake the writer (a lock could be held across fork)
+  std::atomic<uint64_t> m_written {0}; // Events encoded, written by the writer
+  bool m_block_when_full = false;
+  uint64_t m_ring_events = DEFAULT_TRACE_RING_EVENTS;
+  int m_fd = -1;
+  pid_t m_pid = 0;
+  pthread_key_t m_ring_key {0};
+  const SafiSiteTable* m_sites = nullptr;
+  std::thread* m_writer = nullptr;
+
+  std::mutex m_rings_mutex; // Guards ring creation and recycling
+  std::atomic<SafiTraceRing*> m_rings {nullptr};
+  SafiTraceRing* m_free_rings = nullptr;
+
+  // Writer state
+  SafiTraceHeader* m_header = nullptr; // Shared mapping of the first page
+  uint8_t* m_window = nullptr; // Shared mapping of the file from m_window_offset
+  uint64_t m_window_offset = 0;
+  uint64_t m_window_size = 0;
+  uint64_t m_file_size = 0;
+  uint64_t m_commit = 0;
+  SafiTraceEvent* m_staging = nullptr;
+  size_t m_staging_capacity = 0;
+  size_t m_staging_size = 0;
+  uint8_t* m_block = nullptr;
+  size_t m_block_size = 0;
+  uint32_t m_block_events = 0;
+  SafiTraceBlockHeader m_block_header;
+  SafiTraceCodec m_codec;
+  uint64_t m_start_ns = 0;
+  uint64_t m_last_flush_ns = 0;
+
+  SafiTraceRing* acquire_ring();
+  bool wait_for_space(SafiTraceRing* ring, uint64_t head);
+  void half_full(SafiTraceRing* ring, uint64_t head);
+  void wake_writer();
+
+  void writer_loop();
+  size_t drain_round(bool final);
+  bool reserve_staging(size_t count);
+  void emit(const SafiTraceEvent& ev);
+  void flush_block(uint32_t magic=SAFI_TRACE_BLOCK_MAGIC);
+  bool reserve_file(uint64_t size);
+  void write_sites();
+  void write_maps();
+  void calibrate();
+};
@@ -0,0 +1,272 @@
+/**
+ * @file safi_trace_format.h
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief On-disk format of the MemSafi event trace, shared by the library and
+ *        the offline tools
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * A trace is a SafiTraceHeader followed by self-contained blocks. A block is a
+ * SafiTraceBlockHeader and 'payload_size' bytes of encoded events; the delta
+ * state is reset at every block so blocks can be decoded independently.
+ *
+ * The file is written through a shared mapping and grows in large chunks, so
+ * it is usually longer than the data. 'commit_offset' in the header is only
+ * advanced once a whole block is in place: anything past it (a crash in the
+ * middle of a block, or the zeroed tail of the last chunk) is not part of
+ * the trace.
+ *
+ * Every event starts with a kind byte: the event type in the low bits, plus
+ * SAFI_EV_NEW_TID if a varint thread id follows. Then come the zigzag varint
+ * deltas of the TSC and of the pointer against the previous event of the
+ * block, and the varint usable size. A realloc adds the zigzag delta of the
+ * old pointer against the new one and the old usable size. Allocations
+ * flagged with SAFI_EV_HAS_SITE end with their varint site id. A 'dropped'
+ * event only carries the TSC delta and the number of lost events.
+ *
+ * Two kinds of metadata blocks are appended when tracing stops: site blocks
+ * (SAFI_TRACE_SITES_MAGIC, 'num_events' sites made of a varint id, a varint
+ * depth and the varint return addresses) and maps blocks
+ * (SAFI_TRACE_MAPS_MAGIC, the raw text of /proc/self/maps) to let the tools
+ * resolve the addresses.
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define SAFI_TRACE_MAGIC 0x3143525449464153ull // "SAFITRC1"
+#define SAFI_TRACE_VERSION 3
+#define SAFI_TRACE_BLOCK_MAGIC 0x4B4C4253u // "SBLK"
+#define SAFI_TRACE_SITES_MAGIC 0x54495353u // "SSIT"
+#define SAFI_TRACE_MAPS_MAGIC 0x50414D53u // "SMAP"
+
+#define SAFI_EV_TYPE_MASK 0x07
+#define SAFI_EV_NEW_TID 0x08
+#define SAFI_EV_HAS_SITE 0x10
+
+// Upper bound of the encoded size of one event
+#define SAFI_EV_MAX_ENCODED_SIZE 64
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+enum SafiTraceEventType : uint8_t
+{
+  SAFI_EV_MALLOC = 1,
+  SAFI_EV_CALLOC,
+  SAFI_EV_REALLOC,
+  SAFI_EV_FREE,
+  SAFI_EV_DROPPED, // Events lost because the thread's ring was full
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief File header, 'tsc_hz' is filled once the writer calibrated the TSC
+ *        and 'commit_offset' grows as blocks are written
+ */
+struct SafiTraceHeader
+{
+ public:
+  uint64_t magic = SAFI_TRACE_MAGIC;
+  uint32_t version = SAFI_TRACE_VERSION;
+  uint32_t header_size = sizeof(SafiTraceHeader);
+  uint64_t pid = 0;
+  uint64_t tsc_hz = 0;
+  uint64_t start_tsc = 0;
+  uint64_t start_realtime_ns = 0; // Wall clock at start_tsc
+  uint64_t commit_offset = 0; // End of the last complete block
+};
+
+
+struct SafiTraceBlockHeader
+{
+ public:
+  uint32_t magic = SAFI_TRACE_BLOCK_MAGIC;
+  uint32_t payload_size = 0;
+  uint32_t num_events = 0;
+  uint32_t reserved = 0;
+  uint64_t base_tsc = 0; // TSC the first event's delta is relative to
+};
+
+
+/**
+ * @brief One decoded (or not yet encoded) event
+ */
+struct SafiTraceEvent
+{
+ public:
+  uint64_t tsc = 0;
+  uintptr_t ptr = 0;
+  uintptr_t old_ptr = 0; // Realloc only
+  uint64_t size = 0; // Usable bytes (number of lost events for SAFI_EV_DROPPED)
+  uint64_t old_size = 0; // Realloc only
+  uint32_t tid = 0;
+  uint32_t site = 0; // Allocation site id (0: unknown)
+  SafiTraceEventType type = SAFI_EV_MALLOC;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+inline uint64_t safi_zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+
+inline int64_t safi_unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+
+/**
+ * @brief LEB128 encoding
+ *
+ * @return uint8_t* Position after the encoded value
+ */
+inline uint8_t* safi_put_varint(uint8_t* out, uint64_t value)
+{
+  while (value >= 0x80) {
+    *out++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+
+/**
+ * @brief LEB128 decoding, advances 'in'
+ *
+ * @return false if the input ended in the middle of the value
+ */
+inline bool safi_get_varint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+{
+  value = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7) {
+    uint8_t byte = *in++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/**
+ * @brief Delta state of a block, shared by the encoder and the decoder
+ */
+struct SafiTraceCodec
+{
+ public:
+  uint64_t prev_tsc = 0;
+  uintptr_t prev_ptr = 0;
+  uint32_t prev_tid = UINT32_MAX;
+
+  void reset(uint64_t base_tsc)
+  {
+    prev_tsc = base_tsc;
+    prev_ptr = 0;
+    prev_tid = UINT32_MAX;
+  }
+
+  // 'out' needs SAFI_EV_MAX_ENCODED_SIZE bytes
+  uint8_t* encode(const SafiTraceEvent& ev, uint8_t* out)
+  {
+    bool new_tid = ev.tid != prev_tid;
+    bool has_site = ev.site != 0 && ev.type != SAFI_EV_FREE && ev.type != SAFI_EV_DROPPED;
+    *out++ = ev.type | (new_tid ? SAFI_EV_NEW_TID : 0) | (has_site ? SAFI_EV_HAS_SITE : 0);
+    if (new_tid) {
+      out = safi_put_varint(out, ev.tid);
+      prev_tid = ev.tid;
+    }
+    out = safi_put_varint(out, safi_zigzag(ev.tsc - prev_tsc));
+    prev_tsc = ev.tsc;
+
+    if (ev.type == SAFI_EV_DROPPED) {
+      return safi_put_varint(out, ev.size);
+    }
+
+    out = safi_put_varint(out, safi_zigzag(ev.ptr - prev_ptr));
+    prev_ptr = ev.ptr;
+    out = safi_put_varint(out, ev.size);
+    if (ev.type == SAFI_EV_REALLOC) {
+      out = safi_put_varint(out, safi_zigzag(ev.old_ptr - ev.ptr));
+      out = safi_put_varint(out, ev.old_size);
+    }
+    if (has_site) {
+      out = safi_put_varint(out, ev.site);
+    }
+    return out;
+  }
+
+  // Advances 'in', returns false on a truncated or corrupted event
+  bool decode(const uint8_t*& in, const uint8_t* end, SafiTraceEvent& ev)
+  {
+    if (in >= end) {
+      return false;
+    }
+    uint8_t kind = *in++;
+    uint64_t value = 0;
+
+    ev.type = (SafiTraceEventType)(kind & SAFI_EV_TYPE_MASK);
+    if (ev.type < SAFI_EV_MALLOC || ev.type > SAFI_EV_DROPPED) {
+      return false;
+    }
+    if (kind & SAFI_EV_NEW_TID) {
+      if (!safi_get_varint(in, end, value)) {
+        return false;
+      }
+      prev_tid = (uint32_t)value;
+    }
+    ev.tid = prev_tid;
+
+    if (!safi_get_varint(in, end, value)) {
+      return false;
+    }
+    prev_tsc += safi_unzigzag(value);
+    ev.tsc = prev_tsc;
+    ev.ptr = ev.old_ptr = 0;
+    ev.old_size = 0;
+    ev.site = 0;
+
+    if (ev.type == SAFI_EV_DROPPED) {
+      return safi_get_varint(in, end, ev.size);
+    }
+
+    if (!safi_get_varint(in, end, value)) {
+      return false;
+    }
+    prev_ptr += safi_unzigzag(value);
+    ev.ptr = prev_ptr;
+    if (!safi_get_varint(in, end, ev.size)) {
+      return false;
+    }
+    if (ev.type == SAFI_EV_REALLOC) {
+      if (!safi_get_varint(in, end, value) || !safi_get_varint(in, end, ev.old_size)) {
+        return false;
+      }
+      ev.old_ptr = ev.ptr + safi_unzigzag(value);
+    }
+    if (kind & SAFI_EV_HAS_SITE) {
+      if (!safi_get_varint(in, end, value)) {
+        return false;
+      }
+      ev.site = (uint32_t)value;
+    }
+    return true;
+  }
+};
@@ -13,16 +13,26 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Includes
 ////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <link.h>
 #include <malloc.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <atomic>
 #include <chrono>
+#include <cmath>
 #include <iostream>
 #include <mutex>
+#include <new>
 #include <thread>
 
 
@@ -30,22 +40,82 @@
 // Local Includes
 ////////////////////////////////////////////////////////////////////////////////
 #include "library.h"
+#include "safi_bootstrap.h"
+#include "safi_cache.h"
+#include "safi_header.h"
+#include "safi_heap.h"
+#include "safi_latency.h"
+#include "safi_leaks.h"
+#include "safi_lifetime.h"
+#include "safi_memory.h"
+#include "safi_mmap.h"
+#include "safi_report.h"
+#include "safi_scopes.h"
+#include "safi_shm.h"
+#include "safi_sites.h"
+#include "safi_socket.h"
+#include "safi_table.h"
+#include "safi_threads.h"
+#include "safi_timeline.h"
+#include "safi_trace.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Function Prototypes
 ////////////////////////////////////////////////////////////////////////////////
+static void* __lazy_alloc(size_t size, size_t alignment, bool zeroed, SafiCall call);
+static void* __lazy_realloc(void* ptr, size_t size, SafiCall call);
+static void __lazy_release(void* ptr, size_t size, bool aligned, SafiCall call);
+static size_t __lazy_usable_size(void* ptr);
+static double __sample_weight(size_t size);
+
+// glibc's sbrk() keeps the break it caches in sync, brk() is rebuilt on it
+extern "C" void* __sbrk(intptr_t increment);
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // Pre-processor constants
 ////////////////////////////////////////////////////////////////////////////////
-#define TEMP_BUFFER_SIZE 80000
-#define PRINT_FREQ_IN_SEC 5
+#define LOG_BUFFER_SIZE 512
+
+// Most frames of this library above the program's call (wrapper, dispatch, __capture_site)
+#define SITE_MAX_SKIP_FRAMES 4
+
+// Spin of __calibrate_tsc()
+#define TSC_CALIBRATION_NS 200000
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Type definitions
 ////////////////////////////////////////////////////////////////////////////////
+// Implementations behind the wrappers, one set per mode
+typedef void* (*AllocImplType)(size_t size, size_t alignment, bool zeroed, SafiCall call);
+typedef void* (*ReallocImplType)(void* ptr, size_t size, SafiCall call);
+typedef void (*ReleaseImplType)(void* ptr, size_t size, bool aligned, SafiCall call);
+typedef size_t (*UsableSizeImplType)(void* ptr);
+
+/**
+ * @brief Implementations the wrappers forward to, one atomic load per call
+ *        instead of an init check: they start on the lazy versions and
+ *        __init_safi() swaps in the ones of the selected mode
+ */
+struct SafiDispatch
+{
+ public:
+  std::atomic<AllocImplType> alloc;
+  std::atomic<ReallocImplType> realloc;
+  std::atomic<ReleaseImplType> release;
+  std::atomic<UsableSizeImplType> usable_size;
+};
+
+
+// Live blocks and bytes of one site in a heap profile
+struct SafiHeapBucket
+{
+ public:
+  int64_t blocks;
+  int64_t bytes;
+};
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -53,86 +123,1821 @@
 ////////////////////////////////////////////////////////////////////////////////
 SafiStats safiStats;
 SafiControl safiControl;
-std::thread* print_thread;
+SafiAllocTable safiTable;
+SafiSiteTable safiSites;
+SafiLifetimeTable safiLifetimes;
+SafiLatencyTable safiLatency;
+SafiThreadTable safiThreads;
+SafiTracer safiTracer;
+SafiReporter safiReporter;
+SafiShmPublisher safiShm;
+SafiCommandServer safiCommands;
+SafiHeapProfiler safiHeap;
+SafiLeakTable safiLeaks;
+SafiCache safiCache;
+SafiMemoryStats safiMemory;
+SafiTimeline safiTimeline;
+SafiTagTable safiTags;
+__thread SafiShard* t_safi_shard __attribute__((tls_model("initial-exec"))) = nullptr;
+
+// Set while this thread unwinds its stack, backtrace() may allocate on first use
+__thread bool t_safi_in_unwind __attribute__((tls_model("initial-exec"))) = false;
+
+// Sampling mode: bytes left before the next sampled allocation, and the RNG drawing the gaps
+__thread int64_t t_safi_sample_countdown __attribute__((tls_model("initial-exec"))) = 0;
+__thread uint64_t t_safi_sample_rng __attribute__((tls_model("initial-exec"))) = 0;
+
+// Serves the allocations made while dlsym is pending
+SafiBootstrap safiBootstrap;
+
+// Every wrapper goes through it, constant-initialized so it works before any constructor
+SafiDispatch safiDispatch = {
+  {__lazy_alloc},
+  {__lazy_realloc},
+  {__lazy_release},
+  {__lazy_usable_size},
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Thread-exit hook (pthread key destructor) that releases the thread's shard
+ */
+static void __release_safi_shard(void* shard)
+{
+  safiStats.retire_shard(static_cast<SafiShard*>(shard));
+}
+
+
+void SafiStats::enable_sharding(int64_t flush_bytes)
+{
+  if (pthread_key_create(&m_shard_key, __release_safi_shard) != 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to create the shard key, sharding disabled!\n");
+    return;
+  }
+  m_flush_bytes = flush_bytes;
+  m_sharded = true;
+}
+
+
+SafiShard* SafiStats::acquire_shard()
+{
+  SafiShard* shard = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(m_shards_mutex);
+    if (m_free_shards != nullptr) {
+      shard = m_free_shards;
+      m_free_shards = shard->next_free;
+    }
+  }
+
+  // Shards come straight from mmap so we never re-enter the hooked malloc
+  if (shard == nullptr) {
+    void* mem = safi_mmap_alloc(sizeof(SafiShard));
+    if (mem == nullptr) {
+      SAFI_LOG_ERROR("[ERROR] Failed to map memory for a stats shard!\n");
+      exit(1);
+    }
+    shard = new (mem) SafiShard();
+
+    std::lock_guard<std::mutex> guard(m_shards_mutex);
+    shard->next = m_shards;
+    m_shards = shard;
+    ++m_num_shards;
+  }
+
+  t_safi_shard = shard;
+  pthread_setspecific(m_shard_key, shard);
+  return shard;
+}
+
+
+void SafiStats::retire_shard(SafiShard* shard)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_shards_mutex);
+    int64_t pending = shard->reserved.exchange(0);
+    update_peak(m_reserved.fetch_add(pending) + pending);
+    m_total_reserved += shard->total_reserved.exchange(0);
+    m_freed += shard->freed.exchange(0);
+    for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+      m_num_calls[call] += shard->num_calls[call].exchange(0);
+    }
+    m_total_requested += shard->total_requested.exchange(0);
+    m_freed_requested += shard->freed_requested.exchange(0);
+    m_sizes.take(shard->sizes);
+    m_lifetimes.take(shard->lifetimes);
+
+    shard->next_free = m_free_shards;
+    m_free_shards = shard;
+  }
+
+  // Allocations done by later thread-exit destructors get a fresh shard
+  t_safi_shard = nullptr;
+}
+
+
+void SafiStats::collect(SafiShard& totals) const
+{
+  std::lock_guard<std::mutex> guard(m_shards_mutex);
+  totals.reserved = m_reserved.load();
+  totals.total_reserved = m_total_reserved.load();
+  totals.freed = m_freed.load();
+  for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+    totals.num_calls[call] = m_num_calls[call].load();
+  }
+  totals.total_requested = m_total_requested.load();
+  totals.freed_requested = m_freed_requested.load();
+  totals.sizes.merge(m_sizes);
+  totals.lifetimes.merge(m_lifetimes);
+
+  for (const SafiShard* shard = m_shards; shard != nullptr; shard = shard->next) {
+    SafiShard::add(totals.reserved, shard->reserved.load(std::memory_order_relaxed));
+    SafiShard::add(totals.total_reserved, shard->total_reserved.load(std::memory_order_relaxed));
+    SafiShard::add(totals.freed, shard->freed.load(std::memory_order_relaxed));
+    for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+      SafiShard::add(totals.num_calls[call], shard->num_calls[call].load(std::memory_order_relaxed));
+    }
+    SafiShard::add(totals.total_requested, shard->total_requested.load(std::memory_order_relaxed));
+    SafiShard::add(totals.freed_requested, shard->freed_requested.load(std::memory_order_relaxed));
+    totals.sizes.merge(shard->sizes);
+    totals.lifetimes.merge(shard->lifetimes);
+  }
+}
+
+
+void SafiStats::rebase()
+{
+  SafiShard totals;
+  collect(totals);
+
+  // The other threads are gone, their shards can be recycled
+  m_free_shards = nullptr;
+  for (SafiShard* shard = m_shards; shard != nullptr; shard = shard->next) {
+    shard->reserved.store(0, std::memory_order_relaxed);
+    shard->total_reserved.store(0, std::memory_order_relaxed);
+    shard->freed.store(0, std::memory_order_relaxed);
+    for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+      shard->num_calls[call].store(0, std::memory_order_relaxed);
+    }
+    shard->total_requested.store(0, std::memory_order_relaxed);
+    shard->freed_requested.store(0, std::memory_order_relaxed);
+    shard->sizes.clear();
+    shard->lifetimes.clear();
+    if (shard != t_safi_shard) {
+      shard->next_free = m_free_shards;
+      m_free_shards = shard;
+    }
+  }
+
+  int64_t reserved = totals.reserved.load();
+  m_reserved = reserved;
+  m_total_reserved = reserved;
+  m_freed = 0;
+  m_real_peak = reserved;
+  for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+    m_num_calls[call] = 0;
+  }
+  m_total_requested = totals.total_requested.load() - totals.freed_requested.load();
+  m_freed_requested = 0;
+  m_sizes.clear();
+  m_lifetimes.clear();
+}
+
+
+void SafiStats::snapshot(SafiSnapshot& snapshot) const
+{
+  SafiShard totals;
+  collect(totals);
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  snapshot.timestamp_ns = now.tv_sec * 1000000000ll + now.tv_nsec;
+  snapshot.pid = getpid();
+
+  snapshot.reserved = totals.reserved.load();
+  snapshot.peak = m_real_peak.load();
+  snapshot.sharded = m_sharded;
+  if (m_sharded) {
+    // Live shards may each hold up to m_flush_bytes not yet seen by the peak
+    std::lock_guard<std::mutex> guard(m_shards_mutex);
+    snapshot.peak_accuracy = m_num_shards * m_flush_bytes;
+  }
+  snapshot.total_reserved = totals.total_reserved.load();
+  snapshot.freed = totals.freed.load();
+  for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+    snapshot.num_calls[call] = totals.num_calls[call].load();
+  }
+
+  snapshot.track_requested = m_track_requested;
+  snapshot.sample_bytes = m_sample_bytes;
+  snapshot.total_requested = totals.total_requested.load();
+  snapshot.freed_requested = totals.freed_requested.load();
+
+  snapshot.histograms = m_histograms;
+  for (int i = 0; i < SAFI_HIST_BUCKETS; i++) {
+    snapshot.sizes[i] = totals.sizes.counts[i].load(std::memory_order_relaxed);
+    snapshot.lifetimes[i] = totals.lifetimes.counts[i].load(std::memory_order_relaxed);
+  }
+  snapshot.sizes_sum = totals.sizes.sum.load();
+  snapshot.lifetimes_sum = totals.lifetimes.sum.load();
+}
+
+
+static void __print_json_report(FILE* stream)
+{
+  SafiSnapshot snapshot;
+  safiStats.snapshot(snapshot);
+  snapshot.init_ns = safiControl.init_ns;
+  safi_print_json(stream, snapshot);
+}
+
+
+static void __print_prometheus_report(FILE* stream)
+{
+  SafiSnapshot snapshot;
+  safiStats.snapshot(snapshot);
+  snapshot.init_ns = safiControl.init_ns;
+  safi_print_prometheus(stream, snapshot);
+}
+
+
+/**
+ * @brief Print the statistics and, if enabled, the top allocation sites
+ */
+static void __print_text_report(FILE* stream)
+{
+  SafiSnapshot snapshot;
+  safiStats.snapshot(snapshot);
+  snapshot.init_ns = safiControl.init_ns;
+  safi_print_text(stream, snapshot);
+  double elapsed_s = std::max((safi_tsc() - safiControl.start_tsc) * safiControl.ns_per_tsc / 1e9, 1e-9);
+  if (safiControl.latency) {
+    safiLatency.print(stream, safiControl.ns_per_tsc, elapsed_s);
+  }
+  if (safiControl.lifetimes) {
+    bool estimated = safiControl.sample_bytes != 0;
+    safiLifetimes.print(stream, safiControl.short_lived_ns, elapsed_s, estimated && safiControl.side_table);
+    fprintf(stream, "\n");
+    if (safiControl.sites) {
+      safiSites.print_churn(stream, safiControl.top_sites, safiControl.short_lived_ns / 1000, elapsed_s, estimated);
+    }
+  }
+  if (safiControl.timeline) {
+    safiTimeline.print_text(stream);
+  }
+  if (safiControl.memory) {
+    safiMemory.print(stream, snapshot.reserved);
+  }
+  if (safiControl.cache) {
+    safiCache.print(stream);
+  }
+  if (safiControl.trace) {
+    safiTracer.print(stream);
+  }
+  if (safiControl.threads) {
+    safiThreads.print(stream, safiControl.top_threads, safiControl.sample_bytes != 0 && safiControl.side_table);
+  }
+  if (safiControl.scopes) {
+    safiTags.print(stream);
+  }
+  if (safiControl.sites) {
+    safiSites.print_top(stream, safiControl.top_sites, safiControl.sample_bytes != 0);
+  }
+}
+
+
+static void __print_timeline_json(FILE* stream)
+{
+  safiTimeline.print_json(stream);
+}
+
+
+// Sampler of the reporting thread (MEM_SAFI_TIMELINE_MS)
+static void __sample_timeline()
+{
+  SafiSnapshot snapshot;
+  safiStats.snapshot(snapshot);
+  safiTimeline.sample(snapshot, safiStats.take_interval_peak());
+}
+
+
+// Report in MEM_SAFI_REPORT_FORMAT, the other sections have no machine-readable format yet
+static void __print_report(FILE* stream)
+{
+  switch (safiControl.report_format) {
+    case SAFI_FORMAT_JSON: __print_json_report(stream); break;
+    case SAFI_FORMAT_PROMETHEUS: __print_prometheus_report(stream); break;
+    default: __print_text_report(stream); break;
+  }
+}
+
+
+/**
+ * @brief Copy the stats and the top sites to the shared-memory segment (see SafiShmPublisher)
+ */
+static void __publish_stats(SafiShmSegment* segment)
+{
+  SafiSnapshot snapshot;
+  safiStats.snapshot(snapshot);
+  segment->publish_ns = snapshot.timestamp_ns;
+  segment->reserved = snapshot.reserved;
+  segment->peak = snapshot.peak;
+  segment->peak_accuracy = snapshot.peak_accuracy;
+  segment->total_reserved = snapshot.total_reserved;
+  segment->freed = snapshot.freed;
+  for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+    segment->num_calls[call] = snapshot.num_calls[call];
+  }
+  segment->requested = snapshot.track_requested ? snapshot.requested() : -1;
+  segment->sample_bytes = snapshot.sample_bytes;
+
+  // The unknown site (id 0) is left out, it has no frames to show
+  uint32_t top[SAFI_SHM_TOP_SITES];
+  size_t found = safiControl.sites ? safiSites.top_live(top, SAFI_SHM_TOP_SITES) : 0;
+  uint32_t num_sites = 0;
+  for (size_t rank = 0; rank < found; rank++) {
+    const SafiSite* site = safiSites.get(top[rank]);
+    if (site == nullptr) {
+      continue;
+    }
+    SafiShmSite& shared = segment->sites[num_sites++];
+    shared.id = top[rank];
+    shared.depth = std::min<uint32_t>(site->depth, SAFI_SHM_SITE_FRAMES);
+    shared.live_bytes = site->live_bytes.load(std::memory_order_relaxed);
+    shared.live_blocks = site->live_blocks.load(std::memory_order_relaxed);
+    shared.total_bytes = site->total_bytes.load(std::memory_order_relaxed);
+    shared.total_allocs = site->total_allocs.load(std::memory_order_relaxed);
+    for (uint32_t f = 0; f < shared.depth; f++) {
+      shared.frames[f] = (uint64_t)site->frames[f];
+    }
+  }
+  segment->num_sites = num_sites;
+}
+
+
+/**
+ * @brief Print a heap profile of the live blocks per site (legacy pprof heap format)
+ *
+ * With the side table the live blocks are walked shard by shard, else the
+ * live counters of the sites are used. Sampled blocks are scaled back up like
+ * in the report, so the profile is written as unsampled ("heapprofile").
+ * Blocks of the unknown site have no stack and are left out.
+ */
+static void __print_heap_profile(FILE* stream)
+{
+  size_t buckets_size = SAFI_MAX_SITES * sizeof(SafiHeapBucket);
+  SafiHeapBucket* buckets = static_cast<SafiHeapBucket*>(safi_mmap_alloc(buckets_size));
+  if (buckets == nullptr) {
+    return;
+  }
+
+  if (safiControl.side_table) {
+    safiTable.for_each([buckets] (const SafiAllocEntry& entry) {
+      double weight = __sample_weight(entry.requested);
+      buckets[entry.site].blocks += std::llround(weight);
+      buckets[entry.site].bytes += std::llround(entry.requested * weight);
+    });
+  } else {
+    for (uint32_t id = 0; id < SAFI_MAX_SITES; id++) {
+      const SafiSite* site = safiSites.get(id);
+      if (site != nullptr) {
+        buckets[id].blocks = site->live_blocks.load(std::memory_order_relaxed);
+        buckets[id].bytes = site->live_bytes.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  int64_t live_blocks = 0, live_bytes = 0, total_allocs = 0, total_bytes = 0;
+  for (uint32_t id = 0; id < SAFI_MAX_SITES; id++) {
+    const SafiSite* site = safiSites.get(id);
+    if (site != nullptr) {
+      live_blocks += buckets[id].blocks;
+      live_bytes += buckets[id].bytes;
+      total_allocs += site->total_allocs.load(std::memory_order_relaxed);
+      total_bytes += site->total_bytes.load(std::memory_order_relaxed);
+    }
+  }
+
+  fprintf(stream, "heap profile: %6ld: %8ld [%6ld: %8ld] @ heapprofile\n",
+          live_blocks, live_bytes, total_allocs, total_bytes);
+  for (uint32_t id = 0; id < SAFI_MAX_SITES; id++) {
+    const SafiSite* site = safiSites.get(id);
+    if (site == nullptr || site->depth == 0) {
+      continue;
+    }
+    int64_t allocs = site->total_allocs.load(std::memory_order_relaxed);
+    if (buckets[id].blocks == 0 && allocs == 0) {
+      continue;
+    }
+    fprintf(stream, "%6ld: %8ld [%6ld: %8ld] @", buckets[id].blocks, buckets[id].bytes,
+            allocs, site->total_bytes.load(std::memory_order_relaxed));
+    for (uint32_t f = 0; f < site->depth; f++) {
+      fprintf(stream, " %p", site->frames[f]);
+    }
+    fprintf(stream, "\n");
+  }
+  safi_mmap_free(buckets, buckets_size);
+
+  // pprof skips the comment lines, the time series lines the profile up with the traffic
+  if (safiControl.timeline) {
+    safiTimeline.print_comments(stream);
+  }
+
+  // pprof maps the addresses back to the binaries with this section
+  fprintf(stream, "\nMAPPED_LIBRARIES:\n");
+  int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    char buffer[4096];
+    ssize_t length = 0;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+      fwrite(buffer, 1, length, stream);
+    }
+    close(fd);
+  }
+}
+
+
+/**
+ * @brief Copy 'path' to 'out' with every "%p" replaced by the pid, so that the
+ *        forked and exec'd processes get their own outputs
+ *
+ * @return char* 'out'
+ */
+static char* __expand_pid(const char* path, char* out, size_t size)
+{
+  size_t length = 0;
+  for (const char* c = path; *c != '\0' && length + 1 < size; c++) {
+    if (c[0] == '%' && c[1] == 'p') {
+      length += snprintf(out + length, size - length, "%d", (int)getpid());
+      c++;
+    } else {
+      out[length++] = *c;
+    }
+  }
+  out[std::min(length, size - 1)] = '\0';
+  return out;
+}
+
+
+static void __print_leak_report(FILE* stream)
+{
+  fprintf(stream, "[MemSafi] Leak report of pid %d\n\n", (int)getpid());
+  safiLeaks.print(stream, safiSites, safiControl.top_leaks, safiControl.sample_bytes != 0);
+}
+
+
+/**
+ * @brief Gather the blocks never freed and write the leak report to
+ *        MEM_SAFI_LEAK_FILE (default SAFI_LEAK_FILE_FORMAT)
+ */
+static void __report_leaks()
+{
+  bool collected = false;
+  if (safiControl.side_table) {
+    collected = safiLeaks.collect(safiTable, __sample_weight, safiControl.leak_jobs);
+  } else if (safiControl.sites) {
+    collected = safiLeaks.collect(safiSites);
+  }
+  if (!collected) {
+    SAFI_LOG_ERROR("[ERROR] Failed to map the leak table, no leak report!\n");
+    return;
+  }
+
+  char path[PATH_MAX];
+  char* leak_file = getenv("MEM_SAFI_LEAK_FILE");
+  if (leak_file != nullptr && leak_file[0] != '\0') {
+    __expand_pid(leak_file, path, sizeof(path));
+  } else {
+    snprintf(path, sizeof(path), SAFI_LEAK_FILE_FORMAT, (int)getpid());
+  }
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to open the leak report '%s': %s\n", path, strerror(errno));
+    return;
+  }
+  safiReporter.emit_to(fd, __print_leak_report, false);
+  close(fd);
+  SAFI_LOG_ERROR("[MemSafi] Leak report written to '%s'\n", path);
+}
+
+
+/**
+ * @brief Commands of the MEM_SAFI_SOCKET socket, the answers go through the reporter's buffer
+ */
+static void __run_command(const char* command, int fd)
+{
+  if (strcmp(command, "report") == 0) {
+    safiReporter.emit_to(fd, __print_text_report, true);
+  } else if (strcmp(command, "json") == 0) {
+    safiReporter.emit_to(fd, __print_json_report, true);
+  } else if (strcmp(command, "prometheus") == 0) {
+    safiReporter.emit_to(fd, __print_prometheus_report, true);
+  } else if (strcmp(command, "heap") == 0 && safiControl.sites) {
+    safiHeap.dump_to(fd, true);
+  } else if (strcmp(command, "timeline") == 0 && safiControl.timeline) {
+    safiReporter.emit_to(fd, __print_timeline_json, true);
+  } else {
+    const char usage[] = "Commands: report, json, prometheus, heap (with MEM_SAFI_SITES=1 or MEM_SAFI_HEAP_SIGNAL), "
+                         "timeline (with MEM_SAFI_TIMELINE_MS)\n";
+    send(fd, usage, sizeof(usage) - 1, MSG_NOSIGNAL);
+  }
+}
+
+
+/**
+ * @brief Write a log message to stderr, use the SAFI_LOG_* macros instead
+ *
+ * The message is formatted on the stack and written with a single write(2),
+ * stdio streams may allocate (and re-enter our hooks) on first use.
+ *
+ * @param format Message formatted in printf style format
+ * @param ... veriadic arguments
+ */
+void __log_msg(const char* format, ...)
+{
+  char buffer[LOG_BUFFER_SIZE];
+
+  va_list argptr;
+  va_start(argptr, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, argptr);
+  va_end(argptr);
+
+  if (length <= 0) {
+    return;
+  }
+  if (length >= (int)sizeof(buffer)) {
+    length = sizeof(buffer) - 1;
+  }
+  ssize_t ret = write(STDERR_FILENO, buffer, length);
+  (void)ret;
+}
+
+
+/**
+ * @brief Allocate from safiBootstrap, used by dlsym for bootstraping
+ *
+ * @param alignment Any value, rounded up to a power of two
+ */
+static void* __bootstrap_alloc(size_t size, size_t alignment=0)
+{
+  SAFI_LOG_INFO("[INFO] Bootstrap alloc (size: %lu, alignment: %lu)\n", size, alignment);
+
+  alignment = alignment <= 1 ? 1 : (size_t)1 << (64 - __builtin_clzl(alignment - 1));
+  void* p = safiBootstrap.alloc(size, alignment);
+  if (p == nullptr) {
+    SAFI_LOG_ERROR("[ERROR] Bootstrap allocator is out of memory (size: %lu)!\n", size);
+  }
+  return p;
+}
+
+
+/**
+ * @brief Check if an environment variable is set to "1"
+ */
+static bool __env_flag(const char* name)
+{
+  char* value = getenv(name);
+  return value != nullptr && strcmp(value, "1") == 0;
+}
+
+
+/**
+ * @brief Read a positive integer from the environment
+ */
+static int64_t __env_int(const char* name, int64_t default_value)
+{
+  char* value = getenv(name);
+  return value != nullptr && atoll(value) > 0 ? atoll(value) : default_value;
+}
+
+
+/**
+ * @brief Open the report output: MEM_SAFI_REPORT_FILE (appended to, "%p" is
+ *        the pid) wins over MEM_SAFI_REPORT_FD, the default is stderr
+ */
+static int __open_report_fd()
+{
+  char* report_file = getenv("MEM_SAFI_REPORT_FILE");
+  if (report_file == nullptr || report_file[0] == '\0') {
+    return __env_int("MEM_SAFI_REPORT_FD", STDERR_FILENO);
+  }
+
+  char path[PATH_MAX];
+  __expand_pid(report_file, path, sizeof(path));
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to open the report file '%s': %s\n", path, strerror(errno));
+    return STDERR_FILENO;
+  }
+  return fd;
+}
+
+
+/**
+ * @brief Open the report output and start the periodic reports,
+ *        MEM_SAFI_REPORT_INTERVAL_MS=0 only keeps the report at exit
+ */
+static void __start_reporter()
+{
+  int fd = __open_report_fd();
+
+  safiControl.report_format = safi_report_format(getenv("MEM_SAFI_REPORT_FORMAT"));
+  char* interval_str = getenv("MEM_SAFI_REPORT_INTERVAL_MS");
+  int64_t interval_ms = interval_str != nullptr ? std::max<int64_t>(atoll(interval_str), 0) : DEFAULT_REPORT_INTERVAL_MS;
+  size_t buffer_size = DEFAULT_REPORT_BUFFER_SIZE;
+  if (getenv("MEM_SAFI_REPORT_BUFFER_KB") != nullptr) {
+    buffer_size = __env_int("MEM_SAFI_REPORT_BUFFER_KB", DEFAULT_REPORT_BUFFER_SIZE / 1024) * 1024;
+  }
+  safiReporter.start(__print_report, fd, interval_ms, buffer_size);
+}
+
+
+/**
+ * @brief Path of the MEM_SAFI_SOCKET socket: 1 for SAFI_SOCKET_PATH_FORMAT, or
+ *        a path where "%p" is the pid
+ *
+ * @param per_pid_only Only accept the paths that differ per process (for a forked child)
+ * @return false if there is no socket
+ */
+static bool __socket_path(char* path, size_t size, bool per_pid_only)
+{
+  char* socket_str = getenv("MEM_SAFI_SOCKET");
+  if (socket_str == nullptr || socket_str[0] == '\0' || strcmp(socket_str, "0") == 0) {
+    return false;
+  }
+  if (strcmp(socket_str, "1") == 0) {
+    snprintf(path, size, SAFI_SOCKET_PATH_FORMAT, (int)getpid());
+    return true;
+  }
+  if (per_pid_only && strstr(socket_str, "%p") == nullptr) {
+    return false;
+  }
+  __expand_pid(socket_str, path, size);
+  return true;
+}
+
+
+/**
+ * @brief dl_iterate_phdr callback, finds the executable segment holding
+ *        safiControl.self_begin and stores its bounds
+ */
+static int __find_self_text(struct dl_phdr_info* info, size_t, void* data)
+{
+  uintptr_t self = (uintptr_t)data;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+    uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+    if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X) && begin <= self && self < begin + phdr.p_memsz) {
+      safiControl.self_begin = begin;
+      safiControl.self_end = begin + phdr.p_memsz;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Intern the call stack of the program's allocation, the leading frames
+ *        inside this library (wrapper, dispatch, tail calls or not) are skipped
+ *
+ * @return uint32_t Site id in safiSites
+ */
+static __attribute__((noinline)) uint32_t __capture_site()
+{
+  if (!safiControl.sites || t_safi_in_unwind) {
+    return SAFI_UNKNOWN_SITE;
+  }
+
+  void* frames[SAFI_MAX_STACK_DEPTH + SITE_MAX_SKIP_FRAMES];
+  t_safi_in_unwind = true;
+  int depth = backtrace(frames, safiControl.stack_depth + SITE_MAX_SKIP_FRAMES);
+  t_safi_in_unwind = false;
+
+  int skip = 0;
+  while (skip < depth && skip < SITE_MAX_SKIP_FRAMES && safiControl.self_begin <= (uintptr_t)frames[skip] &&
+         (uintptr_t)frames[skip] < safiControl.self_end) {
+    skip++;
+  }
+  return safiSites.intern(frames + skip, std::min(depth - skip, safiControl.stack_depth));
+}
+
+
+/**
+ * @brief Draw the gap to the next sample, exponentially distributed with mean
+ *        sample_bytes so the sample points form a Poisson process over bytes
+ */
+static int64_t __next_sample_gap()
+{
+  if (t_safi_sample_rng == 0) {
+    // The TSC, not the coarse clock: threads started in the same tick reuse the same TLS address.
+    // The splitmix64 finalizer spreads the close seeds of consecutive threads
+    uint64_t seed = safi_tsc() ^ ((uintptr_t)&t_safi_sample_rng * 0x9E3779B97F4A7C15ull);
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ull;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBull;
+    t_safi_sample_rng = (seed ^ (seed >> 31)) | 1;
+  }
+
+  // xorshift64*, top 53 bits as a uniform double in (0, 1]
+  t_safi_sample_rng ^= t_safi_sample_rng >> 12;
+  t_safi_sample_rng ^= t_safi_sample_rng << 25;
+  t_safi_sample_rng ^= t_safi_sample_rng >> 27;
+  double u = ((t_safi_sample_rng * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / 9007199254740992.0);
+
+  return (int64_t)(-std::log(1.0 - u) * safiControl.sample_bytes) + 1;
+}
+
+
+/**
+ * @brief Slow path of __should_track, the countdown crossed a sample point
+ *
+ * The countdown restarts from a fresh gap (like tcmalloc): the bytes of a
+ * large sampled block past the sample point must not sample the next ones. A
+ * thread starts at 0, its first crossing draws its first gap and checks the
+ * allocation against it, so it is sampled with the same probability as later
+ * ones.
+ */
+static __attribute__((noinline)) bool __take_sample(size_t size)
+{
+  if (t_safi_sample_rng == 0) {
+    t_safi_sample_countdown = __next_sample_gap() - (int64_t)size;
+    if (t_safi_sample_countdown >= 0) {
+      return false;
+    }
+  }
+  t_safi_sample_countdown = __next_sample_gap();
+  return true;
+}
+
+
+/**
+ * @brief Decide if an allocation goes to the side table. When sampling, the
+ *        untaken path is a subtraction and a branch
+ */
+static inline bool __should_track(size_t size)
+{
+  if (safiControl.sample_bytes == 0) {
+    return true;
+  }
+  t_safi_sample_countdown -= size;
+  return t_safi_sample_countdown < 0 && __take_sample(size);
+}
+
+
+/**
+ * @brief Number of allocations represented by a tracked one of 'size' bytes
+ *
+ * A block of 'size' bytes is sampled with probability 1 - exp(-size / N), so
+ * weighting it by the inverse gives unbiased estimates (same as tcmalloc).
+ */
+static double __sample_weight(size_t size)
+{
+  if (safiControl.sample_bytes == 0) {
+    return 1.0;
+  }
+  return 1.0 / -std::expm1(-(double)std::max<size_t>(size, 1) / safiControl.sample_bytes);
+}
+
+
+/**
+ * @brief Record a new allocation in the side table
+ */
+static void __track_alloc(void* p, size_t requested, size_t usable, SafiAllocType type, uint32_t site, uint64_t birth)
+{
+  SafiAllocEntry entry;
+  entry.ptr = (uintptr_t)p;
+  entry.requested = requested;
+  entry.slack = usable - requested;
+  entry.site = site;
+  entry.type = type;
+  entry.timestamp = birth;
+
+  double weight = __sample_weight(requested);
+  int64_t bytes = std::llround(requested * weight);
+  if (safiControl.threads) {
+    entry.thread = safiThreads.log_alloc(bytes, std::llround(weight));
+  }
+  if (safiControl.scopes) {
+    entry.tag = safi_scope_tag();
+  }
+  if (safiTable.insert(entry)) {
+    safiStats.log_requested(bytes, 0);
+    if (safiControl.sites) {
+      safiSites.log_alloc(site, bytes, std::llround(weight));
+    }
+    if (safiControl.scopes) {
+      safiTags.log_alloc(entry.tag, bytes);
+    }
+  } else if (safiControl.threads) {
+    safiThreads.log_free(entry.thread, bytes, std::llround(weight));
+  }
+}
+
+
+/**
+ * @brief Account for a block leaving the side table
+ */
+static void __log_untracked(const SafiAllocEntry& entry)
+{
+  // Same weight as __track_alloc so the estimates return to zero
+  double weight = __sample_weight(entry.requested);
+  int64_t bytes = std::llround(entry.requested * weight);
+  safiStats.log_requested(0, bytes);
+  if (safiControl.sites) {
+    safiSites.log_free(entry.site, bytes, std::llround(weight));
+  }
+  if (safiControl.threads) {
+    safiThreads.log_free(entry.thread, bytes, std::llround(weight));
+  }
+  if (safiControl.scopes) {
+    safiTags.log_free(entry.tag, bytes);
+  }
+}
+
+
+/**
+ * @brief Account for the lifetime of a freed block
+ *
+ * @param birth safi_tsc() at allocation
+ * @param count Number of blocks it stands for in the histograms
+ * @param site_count Number of blocks it stands for in its site's counters
+ */
+static void __log_lifetime(uint64_t birth, size_t requested, int64_t count, uint32_t site, int64_t site_count)
+{
+  uint64_t now = safi_tsc();
+  uint64_t ns = now > birth ? (uint64_t)((now - birth) * safiControl.ns_per_tsc) : 0;
+  safiStats.log_lifetime(ns, count);
+  if (safiControl.lifetimes) {
+    bool short_lived = ns < safiControl.short_lived_ns;
+    safiLifetimes.log(requested, ns, count, short_lived);
+    if (short_lived && site != SAFI_UNKNOWN_SITE) {
+      safiSites.log_short_lived(site, site_count);
+    }
+  }
+}
+
+
+/**
+ * @brief Ticks of safi_tsc() per ns, measured against CLOCK_MONOTONIC over a short spin
+ */
+static double __calibrate_tsc()
+{
+  struct timespec start;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint64_t start_tsc = safi_tsc();
+  int64_t elapsed_ns = 0;
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ns = (now.tv_sec - start.tv_sec) * 1000000000ll + (now.tv_nsec - start.tv_nsec);
+  } while (elapsed_ns < TSC_CALIBRATION_NS);
+  uint64_t ticks = safi_tsc() - start_tsc;
+  return ticks == 0 ? 1.0 : (double)elapsed_ns / ticks;
+}
+
+
+/**
+ * @brief Account for a new block, shared by every allocating implementation
+ */
+static inline __attribute__((always_inline)) void __log_alloc(void* p, size_t requested, size_t usable, SafiCall call,
+                                                              SafiAllocType type, SafiTraceEventType event)
+{
+  safiStats.log_alloc(call, usable);
+  safiStats.log_size(requested);
+  uint32_t site = SAFI_UNKNOWN_SITE;
+  if (safiControl.side_table && __should_track(requested)) {
+    site = __capture_site();
+    __track_alloc(p, requested, usable, type, site, safi_tsc());
+  }
+  if (safiControl.trace) {
+    safiTracer.record(event, p, usable, site);
+  }
+}
+
+
+/**
+ * @brief Account for a block about to be released, shared by free and the delete operators
+ *
+ * @param usable Usable bytes of the block, 0 if the caller does not know them. They
+ *        then come from the side table entry, and only untracked blocks pay for a
+ *        malloc_usable_size() (it reads the cold chunk headers)
+ */
+static inline __attribute__((always_inline)) size_t __log_release(void* ptr, size_t usable, SafiCall call)
+{
+  if (safiControl.side_table) {
+    SafiAllocEntry entry;
+    if (safiTable.remove((uintptr_t)ptr, entry)) {
+      __log_untracked(entry);
+      int64_t weight = std::llround(__sample_weight(entry.requested));
+      __log_lifetime(entry.timestamp, entry.requested, weight, entry.site, weight);
+      usable = usable == 0 ? entry.usable() : usable;
+    }
+  }
+  if (usable == 0) {
+    usable = safiControl.orig_malloc_usable_size(ptr);
+  }
+  safiStats.log_free(call, usable);
+
+  // Before the block can be handed out again (see SafiTracer)
+  if (safiControl.trace) {
+    safiTracer.record(SAFI_EV_FREE, ptr, usable);
+  }
+  return usable;
+}
+
+
+// Mappings are made of whole pages
+static inline size_t __page_round(size_t length)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  return (length + page - 1) & ~(page - 1);
+}
+
+
+/**
+ * @brief Round an alignment like glibc's memalign: a power of two, 0 when
+ *        malloc's 16 bytes are enough
+ */
+static inline size_t __normalize_alignment(size_t alignment)
+{
+  if (alignment <= SAFI_HEADER_SIZE) {
+    return 0;
+  }
+  return (size_t)1 << (64 - __builtin_clzl(alignment - 1));
+}
+
+
+static inline SafiAllocType __alloc_type(SafiCall call)
+{
+  switch (call) {
+    case SAFI_CALL_MALLOC: return SAFI_ALLOC_MALLOC;
+    case SAFI_CALL_CALLOC: return SAFI_ALLOC_CALLOC;
+    case SAFI_CALL_NEW:
+    case SAFI_CALL_NEW_ARRAY: return SAFI_ALLOC_NEW;
+    default: return SAFI_ALLOC_MEMALIGN;
+  }
+}
+
+
+/**
+ * @brief Bootstrap realloc: the block moves and the old one is never reused
+ *
+ * @param alloc Allocation used for the new block
+ */
+static void* __bootstrap_realloc(void* ptr, size_t size, AllocImplType alloc)
+{
+  void* new_ptr = size == 0 ? nullptr : alloc(size, 0, false, SAFI_CALL_REALLOC);
+  if (new_ptr != nullptr && ptr != nullptr) {
+    memcpy(new_ptr, ptr, std::min(size, SafiBootstrap::size_of(ptr)));
+  }
+  return new_ptr;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Default mode implementations (glibc blocks as is)
+//
+// Every mode implementation is instantiated twice: TIMED (MEM_SAFI_LATENCY=1)
+// measures the original calls, the other one has no trace of the timing.
+////////////////////////////////////////////////////////////////////////////////
+
+template <bool TIMED>
+static void* __default_alloc(size_t size, size_t alignment, bool zeroed, SafiCall call)
+{
+  uint64_t start = TIMED ? safi_tsc() : 0;
+  void* p = nullptr;
+  size_t usable = 0;
+  if (alignment != 0) {
+    p = safiControl.orig_memalign(alignment, size);
+  } else if (safiControl.cache && (p = safiCache.pop(size, usable)) != nullptr) {
+    if (zeroed) {
+      memset(p, 0, size);
+    }
+  } else if (zeroed) {
+    p = safiControl.orig_calloc(1, size);
+  } else {
+    p = safiControl.orig_malloc(size);
+  }
+  if (TIMED) {
+    safiLatency.log(call, size, safi_tsc() - start);
+  }
+  if (p == nullptr) {
+    return nullptr;
+  }
+
+  // A cached block has the usable size of its list
+  if (usable == 0) {
+    usable = safiControl.orig_malloc_usable_size(p);
+  }
+  __log_alloc(p, size, usable, call, __alloc_type(call), zeroed ? SAFI_EV_CALLOC : SAFI_EV_MALLOC);
+  return p;
+}
+
+
+template <bool TIMED>
+static void* __default_realloc(void* ptr, size_t size, SafiCall call)
+{
+  if (safiBootstrap.owns(ptr)) {
+    return __bootstrap_realloc(ptr, size, __default_alloc<TIMED>);
+  }
+
+  // Untrack first: once realloc releases 'ptr' another thread may get it back
+  SafiAllocEntry old_entry;
+  bool tracked = safiControl.side_table && ptr != nullptr && safiTable.remove((uintptr_t)ptr, old_entry);
+
+  // The new block's header was just written by realloc, only the old one is cold. With
+  // scopes an untracked block was never counted, it is resized into a new one
+  size_t old_size = tracked ? old_entry.usable() : safiControl.scopes ? 0 : safiControl.orig_malloc_usable_size(ptr);
+  uint64_t start = TIMED ? safi_tsc() : 0;
+  void* new_ptr = safiControl.orig_realloc(ptr, size);
+  if (TIMED) {
+    safiLatency.log(call, size, safi_tsc() - start);
+  }
+  size_t new_size = safiControl.orig_malloc_usable_size(new_ptr);
+
+  // A failed realloc leaves the old block alive, only the call counts
+  bool failed = new_ptr == nullptr && size != 0;
+  safiStats.log_alloc(call, failed ? 0 : new_size - old_size);
+  if (new_ptr != nullptr) {
+    safiStats.log_size(size);
+  }
+
+  uint32_t site = SAFI_UNKNOWN_SITE;
+  if (safiControl.side_table) {
+    if (failed) {
+      // Failed, the old block is still alive
+      if (tracked) {
+        safiTable.insert(old_entry);
+      }
+    } else {
+      if (tracked) {
+        __log_untracked(old_entry);
+      }
+      if (new_ptr != nullptr && __should_track(size)) {
+        site = __capture_site();
+        // The block lives on, only its first allocation counts for its lifetime
+        __track_alloc(new_ptr, size, new_size, SAFI_ALLOC_REALLOC, site, tracked ? old_entry.timestamp : safi_tsc());
+      }
+    }
+  }
+  if (safiControl.trace && (new_ptr != nullptr || size == 0)) {
+    safiTracer.record(SAFI_EV_REALLOC, new_ptr, new_size, site, ptr, old_size);
+  }
+
+  return new_ptr;
+}
+
+
+/**
+ * @brief Account for a block and free it. The size of a sized operator delete
+ *        is ignored, both sides of a block ask glibc for its usable size
+ */
+template <bool TIMED>
+static void __default_release(void* ptr, size_t, bool, SafiCall call)
+{
+  // Bootstrap blocks are never reused
+  if (safiBootstrap.owns(ptr)) {
+    return;
+  }
+
+  size_t usable = __log_release(ptr, 0, call);
+
+  uint64_t start = TIMED ? safi_tsc() : 0;
+  if (!safiControl.cache || !safiCache.push(ptr, usable)) {
+    safiControl.orig_free(ptr);
+  }
+  if (TIMED) {
+    safiLatency.log(call, usable, safi_tsc() - start);
+  }
+}
+
+
+static size_t __default_usable_size(void* ptr)
+{
+  if (safiBootstrap.owns(ptr)) {
+    return SafiBootstrap::size_of(ptr);
+  }
+  return safiControl.orig_malloc_usable_size(ptr);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Header mode implementations (MEM_SAFI_HEADER=1, see safi_header.h)
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Fill the SafiHeader of a new chunk and attribute it to its site
+ *
+ * @param prefix Bytes between the chunk start and the program's pointer
+ * @return void* The program's pointer
+ */
+static inline __attribute__((always_inline)) void* __header_fill(void* base, size_t requested, size_t prefix,
+                                                                 SafiAllocType type, uint8_t align_shift)
+{
+  void* user = (char*)base + prefix;
+  SafiHeader* header = safi_header_of(user);
+  header->requested = requested;
+  header->slack = (uint16_t)std::min<size_t>(safiControl.orig_malloc_usable_size(base) - prefix - requested, UINT16_MAX);
+  header->type = type;
+  header->align_shift = align_shift;
+  header->site = SAFI_UNKNOWN_SITE;
+
+  // Blocks of an unknown site are never attributed, neither here nor on free
+  if (safiControl.sites && __should_track(requested)) {
+    header->site = __capture_site();
+    if (header->site != SAFI_UNKNOWN_SITE) {
+      double weight = __sample_weight(requested);
+      safiSites.log_alloc(header->site, std::llround(requested * weight), std::llround(weight));
+    }
+  }
+  return user;
+}
+
+
+/**
+ * @brief Allocate 'size' bytes behind a SafiHeader
+ *
+ * @param alignment Power of two, 0 for malloc's alignment
+ * @param zeroed Get the chunk from calloc
+ */
+template <bool TIMED>
+static void* __header_alloc(size_t size, size_t alignment, bool zeroed, SafiCall call)
+{
+  size_t min_prefix = safiControl.lifetimes || safiControl.threads ? SAFI_HEADER_EXT_SIZE : SAFI_HEADER_SIZE;
+  size_t prefix = safi_header_prefix(alignment, min_prefix);
+  if (size > SIZE_MAX - prefix) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+
+  uint64_t start = TIMED ? safi_tsc() : 0;
+  void* base = nullptr;
+  if (alignment != 0) {
+    base = safiControl.orig_memalign(alignment, prefix + size);
+  } else if (zeroed) {
+    base = safiControl.orig_calloc(1, prefix + size);
+  } else {
+    base = safiControl.orig_malloc(prefix + size);
+  }
+  if (TIMED) {
+    safiLatency.log(call, size, safi_tsc() - start);
+  }
+  if (base == nullptr) {
+    return nullptr;
+  }
+
+  SafiAllocType type = call == SAFI_CALL_REALLOC ? SAFI_ALLOC_REALLOC : __alloc_type(call);
+  void* user = __header_fill(base, size, prefix, type, prefix > SAFI_HEADER_SIZE ? __builtin_ctzl(prefix) : 0);
+  SafiHeader* header = safi_header_of(user);
+  if (safiControl.lifetimes) {
+    safi_header_ext(user)->birth = safi_tsc();
+  }
+  if (safiControl.threads) {
+    safi_header_ext(user)->thread = safiThreads.log_alloc(size, 1);
+  }
+  safiStats.log_alloc(call, header->usable());
+  safiStats.log_requested(size, 0);
+  safiStats.log_size(size);
+  if (safiControl.trace) {
+    SafiTraceEventType event = call == SAFI_CALL_REALLOC ? SAFI_EV_REALLOC : zeroed ? SAFI_EV_CALLOC : SAFI_EV_MALLOC;
+    safiTracer.record(event, user, header->usable(), header->site);
+  }
+  return user;
+}
+
+
+/**
+ * @brief Account for a block and give its chunk back to glibc, the header has the size
+ */
+template <bool TIMED>
+static void __header_release(void* user, size_t, bool, SafiCall call)
+{
+  if (safiBootstrap.owns(user)) {
+    return;
+  }
+
+  SafiHeader* header = safi_header_of(user);
+  safiStats.log_free(call, header->usable());
+  safiStats.log_requested(0, header->requested);
+  if (header->site != SAFI_UNKNOWN_SITE) {
+    double weight = __sample_weight(header->requested);
+    safiSites.log_free(header->site, std::llround(header->requested * weight), std::llround(weight));
+  }
+  if (safiControl.lifetimes) {
+    // Every block has its TSC, only the sites are sampled
+    int64_t site_count = header->site == SAFI_UNKNOWN_SITE ? 0 : std::llround(__sample_weight(header->requested));
+    __log_lifetime(safi_header_ext(user)->birth, header->requested, 1, header->site, site_count);
+  }
+  if (safiControl.threads) {
+    safiThreads.log_free(safi_header_ext(user)->thread, header->requested, 1);
+  }
+
+  // Before the block can be handed out again (see SafiTracer)
+  if (safiControl.trace) {
+    safiTracer.record(SAFI_EV_FREE, user, header->usable());
+  }
+
+  uint64_t usable = header->usable();
+  uint64_t start = TIMED ? safi_tsc() : 0;
+  safiControl.orig_free(header->base(user));
+  if (TIMED) {
+    safiLatency.log(call, usable, safi_tsc() - start);
+  }
+}
+
+
+/**
+ * @brief Resize a block, the prefix (and so the alignment offset) is kept
+ */
+template <bool TIMED>
+static void* __header_realloc(void* ptr, size_t size, SafiCall call)
+{
+  if (ptr == nullptr) {
+    return __header_alloc<TIMED>(size, 0, false, call);
+  }
+  if (safiBootstrap.owns(ptr)) {
+    return __bootstrap_realloc(ptr, size, __header_alloc<TIMED>);
+  }
+
+  // glibc's realloc(ptr, 0) frees the block
+  if (size == 0) {
+    __header_release<TIMED>(ptr, 0, false, call);
+    return nullptr;
+  }
+
+  // Copy it: realloc releases the old chunk
+  SafiHeader old_header = *safi_header_of(ptr);
+  size_t prefix = old_header.prefix();
+  if (size > SIZE_MAX - prefix) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+
+  uint64_t start = TIMED ? safi_tsc() : 0;
+  void* base = safiControl.orig_realloc(old_header.base(ptr), prefix + size);
+  if (TIMED) {
+    safiLatency.log(call, size, safi_tsc() - start);
+  }
+  if (base == nullptr) {
+    // Failed, the old block is still alive
+    return nullptr;
+  }
+
+  if (old_header.site != SAFI_UNKNOWN_SITE) {
+    double weight = __sample_weight(old_header.requested);
+    safiSites.log_free(old_header.site, std::llround(old_header.requested * weight), std::llround(weight));
+  }
+  void* user = __header_fill(base, size, prefix, SAFI_ALLOC_REALLOC, old_header.align_shift);
+  SafiHeader* header = safi_header_of(user);
+  if (safiControl.threads) {
+    // Like the side table: the old block is freed and the new one belongs to the caller
+    SafiHeaderExt* ext = safi_header_ext(user);
+    safiThreads.log_free(ext->thread, old_header.requested, 1);
+    ext->thread = safiThreads.log_alloc(size, 1);
+  }
+  safiStats.log_alloc(call, header->usable() - old_header.usable());
+  safiStats.log_requested(size, old_header.requested);
+  safiStats.log_size(size);
+  if (safiControl.trace) {
+    safiTracer.record(SAFI_EV_REALLOC, user, header->usable(), header->site, ptr, old_header.usable());
+  }
+  return user;
+}
+
+
+// Header mode blocks do not start where their chunk does
+static size_t __header_usable_size(void* ptr)
+{
+  if (safiBootstrap.owns(ptr)) {
+    return SafiBootstrap::size_of(ptr);
+  }
+  return ptr == nullptr ? 0 : safi_header_of(ptr)->usable();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Scoped mode implementations (MEM_SAFI_SCOPES=1, see memsafi.h)
+//
+// The threads in a scope use the default mode, the others go straight to
+// glibc. A block is tracked if it is in the side table, the filter rejects the
+// other pointers without taking a lock.
+////////////////////////////////////////////////////////////////////////////////
+
+template <bool TIMED>
+static void* __scoped_alloc(size_t size, size_t alignment, bool zeroed, SafiCall call)
+{
+  if (safi_scope_active()) {
+    return __default_alloc<TIMED>(size, alignment, zeroed, call);
+  }
+  if (alignment != 0) {
+    return safiControl.orig_memalign(alignment, size);
+  }
+  return zeroed ? safiControl.orig_calloc(1, size) : safiControl.orig_malloc(size);
+}
+
+
+// A tracked block stays tracked whichever thread resizes it
+template <bool TIMED>
+static void* __scoped_realloc(void* ptr, size_t size, SafiCall call)
+{
+  if (safiBootstrap.owns(ptr)) {
+    return __bootstrap_realloc(ptr, size, __scoped_alloc<TIMED>);
+  }
+  if (safi_scope_active() || (ptr != nullptr && safiTable.contains((uintptr_t)ptr))) {
+    return __default_realloc<TIMED>(ptr, size, call);
+  }
+  return safiControl.orig_realloc(ptr, size);
+}
+
+
+template <bool TIMED>
+static void __scoped_release(void* ptr, size_t size, bool aligned, SafiCall call)
+{
+  if (ptr != nullptr && safiTable.contains((uintptr_t)ptr)) {
+    __default_release<TIMED>(ptr, size, aligned, call);
+  } else if (!safiBootstrap.owns(ptr)) {
+    safiControl.orig_free(ptr);
+  }
+}
+
+
+/**
+ * @brief Switch the wrappers to the implementations of the selected mode
+ */
+template <bool TIMED>
+static void __install_dispatch()
+{
+  if (safiControl.header) {
+    safiDispatch.realloc.store(__header_realloc<TIMED>, std::memory_order_release);
+    safiDispatch.release.store(__header_release<TIMED>, std::memory_order_release);
+    safiDispatch.usable_size.store(__header_usable_size, std::memory_order_release);
+    safiDispatch.alloc.store(__header_alloc<TIMED>, std::memory_order_release);
+  } else if (safiControl.scopes) {
+    safiDispatch.realloc.store(__scoped_realloc<TIMED>, std::memory_order_release);
+    safiDispatch.release.store(__scoped_release<TIMED>, std::memory_order_release);
+    safiDispatch.usable_size.store(__default_usable_size, std::memory_order_release);
+    safiDispatch.alloc.store(__scoped_alloc<TIMED>, std::memory_order_release);
+  } else {
+    safiDispatch.realloc.store(__default_realloc<TIMED>, std::memory_order_release);
+    safiDispatch.release.store(__default_release<TIMED>, std::memory_order_release);
+    safiDispatch.usable_size.store(__default_usable_size, std::memory_order_release);
+    safiDispatch.alloc.store(__default_alloc<TIMED>, std::memory_order_release);
+  }
+}
+
+
+/**
+ * @brief pthread_atfork() handlers: the child only keeps the forking thread,
+ *        the locks other threads held are taken before fork() so that they
+ *        are free in the child
+ *
+ * The output locks come first: a report in progress may allocate (dladdr),
+ * which needs the side table.
+ */
+static void __prepare_fork()
+{
+  safiReporter.lock_for_fork();
+  safiHeap.lock_for_fork();
+  safiStats.lock_shards();
+  if (safiControl.cache) {
+    safiCache.lock_for_fork();
+  }
+  if (safiControl.side_table) {
+    safiTable.lock_all();
+  }
+}
+
+
+static void __parent_after_fork()
+{
+  if (safiControl.side_table) {
+    safiTable.unlock_all();
+  }
+  if (safiControl.cache) {
+    safiCache.unlock_after_fork();
+  }
+  safiStats.unlock_shards();
+  safiHeap.unlock_after_fork();
+  safiReporter.unlock_after_fork();
+}
+
+
+/**
+ * @brief Rebase the counters on the inherited heap and restart the threads
+ *        with the child's pid
+ */
+static void __child_after_fork()
+{
+  __parent_after_fork();
+  if (safiControl.finish_started.load()) {
+    return;
+  }
+
+  safiStats.rebase();
+  if (safiControl.timeline) {
+    SafiSnapshot snapshot;
+    safiStats.snapshot(snapshot);
+    safiTimeline.restart_in_child(snapshot);
+  }
+  if (safiControl.memory) {
+    safiMemory.restart_in_child();
+  }
+  if (safiControl.cache) {
+    safiCache.restart_in_child();
+  }
+  if (safiControl.sites) {
+    safiSites.rebase();
+  }
+  if (safiControl.scopes) {
+    safiTags.rebase();
+  }
+  if (safiControl.trace) {
+    safiTracer.abandon_in_child();
+    safiControl.trace = false;
+  }
+
+  // A shared report file is kept, every report carries the pid
+  int fd = safiReporter.fd();
+  char* report_file = getenv("MEM_SAFI_REPORT_FILE");
+  if (report_file != nullptr && strstr(report_file, "%p") != nullptr) {
+    close(fd);
+    fd = __open_report_fd();
+  }
+  safiReporter.restart_in_child(fd);
+
+  safiShm.restart_in_child();
+  char socket_path[sizeof(sockaddr_un::sun_path)];
+  safiCommands.restart_in_child(__socket_path(socket_path, sizeof(socket_path), true) ? socket_path : nullptr);
+  safiHeap.restart_in_child();
+}
+
+
+/**
+ * @brief Capture the original function pointers and select the mode, runs once
+ *        (see __ensure_init)
+ */
+static void __init_safi()
+{
+  // safi_now_ns() only has jiffy resolution
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  safiControl.debug = __env_flag("MEM_SAFI_DEBUG");
+
+  // Heap profiles are made of the sites
+  char* heap_signal_str = getenv("MEM_SAFI_HEAP_SIGNAL");
+  int heap_signal = safi_parse_signal(heap_signal_str);
+  if (heap_signal_str != nullptr && heap_signal == 0) {
+    SAFI_LOG_ERROR("[ERROR] Unknown signal MEM_SAFI_HEAP_SIGNAL='%s', heap profiles disabled!\n", heap_signal_str);
+  }
+
+  // Leaks are grouped by site
+  if (__env_flag("MEM_SAFI_LEAKS")) {
+    safiControl.leaks = true;
+    char* top_leaks_str = getenv("MEM_SAFI_TOP_LEAKS");
+    safiControl.top_leaks = top_leaks_str != nullptr ? std::max<int64_t>(atoll(top_leaks_str), 0) : DEFAULT_TOP_LEAKS;
+    safiControl.leak_jobs = __env_int("MEM_SAFI_LEAK_JOBS", std::max(1u, std::thread::hardware_concurrency()));
+  }
+
+  if (__env_flag("MEM_SAFI_SITES") || heap_signal != 0 || safiControl.leaks) {
+    if (safiSites.init()) {
+      safiControl.sites = true;
+      safiControl.stack_depth = std::min<int64_t>(__env_int("MEM_SAFI_STACK_DEPTH", DEFAULT_STACK_DEPTH), SAFI_MAX_STACK_DEPTH);
+      safiControl.top_sites = __env_int("MEM_SAFI_TOP_SITES", DEFAULT_TOP_SITES);
+    } else {
+      SAFI_LOG_ERROR("[ERROR] Failed to map the site table, sites disabled!\n");
+    }
+  }
+
+  if (__env_flag("MEM_SAFI_LIFETIMES")) {
+    safiControl.lifetimes = true;
+    safiControl.short_lived_ns = __env_int("MEM_SAFI_SHORT_LIVED_US", DEFAULT_SHORT_LIVED_US) * 1000;
+  }
+
+  if (__env_flag("MEM_SAFI_THREADS")) {
+    if (safiThreads.init()) {
+      safiControl.threads = true;
+      safiControl.top_threads = __env_int("MEM_SAFI_TOP_THREADS", DEFAULT_TOP_THREADS);
+    } else {
+      SAFI_LOG_ERROR("[ERROR] Failed to map the thread table, threads disabled!\n");
+    }
+  }
+
+  // The side table tells the blocks of the scopes apart, through the filter so the other frees take no lock
+  if (__env_flag("MEM_SAFI_SCOPES")) {
+    if (__env_flag("MEM_SAFI_HEADER")) {
+      SAFI_LOG_ERROR("[ERROR] MEM_SAFI_SCOPES is not supported with MEM_SAFI_HEADER=1, scopes disabled!\n");
+    } else if (safiTable.enable_filter()) {
+      safiControl.scopes = true;
+    } else {
+      SAFI_LOG_ERROR("[ERROR] Failed to map the side table filter, scopes disabled!\n");
+    }
+  }
+
+  // Sites, lifetimes and threads are attributed back on free through the side table, or through the block headers
+  if (__env_flag("MEM_SAFI_HEADER")) {
+    safiControl.header = true;
+    safiControl.sample_bytes = std::max<int64_t>(__env_int("MEM_SAFI_SAMPLE_BYTES", 0), 0);
+    safiStats.enable_requested();
+  } else if (__env_flag("MEM_SAFI_SIDE_TABLE") || safiControl.sites || safiControl.lifetimes ||
+             safiControl.threads || safiControl.leaks || safiControl.scopes) {
+    safiControl.side_table = true;
+
+    // Only the sampled pointers are in the table, most frees must not take its locks. With
+    // scopes an untracked block must be one that was never counted, they do not sample
+    int64_t sample_bytes = __env_int("MEM_SAFI_SAMPLE_BYTES", 0);
+    if (sample_bytes > 0 && safiControl.scopes) {
+      SAFI_LOG_ERROR("[ERROR] MEM_SAFI_SAMPLE_BYTES is not supported with MEM_SAFI_SCOPES=1, sampling disabled!\n");
+    } else if (sample_bytes > 0 && safiTable.enable_filter()) {
+      safiControl.sample_bytes = sample_bytes;
+    }
+    safiStats.enable_requested(safiControl.sample_bytes);
+  }
+
+  if (__env_flag("MEM_SAFI_LATENCY")) {
+    if (safiLatency.init()) {
+      safiControl.latency = true;
+    } else {
+      SAFI_LOG_ERROR("[ERROR] Failed to create the latency key, latency disabled!\n");
+    }
+  }
+
+  // Lifetimes and latencies are measured in TSC ticks
+  if (safiControl.side_table || safiControl.lifetimes || safiControl.latency) {
+    safiControl.ns_per_tsc = __calibrate_tsc();
+    safiControl.start_tsc = safi_tsc();
+  }
+
+  if (__env_flag("MEM_SAFI_MEMORY")) {
+    if (safiMemory.init(__env_flag("MEM_SAFI_PSS"))) {
+      safiControl.memory = true;
+    } else {
+      SAFI_LOG_ERROR("[ERROR] Failed to open /proc/self/statm, memory breakdown disabled!\n");
+    }
+  }
+
+  if (__env_flag("MEM_SAFI_HISTOGRAMS")) {
+    safiStats.enable_histograms();
+  }
+
+  if (__env_flag("MEM_SAFI_SHARDED")) {
+    safiStats.enable_sharding(__env_int("MEM_SAFI_SHARD_FLUSH_BYTES", DEFAULT_SHARD_FLUSH_BYTES));
+  }
+
+  SAFI_LOG_INFO("[INFO] Start Init!\n");
+  safiControl.init();
+
+  // Header blocks are freed from their chunk start, they never reach the cache
+  if (__env_flag("MEM_SAFI_CACHE")) {
+    if (safiControl.header) {
+      SAFI_LOG_ERROR("[ERROR] MEM_SAFI_CACHE is not supported with MEM_SAFI_HEADER=1, cache disabled!\n");
+    } else if (safiCache.init(safiControl.orig_free, __env_int("MEM_SAFI_CACHE_BLOCKS", DEFAULT_CACHE_BLOCKS),
+                              __env_int("MEM_SAFI_CACHE_KB", DEFAULT_CACHE_KB) * 1024)) {
+      safiControl.cache = true;
+    } else {
+      SAFI_LOG_ERROR("[ERROR] Failed to create the thread cache key, cache disabled!\n");
+    }
+  }
+  dl_iterate_phdr(__find_self_text, (void*)&__capture_site);
+
+  // From here on the wrappers stop using safiBootstrap
+  if (safiControl.latency) {
+    __install_dispatch<true>();
+  } else {
+    __install_dispatch<false>();
+  }
+
+  // The reporting thread also samples the time series
+  int64_t timeline_ms = __env_int("MEM_SAFI_TIMELINE_MS", 0);
+  if (timeline_ms > 0) {
+    if (safiTimeline.init(__env_int("MEM_SAFI_TIMELINE_SAMPLES", DEFAULT_TIMELINE_SAMPLES))) {
+      safiControl.timeline = true;
+      safiStats.enable_interval_peaks();
+      safiReporter.set_sampler(__sample_timeline, timeline_ms);
+    } else {
+      SAFI_LOG_ERROR("[ERROR] Failed to map the timeline, timeline disabled!\n");
+    }
+  }
+
+  // Spwan a thread to print stats
+  __start_reporter();
+
+  // The live stats in shared memory, and the command socket
+  if (__env_flag("MEM_SAFI_SHM")) {
+    safiShm.start(__publish_stats, __env_int("MEM_SAFI_SHM_INTERVAL_MS", DEFAULT_SHM_INTERVAL_MS));
+  }
+  char socket_path[sizeof(sockaddr_un::sun_path)];
+  if (__socket_path(socket_path, sizeof(socket_path), false)) {
+    safiCommands.start(socket_path, __run_command);
+  }
+  if (safiControl.sites && (heap_signal != 0 || safiCommands.running())) {
+    char heap_prefix[PATH_MAX];
+    char* heap_prefix_str = getenv("MEM_SAFI_HEAP_PREFIX");
+    bool custom = heap_prefix_str != nullptr && heap_prefix_str[0] != '\0';
+    safiHeap.start(__print_heap_profile, heap_signal,
+                   __expand_pid(custom ? heap_prefix_str : DEFAULT_HEAP_PREFIX, heap_prefix, sizeof(heap_prefix)));
+  }
+
+  // And one to write the event trace
+  char* trace_str = getenv("MEM_SAFI_TRACE");
+  if (trace_str != nullptr && trace_str[0] != '\0') {
+    char trace_path[PATH_MAX];
+    __expand_pid(trace_str, trace_path, sizeof(trace_path));
+    char* full_str = getenv("MEM_SAFI_TRACE_FULL");
+    bool block_when_full = full_str != nullptr && strcmp(full_str, "block") == 0;
+    uint64_t ring_events = __env_int("MEM_SAFI_TRACE_RING_EVENTS", DEFAULT_TRACE_RING_EVENTS);
+    safiControl.trace = safiTracer.start(trace_path, block_when_full, ring_events,
+                                         safiControl.sites ? &safiSites : nullptr);
+  }
+
+  pthread_atfork(__prepare_fork, __parent_after_fork, __child_after_fork);
+
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  safiControl.init_ns = (end.tv_sec - start.tv_sec) * 1000000000ll + (end.tv_nsec - start.tv_nsec);
+  SAFI_LOG_INFO("[INFO] End Init!\n");
+}
+
+/**
+ * @brief Run __init_safi() once, early callers of other threads do not wait
+ *        for it: until the dispatch table is installed they use safiBootstrap
+ */
+static void __ensure_init()
+{
+  bool expected = false;
+  if (!safiControl.init_started.load(std::memory_order_relaxed) &&
+      safiControl.init_started.compare_exchange_strong(expected, true)) {
+    __init_safi();
+  }
+}
 
-// Temp space that is used to allocate memory at initiation while dlsym is pending
-char temp_buffer[TEMP_BUFFER_SIZE];
-size_t used_buffer_size = 0;
 
+/**
+ * @brief ELF constructor, resolves everything before main even if nothing
+ *        allocates (the dynamic loader usually allocates first)
+ */
+__attribute__((constructor)) static void __safi_constructor()
+{
+  __ensure_init();
+}
 
-////////////////////////////////////////////////////////////////////////////////
-// Functions
-////////////////////////////////////////////////////////////////////////////////
 
 /**
- * @brief Function that is designed to run in a thread to print memory
- * statistics periodically (every 5 seconds)
+ * @brief Write the time series to MEM_SAFI_TIMELINE_FILE, if set
  */
-static void __print_safi_stats()
+static void __write_timeline()
 {
-  while (!safiStats.isPrintEnabled()) {
-    std::this_thread::sleep_for(std::chrono::seconds(PRINT_FREQ_IN_SEC));
-    safiStats.print();
+  char* timeline_file = getenv("MEM_SAFI_TIMELINE_FILE");
+  if (timeline_file == nullptr || timeline_file[0] == '\0') {
+    return;
+  }
+  char path[PATH_MAX];
+  __expand_pid(timeline_file, path, sizeof(path));
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to open the timeline file '%s': %s\n", path, strerror(errno));
+    return;
   }
+  safiReporter.emit_to(fd, __print_timeline_json, false);
+  close(fd);
 }
 
 
 /**
- * @brief Print debug message if debug flag is set
- * 
- * @param format Message formatted in printf style format
- * @param ... veriadic arguments
+ * @brief Stop the background threads and print the final report, runs once:
+ *        when main returns, or from the destructor if exit() skipped main_hook
  */
-void __debug_msg(const char* format, ...)
+static void __finish_safi()
 {
-  if (!safiControl.debug) {
+  bool expected = false;
+  if (!safiControl.finish_started.compare_exchange_strong(expected, true)) {
     return;
   }
 
-  va_list argptr;
-  va_start(argptr, format);
-  vfprintf(stderr, format, argptr);
-  va_end(argptr);
+  if (safiControl.trace) {
+    safiTracer.stop();
+  }
+
+  // Stop reporting statistics
+  safiCommands.stop();
+  safiHeap.stop();
+  safiShm.stop();
+  safiReporter.stop();
+  if (safiControl.timeline) {
+    __sample_timeline();
+  }
+  safiReporter.emit();
+  if (safiControl.timeline) {
+    __write_timeline();
+  }
 }
 
 
 /**
- * @brief A thread-safe temporary malloc function that could be used by dlsym for bootstraping
+ * @brief ELF destructor, run by exit() whether main returned or not
+ *
+ * Preloaded first, the library is finalized after the program: its static
+ * destructors and atexit handlers have run, what they free is not a leak.
+ * The final report was printed when main returned, stderr may be closed by
+ * now (coreutils' close_stdout), the leak report goes to its own file.
  */
-static void* __temp_malloc(size_t size)
+__attribute__((destructor)) static void __safi_destructor()
+{
+  __finish_safi();
+  if (safiControl.leaks) {
+    __report_leaks();
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Lazy implementations, installed until __init_safi() picks the mode
+////////////////////////////////////////////////////////////////////////////////
+
+// While dlsym is pending (or another thread runs the init) blocks come from safiBootstrap
+static void* __lazy_alloc(size_t size, size_t alignment, bool zeroed, SafiCall call)
+{
+  __ensure_init();
+  AllocImplType alloc = safiDispatch.alloc.load(std::memory_order_acquire);
+  if (alloc == __lazy_alloc) {
+    return __bootstrap_alloc(size, alignment);
+  }
+  return alloc(size, alignment, zeroed, call);
+}
+
+
+static void* __lazy_realloc(void* ptr, size_t size, SafiCall call)
 {
-  static std::mutex buffer_mutex;
-  std::lock_guard<std::mutex> guard(buffer_mutex);
+  __ensure_init();
+  ReallocImplType impl = safiDispatch.realloc.load(std::memory_order_acquire);
+  if (impl == __lazy_realloc) {
+    return __bootstrap_realloc(ptr, size, __lazy_alloc);
+  }
+  return impl(ptr, size, call);
+}
 
-  __debug_msg("[INFO] Temp Malloc (size: %lu)\n", size);
-  if (used_buffer_size + size > TEMP_BUFFER_SIZE) {
-    __debug_msg("[ERROR] Temp Malloc calls required more than the set max!\n");
-    exit(1);
+
+static void __lazy_release(void* ptr, size_t size, bool aligned, SafiCall call)
+{
+  __ensure_init();
+  ReleaseImplType release = safiDispatch.release.load(std::memory_order_acquire);
+  if (release != __lazy_release) {
+    release(ptr, size, aligned, call);
   }
+}
 
-  void* p = (void*)(temp_buffer + used_buffer_size);
-  used_buffer_size += size;
-  return p;
+
+static size_t __lazy_usable_size(void* ptr)
+{
+  __ensure_init();
+  UsableSizeImplType usable_size = safiDispatch.usable_size.load(std::memory_order_acquire);
+  if (usable_size == __lazy_usable_size) {
+    return safiBootstrap.owns(ptr) ? SafiBootstrap::size_of(ptr) : 0;
+  }
+  return usable_size(ptr);
 }
 
 
 /**
- * @brief Capture the original function pointers on first use
+ * @brief Common part of the operator new wrappers, same failure semantics as
+ *        the standard ones (new_handler loop then std::bad_alloc)
+ *
+ * @param alignment 0 for the unaligned versions
  */
-static void __init_safi()
+static inline __attribute__((always_inline)) void* __new_impl(size_t size, size_t alignment, SafiCall call)
 {
-  char* safi_debug_str = getenv("MEM_SAFI_DEBUG");
-  if (safi_debug_str != nullptr && strcmp(safi_debug_str, "1") == 0) {
-    safiControl.debug = true;
-  }
+  // new(0) must return a unique pointer
+  size = size == 0 ? 1 : size;
+  alignment = __normalize_alignment(alignment);
+  for (;;) {
+    void* p = safiDispatch.alloc.load(std::memory_order_acquire)(size, alignment, false, call);
+    if (p != nullptr) {
+      return p;
+    }
 
-  __debug_msg("[INFO] Start Init!\n");
-  safiControl.init();
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
 
-  // Spwan a thread to print stats
-  print_thread = new std::thread(__print_safi_stats);
 
-  __debug_msg("[INFO] End Init!\n");
+/**
+ * @brief Common part of the operator delete wrappers
+ *
+ * @param size Size given to operator new, 0 when the caller does not know it
+ * @param aligned Whether the block comes from an aligned operator new
+ */
+static inline __attribute__((always_inline)) void __delete_impl(void* ptr, size_t size, bool aligned, SafiCall call)
+{
+  if (ptr != nullptr) {
+    safiDispatch.release.load(std::memory_order_acquire)(ptr, size, aligned, call);
+  }
 }
 
 extern "C" {
@@ -142,23 +1947,11 @@ extern "C" {
  * @param size 
  * @return void* 
  */
-void* malloc(size_t size)
+SAFI_EXPORT void* malloc(size_t size)
 {
-  __debug_msg("[INFO] Malloc call (size: %lu)\n", size);
-
-  // Help dlsym to allocate some memory using a temporary buffer!
-  if (safiControl.pending_init) {
-    return __temp_malloc(size);
-  }
+  SAFI_LOG_INFO("[INFO] Malloc call (size: %lu)\n", size);
 
-  if (safiControl.orig_malloc == nullptr) {
-    __init_safi();
-  }
-
-  void* p = safiControl.orig_malloc(size);
-  safiStats.log_malloc(malloc_usable_size(p));
-
-  return p;
+  return safiDispatch.alloc.load(std::memory_order_acquire)(size, 0, false, SAFI_CALL_MALLOC);
 }
 
 
@@ -169,22 +1962,16 @@ void* malloc(size_t size)
  * @param size 
  * @return void* 
  */
-void* calloc(size_t num, size_t size)
+SAFI_EXPORT void* calloc(size_t num, size_t size)
 {
-  __debug_msg("[INFO] Calloc call (num, %lu, size: %lu)\n", num, size);
+  SAFI_LOG_INFO("[INFO] Calloc call (num, %lu, size: %lu)\n", num, size);
 
-  if (safiControl.orig_calloc == nullptr) {
-    void* p = malloc(num * size);
-    if (p != nullptr) {
-      memset(p, 0, num * size);
-    }
-    return p;
+  size_t bytes = 0;
+  if (__builtin_mul_overflow(num, size, &bytes)) {
+    errno = ENOMEM;
+    return nullptr;
   }
-
-  void* p = safiControl.orig_calloc(num, size);
-  safiStats.log_calloc(malloc_usable_size(p));
-
-  return p;
+  return safiDispatch.alloc.load(std::memory_order_acquire)(bytes, 0, true, SAFI_CALL_CALLOC);
 }
 
 
@@ -195,24 +1982,102 @@ void* calloc(size_t num, size_t size)
  * @param size 
  * @return void* 
  */
-void* realloc(void* ptr, size_t size)
+SAFI_EXPORT void* realloc(void* ptr, size_t size)
 {
-  __debug_msg("[INFO] Realloc call (ptr, %p, size: %lu)\n", ptr, size);
+  SAFI_LOG_INFO("[INFO] Realloc call (ptr, %p, size: %lu)\n", ptr, size);
 
-  if (safiControl.orig_realloc == nullptr) {
-    void* new_ptr = malloc(size);
-    if (new_ptr != nullptr && ptr != nullptr) {
-      memmove(new_ptr, ptr, size);
-      free(ptr);
-    }
-    return new_ptr;
+  return safiDispatch.realloc.load(std::memory_order_acquire)(ptr, size, SAFI_CALL_REALLOC);
+}
+
+
+/**
+ * @brief Wrapper for 'reallocarray', glibc's calls its internal realloc so it
+ *        is rebuilt on top of ours
+ */
+SAFI_EXPORT void* reallocarray(void* ptr, size_t num, size_t size)
+{
+  SAFI_LOG_INFO("[INFO] Reallocarray call (ptr, %p, num: %lu, size: %lu)\n", ptr, num, size);
+
+  size_t bytes = 0;
+  if (__builtin_mul_overflow(num, size, &bytes)) {
+    errno = ENOMEM;
+    return nullptr;
   }
+  return safiDispatch.realloc.load(std::memory_order_acquire)(ptr, bytes, SAFI_CALL_REALLOCARRAY);
+}
 
-  size_t old_size = malloc_usable_size(ptr);
-  void* new_ptr = safiControl.orig_realloc(ptr, size);
-  safiStats.log_realloc(malloc_usable_size(new_ptr) - old_size);
 
-  return new_ptr;
+/**
+ * @brief Wrapper for the original GLIBC 'posix_memalign' function
+ */
+SAFI_EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+  SAFI_LOG_INFO("[INFO] Posix_memalign call (alignment: %lu, size: %lu)\n", alignment, size);
+
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void*) != 0) {
+    return EINVAL;
+  }
+  void* p = safiDispatch.alloc.load(std::memory_order_acquire)(size, __normalize_alignment(alignment), false,
+                                                                SAFI_CALL_POSIX_MEMALIGN);
+  if (p == nullptr) {
+    return ENOMEM;
+  }
+  *memptr = p;
+  return 0;
+}
+
+
+/**
+ * @brief Wrapper for the original GLIBC 'aligned_alloc' function
+ */
+SAFI_EXPORT void* aligned_alloc(size_t alignment, size_t size)
+{
+  SAFI_LOG_INFO("[INFO] Aligned_alloc call (alignment: %lu, size: %lu)\n", alignment, size);
+
+  return safiDispatch.alloc.load(std::memory_order_acquire)(size, __normalize_alignment(alignment), false,
+                                                             SAFI_CALL_ALIGNED_ALLOC);
+}
+
+
+/**
+ * @brief Wrapper for the original GLIBC 'memalign' function
+ */
+SAFI_EXPORT void* memalign(size_t alignment, size_t size)
+{
+  SAFI_LOG_INFO("[INFO] Memalign call (alignment: %lu, size: %lu)\n", alignment, size);
+
+  return safiDispatch.alloc.load(std::memory_order_acquire)(size, __normalize_alignment(alignment), false,
+                                                             SAFI_CALL_MEMALIGN);
+}
+
+
+/**
+ * @brief Wrapper for the original GLIBC 'valloc' function
+ */
+SAFI_EXPORT void* valloc(size_t size)
+{
+  SAFI_LOG_INFO("[INFO] Valloc call (size: %lu)\n", size);
+
+  return safiDispatch.alloc.load(std::memory_order_acquire)(size, sysconf(_SC_PAGESIZE), false, SAFI_CALL_VALLOC);
+}
+
+
+/**
+ * @brief Wrapper for the original GLIBC 'pvalloc' function, the size is rounded up to whole pages
+ */
+SAFI_EXPORT void* pvalloc(size_t size)
+{
+  SAFI_LOG_INFO("[INFO] Pvalloc call (size: %lu)\n", size);
+
+  // Rounding up to the page must not wrap around
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t bytes = 0;
+  if (__builtin_add_overflow(size, page - 1, &bytes)) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  size = size == 0 ? page : bytes & ~(page - 1);
+  return safiDispatch.alloc.load(std::memory_order_acquire)(size, page, false, SAFI_CALL_PVALLOC);
 }
 
 
@@ -221,22 +2086,143 @@ void* realloc(void* ptr, size_t size)
  * 
  * @param ptr 
  */
-void free(void* ptr)
+SAFI_EXPORT void free(void* ptr)
+{
+  SAFI_LOG_INFO("[INFO] Free call (ptr: %p)!\n", ptr);
+
+  if (ptr != nullptr) {
+    safiDispatch.release.load(std::memory_order_acquire)(ptr, 0, false, SAFI_CALL_FREE);
+  }
+}
+
+
+/**
+ * @brief Wrapper for the original GLIBC 'malloc_usable_size' function, header
+ *        mode blocks do not start where their chunk does
+ */
+SAFI_EXPORT size_t malloc_usable_size(void* ptr)
 {
-  __debug_msg("[INFO] Free call (ptr: %p)!\n", ptr);
-  if (ptr >= (void*)temp_buffer && ptr <= (void*)(temp_buffer + used_buffer_size)) {
-    __debug_msg("[INFO] Free pointer allocated by temp Malloc call!\n");
+  return safiDispatch.usable_size.load(std::memory_order_acquire)(ptr);
+}
+
+
+/**
+ * @brief Wrapper for 'mmap', glibc's own mappings (large chunks, arenas, thread
+ *        stacks) use its internal calls and never come here
+ *
+ * The system call is made directly so that this works before the init.
+ */
+SAFI_EXPORT void* mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+  void* p = (void*)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+  if (p != MAP_FAILED) {
+    safiMemory.log_map(__page_round(length));
+  }
+  return p;
+}
+
+
+SAFI_EXPORT void* mmap64(void* addr, size_t length, int prot, int flags, int fd, off64_t offset)
+{
+  return mmap(addr, length, prot, flags, fd, offset);
+}
+
+
+/**
+ * @brief Wrapper for 'munmap', a range never mapped through mmap() above (a
+ *        library segment, a glibc chunk) lowers the count as well
+ */
+SAFI_EXPORT int munmap(void* addr, size_t length)
+{
+  int ret = syscall(SYS_munmap, addr, length);
+  if (ret == 0) {
+    safiMemory.log_unmap(__page_round(length));
+  }
+  return ret;
+}
+
+
+/**
+ * @brief Wrapper for 'mremap', the new address is only passed with MREMAP_FIXED
+ */
+SAFI_EXPORT void* mremap(void* old_address, size_t old_size, size_t new_size, int flags, ...)
+{
+  void* new_address = nullptr;
+  if (flags & MREMAP_FIXED) {
+    va_list args;
+    va_start(args, flags);
+    new_address = va_arg(args, void*);
+    va_end(args);
+  }
+  void* p = (void*)syscall(SYS_mremap, old_address, old_size, new_size, flags, new_address);
+  if (p != MAP_FAILED) {
+    // MREMAP_DONTUNMAP leaves the old range mapped
+    safiMemory.log_remap(flags & MREMAP_DONTUNMAP ? 0 : __page_round(old_size), __page_round(new_size));
+  }
+  return p;
+}
+
+
+/**
+ * @brief Wrapper for 'sbrk', glibc's arenas grow with its internal one
+ */
+SAFI_EXPORT void* sbrk(intptr_t increment)
+{
+  void* p = __sbrk(increment);
+  if (p != (void*)-1 && increment != 0) {
+    safiMemory.log_brk(increment);
+  }
+  return p;
+}
+
+
+/**
+ * @brief Wrapper for 'brk', moves the break through glibc's sbrk
+ */
+SAFI_EXPORT int brk(void* addr)
+{
+  char* old_break = static_cast<char*>(__sbrk(0));
+  intptr_t increment = static_cast<char*>(addr) - old_break;
+  if (old_break == (void*)-1 || __sbrk(increment) == (void*)-1) {
+    return -1;
+  }
+  safiMemory.log_brk(increment);
+  return 0;
+}
+
+
+/**
+ * @brief Profiling scopes API (see memsafi.h), only the calling thread's
+ *        state changes so it costs a few TLS stores, and nothing at all
+ *        without MEM_SAFI_SCOPES=1
+ */
+SAFI_EXPORT void memsafi_scope_begin(const char* tag)
+{
+  if (!safiControl.scopes) {
     return;
   }
+  uint32_t depth = t_safi_scope.depth;
+  if (depth < SAFI_MAX_SCOPE_DEPTH) {
+    t_safi_scope.tags[depth] = safiTags.intern(tag);
+  }
+  t_safi_scope.depth = depth + 1;
+}
 
-  if (safiControl.orig_free == nullptr) {
-    __init_safi();
+
+SAFI_EXPORT void memsafi_scope_end()
+{
+  // An unbalanced end is ignored
+  if (t_safi_scope.depth != 0) {
+    t_safi_scope.depth--;
   }
+}
 
-  size_t size = malloc_usable_size(ptr);
-  safiStats.log_free(size);
 
-  safiControl.orig_free(ptr);
+SAFI_EXPORT void memsafi_thread_enable(int enable)
+{
+  if (safiControl.scopes) {
+    t_safi_scope.enabled = enable != 0;
+  }
 }
 
 
@@ -246,16 +2232,10 @@ void free(void* ptr)
 int main_hook(int argc, char** argv, char** envp)
 {
   int ret = safiControl.orig_main(argc, argv, envp);
+  SAFI_LOG_INFO("[INFO] Actual main function completed (exit code: %d)!\n", ret);
 
-  __debug_msg("[INFO] Actual main function completed (exit code: %d)!\n", ret);
-
-  // Stop reporting statistics
-  safiStats.disablePrint();
-  if (print_thread != nullptr) {
-    print_thread->detach();
-    delete print_thread;
-  }
-  safiStats.print();
+  // Before the atexit handlers, some close stderr. The leak report waits for them (see __safi_destructor)
+  __finish_safi();
 
   return ret;
 }
@@ -264,7 +2244,7 @@ int main_hook(int argc, char** argv, char** envp)
 /**
  * @brief Wrapper for __libc_start_main() that enables wrapping the real main
  */
-int __libc_start_main(
+SAFI_EXPORT int __libc_start_main(
     MainFnTpe main,
     int argc,
     char** argv,
@@ -274,6 +2254,7 @@ int __libc_start_main(
     void* stack_end)
 {
   safiControl.orig_main = main;
+  __ensure_init();
 
   // Find the real __libc_start_main()
   using StartMainType = int (*)(
@@ -291,3 +2272,123 @@ int __libc_start_main(
 }
 
 }  // End extern "C"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// C++ allocation operators, libstdc++'s versions would show up as mallocs and frees
+////////////////////////////////////////////////////////////////////////////////
+SAFI_EXPORT void* operator new(size_t size)
+{
+  return __new_impl(size, 0, SAFI_CALL_NEW);
+}
+
+SAFI_EXPORT void* operator new[](size_t size)
+{
+  return __new_impl(size, 0, SAFI_CALL_NEW_ARRAY);
+}
+
+SAFI_EXPORT void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  try {
+    return __new_impl(size, 0, SAFI_CALL_NEW);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+SAFI_EXPORT void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  try {
+    return __new_impl(size, 0, SAFI_CALL_NEW_ARRAY);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+SAFI_EXPORT void* operator new(size_t size, std::align_val_t alignment)
+{
+  return __new_impl(size, (size_t)alignment, SAFI_CALL_NEW);
+}
+
+SAFI_EXPORT void* operator new[](size_t size, std::align_val_t alignment)
+{
+  return __new_impl(size, (size_t)alignment, SAFI_CALL_NEW_ARRAY);
+}
+
+SAFI_EXPORT void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  try {
+    return __new_impl(size, (size_t)alignment, SAFI_CALL_NEW);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+SAFI_EXPORT void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  try {
+    return __new_impl(size, (size_t)alignment, SAFI_CALL_NEW_ARRAY);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+SAFI_EXPORT void operator delete(void* ptr) noexcept
+{
+  __delete_impl(ptr, 0, false, SAFI_CALL_DELETE);
+}
+
+SAFI_EXPORT void operator delete[](void* ptr) noexcept
+{
+  __delete_impl(ptr, 0, false, SAFI_CALL_DELETE_ARRAY);
+}
+
+SAFI_EXPORT void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+  __delete_impl(ptr, 0, false, SAFI_CALL_DELETE);
+}
+
+SAFI_EXPORT void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+  __delete_impl(ptr, 0, false, SAFI_CALL_DELETE_ARRAY);
+}
+
+SAFI_EXPORT void operator delete(void* ptr, size_t size) noexcept
+{
+  __delete_impl(ptr, size == 0 ? 1 : size, false, SAFI_CALL_DELETE);
+}
+
+SAFI_EXPORT void operator delete[](void* ptr, size_t size) noexcept
+{
+  __delete_impl(ptr, size == 0 ? 1 : size, false, SAFI_CALL_DELETE_ARRAY);
+}
+
+SAFI_EXPORT void operator delete(void* ptr, std::align_val_t) noexcept
+{
+  __delete_impl(ptr, 0, true, SAFI_CALL_DELETE);
+}
+
+SAFI_EXPORT void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+  __delete_impl(ptr, 0, true, SAFI_CALL_DELETE_ARRAY);
+}
+
+SAFI_EXPORT void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  __delete_impl(ptr, 0, true, SAFI_CALL_DELETE);
+}
+
+SAFI_EXPORT void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+  __delete_impl(ptr, 0, true, SAFI_CALL_DELETE_ARRAY);
+}
+
+SAFI_EXPORT void operator delete(void* ptr, size_t size, std::align_val_t) noexcept
+{
+  __delete_impl(ptr, size, true, SAFI_CALL_DELETE);
+}
+
+SAFI_EXPORT void operator delete[](void* ptr, size_t size, std::align_val_t) noexcept
+{
+  __delete_impl(ptr, size, true, SAFI_CALL_DELETE_ARRAY);
+}
@@ -0,0 +1,95 @@
+/**
+ * @file safi_bootstrap.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the bootstrap allocator
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <unistd.h>
+
+#include <algorithm>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_bootstrap.h"
+#include "safi_mmap.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+void* SafiBootstrap::alloc(size_t size, size_t alignment)
+{
+  alignment = std::max<size_t>(alignment, SAFI_BOOTSTRAP_HEADER_SIZE);
+  m_used.store(true, std::memory_order_relaxed);
+
+  void* p = bump((uintptr_t)m_buffer, sizeof(m_buffer), m_buffer_used, size, alignment);
+
+  for (int i = 0; p == nullptr && i < SAFI_BOOTSTRAP_MAX_REGIONS; i++) {
+    uintptr_t region = m_regions[i].load(std::memory_order_acquire);
+    if (region == 0) {
+      // Threads may race to create the region, the losers unmap theirs
+      size_t page = sysconf(_SC_PAGESIZE);
+      size_t region_size = std::max<size_t>(SAFI_BOOTSTRAP_REGION_SIZE, size + alignment + SAFI_BOOTSTRAP_HEADER_SIZE);
+      region_size = (region_size + page - 1) & ~(page - 1);
+
+      void* mem = safi_mmap_alloc(region_size);
+      if (mem == nullptr) {
+        return nullptr;
+      }
+      *(uint64_t*)mem = region_size;
+      if (m_regions[i].compare_exchange_strong(region, (uintptr_t)mem, std::memory_order_acq_rel)) {
+        region = (uintptr_t)mem;
+      } else {
+        safi_mmap_free(mem, region_size);
+      }
+    }
+    p = bump(region, *(const uint64_t*)region, m_regions_used[i], size, alignment);
+  }
+  return p;
+}
+
+
+bool SafiBootstrap::owns_slow(const void* p) const
+{
+  uintptr_t address = (uintptr_t)p;
+  if (address - (uintptr_t)m_buffer < sizeof(m_buffer)) {
+    return true;
+  }
+  for (int i = 0; i < SAFI_BOOTSTRAP_MAX_REGIONS; i++) {
+    uintptr_t region = m_regions[i].load(std::memory_order_acquire);
+    if (region == 0) {
+      return false;
+    }
+    if (address - region < *(const uint64_t*)region) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+void* SafiBootstrap::bump(uintptr_t base, size_t capacity, std::atomic<size_t>& used, size_t size, size_t alignment)
+{
+  size_t offset = used.load(std::memory_order_relaxed);
+  for (;;) {
+    uintptr_t start = (base + offset + SAFI_BOOTSTRAP_HEADER_SIZE + alignment - 1) & ~(alignment - 1);
+    if (start - base > capacity || size > capacity - (start - base)) {
+      return nullptr;
+    }
+    size_t end = start - base + size;
+    if (used.compare_exchange_weak(offset, end, std::memory_order_relaxed)) {
+      ((uint64_t*)start)[-1] = size;
+      return (void*)start;
+    }
+  }
+}
@@ -0,0 +1,194 @@
+/**
+ * @file safi_cache.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the thread caches of freed blocks
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <new>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_cache.h"
+#include "safi_histogram.h"
+#include "safi_mmap.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+__thread SafiThreadCache* t_safi_cache __attribute__((tls_model("initial-exec"))) = nullptr;
+
+// Cache set the thread-exit hook returns the caches to
+static SafiCache* s_cache = nullptr;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+static void __release_thread_cache(void* cache)
+{
+  s_cache->retire_cache(static_cast<SafiThreadCache*>(cache));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiCache::init(SafiCacheFreeFnType release, int64_t max_blocks, int64_t max_bytes)
+{
+  s_cache = this;
+  m_release = release;
+  m_max_blocks = (uint32_t)std::min<int64_t>(std::max<int64_t>(max_blocks, 1), UINT32_MAX / 2);
+  m_max_bytes = std::max<int64_t>(max_bytes, SAFI_CACHE_MAX_CHUNK);
+  return pthread_key_create(&m_key, __release_thread_cache) == 0;
+}
+
+
+SafiThreadCache* SafiCache::acquire_cache()
+{
+  SafiThreadCache* cache = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_free_caches != nullptr) {
+      cache = m_free_caches;
+      m_free_caches = cache->next_free;
+    }
+  }
+
+  // Caches come straight from mmap so we never re-enter the hooked malloc
+  if (cache == nullptr) {
+    void* mem = safi_mmap_alloc(sizeof(SafiThreadCache));
+    if (mem == nullptr) {
+      return nullptr;
+    }
+    cache = new (mem) SafiThreadCache();
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    cache->next = m_caches;
+    m_caches = cache;
+  }
+
+  t_safi_cache = cache;
+  pthread_setspecific(m_key, cache);
+  return cache;
+}
+
+
+void SafiCache::trim(SafiThreadCache* cache, int size_class, uint32_t count)
+{
+  count = std::min(count, cache->counts[size_class]);
+  for (uint32_t i = 0; i < count; i++) {
+    void* block = cache->heads[size_class];
+    cache->heads[size_class] = *static_cast<void**>(block);
+    m_release(block);
+  }
+  cache->counts[size_class] -= count;
+  cache->low_marks[size_class] = std::min(cache->low_marks[size_class], cache->counts[size_class]);
+
+  size_t usable = ((size_t)size_class << 4) - sizeof(size_t);
+  SafiThreadCache::add(cache->returned, count);
+  SafiThreadCache::add(cache->held_blocks, -(int64_t)count);
+  SafiThreadCache::add(cache->held_bytes, -(int64_t)(count * usable));
+}
+
+
+void SafiCache::trim_all(SafiThreadCache* cache)
+{
+  for (int size_class = 0; size_class < SAFI_CACHE_CLASSES; size_class++) {
+    trim(cache, size_class, (cache->counts[size_class] + 1) / 2);
+  }
+}
+
+
+void SafiCache::scavenge(SafiThreadCache* cache)
+{
+  // Like tcmalloc's thread caches: a list that never went below N blocks had N too many
+  for (int size_class = 0; size_class < SAFI_CACHE_CLASSES; size_class++) {
+    trim(cache, size_class, cache->low_marks[size_class]);
+    cache->low_marks[size_class] = cache->counts[size_class];
+  }
+  cache->frees_to_scavenge = SAFI_CACHE_SCAVENGE_FREES;
+}
+
+
+void SafiCache::retire_cache(SafiThreadCache* cache)
+{
+  for (int size_class = 0; size_class < SAFI_CACHE_CLASSES; size_class++) {
+    trim(cache, size_class, cache->counts[size_class]);
+  }
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    cache->next_free = m_free_caches;
+    m_free_caches = cache;
+  }
+
+  // Frees done by later thread-exit destructors get a fresh cache
+  t_safi_cache = nullptr;
+}
+
+
+void SafiCache::restart_in_child()
+{
+  m_free_caches = nullptr;
+  for (SafiThreadCache* cache = m_caches; cache != nullptr; cache = cache->next) {
+    if (cache != t_safi_cache) {
+      for (int size_class = 0; size_class < SAFI_CACHE_CLASSES; size_class++) {
+        trim(cache, size_class, cache->counts[size_class]);
+      }
+      cache->next_free = m_free_caches;
+      m_free_caches = cache;
+    }
+    cache->hits.store(0, std::memory_order_relaxed);
+    cache->misses.store(0, std::memory_order_relaxed);
+    cache->cached_frees.store(0, std::memory_order_relaxed);
+    cache->returned.store(0, std::memory_order_relaxed);
+  }
+}
+
+
+void SafiCache::print(FILE* stream) const
+{
+  int64_t hits = 0;
+  int64_t misses = 0;
+  int64_t cached_frees = 0;
+  int64_t returned = 0;
+  int64_t held_blocks = 0;
+  int64_t held_bytes = 0;
+  int64_t threads = 0;
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    for (const SafiThreadCache* cache = m_caches; cache != nullptr; cache = cache->next) {
+      hits += cache->hits.load(std::memory_order_relaxed);
+      misses += cache->misses.load(std::memory_order_relaxed);
+      cached_frees += cache->cached_frees.load(std::memory_order_relaxed);
+      returned += cache->returned.load(std::memory_order_relaxed);
+      held_blocks += cache->held_blocks.load(std::memory_order_relaxed);
+      held_bytes += cache->held_bytes.load(std::memory_order_relaxed);
+      threads++;
+    }
+  }
+
+  char max_bytes[32];
+  char held[32];
+  safi_format_value(max_bytes, sizeof(max_bytes), m_max_bytes, false);
+  safi_format_value(held, sizeof(held), held_bytes, false);
+  fprintf(stream, "Thread cache (chunks up to %d bytes, %u blocks per size and %s per thread):\n",
+          SAFI_CACHE_MAX_CHUNK, m_max_blocks, max_bytes);
+  int64_t requests = hits + misses;
+  fprintf(stream, "  hits: %ld of %ld cacheable allocations (%.2f%%)\n", hits, requests,
+          requests == 0 ? 0.0 : 100.0 * hits / requests);
+  fprintf(stream, "  cached frees: %ld, returned to glibc: %ld\n", cached_frees, returned);
+  fprintf(stream, "  held: %ld blocks (%s) in %ld thread caches\n\n", held_blocks, held, threads);
+}
@@ -0,0 +1,200 @@
+/**
+ * @file safi_heap.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the on-demand heap profiles
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "library.h"
+#include "safi_heap.h"
+#include "safi_mmap.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+SafiHeapProfiler* SafiHeapProfiler::s_active = nullptr;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+int safi_parse_signal(const char* name)
+{
+  static const struct { const char* name; int signo; } signals[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+    {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"WINCH", SIGWINCH}, {"PWR", SIGPWR},
+  };
+
+  if (name == nullptr || name[0] == '\0') {
+    return 0;
+  }
+  if (name[0] >= '0' && name[0] <= '9') {
+    int signo = atoi(name);
+    return signo > 0 && signo < NSIG ? signo : 0;
+  }
+  if (strncmp(name, "SIG", 3) == 0) {
+    name += 3;
+  }
+  for (const auto& entry : signals) {
+    if (strcmp(name, entry.name) == 0) {
+      return entry.signo;
+    }
+  }
+  return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiHeapProfiler::start(SafiReportFnType dump, int signo, const char* prefix)
+{
+  m_dump = dump;
+  snprintf(m_prefix, sizeof(m_prefix), "%s", prefix);
+
+  // fopencookie() allocates its FILE once here, never while dumping
+  cookie_io_functions_t functions = {};
+  functions.write = &SafiHeapProfiler::stream_write;
+  m_buffer = static_cast<char*>(safi_mmap_alloc(SAFI_HEAP_BUFFER_SIZE));
+  if (m_buffer != nullptr) {
+    m_stream = fopencookie(this, "w", functions);
+  }
+  if (m_stream == nullptr) {
+    SAFI_LOG_ERROR("[ERROR] Failed to create the heap profile stream, heap profiles disabled!\n");
+    return false;
+  }
+  setvbuf(m_stream, m_buffer, _IOFBF, SAFI_HEAP_BUFFER_SIZE);
+
+  if (signo == 0) {
+    return true;
+  }
+  sem_init(&m_wakeup, 0, 0);
+  m_thread = new std::thread(&SafiHeapProfiler::dumper_loop, this);
+
+  s_active = this;
+  struct sigaction action = {};
+  action.sa_handler = &SafiHeapProfiler::on_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(signo, &action, &m_old_action) != 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to install the heap profile handler of signal %d: %s\n", signo, strerror(errno));
+    stop();
+    return false;
+  }
+  m_signo = signo;
+  return true;
+}
+
+
+void SafiHeapProfiler::stop()
+{
+  if (m_signo != 0) {
+    sigaction(m_signo, &m_old_action, nullptr);
+    m_signo = 0;
+  }
+  s_active = nullptr;
+
+  if (m_thread != nullptr) {
+    m_stop = true;
+    sem_post(&m_wakeup);
+    m_thread->join();
+    delete m_thread;
+    m_thread = nullptr;
+  }
+}
+
+
+void SafiHeapProfiler::restart_in_child()
+{
+  m_count = 0;
+  if (m_thread == nullptr) {
+    return;
+  }
+  m_thread = nullptr;
+  m_stop = false;
+  sem_init(&m_wakeup, 0, 0);
+  m_thread = new std::thread(&SafiHeapProfiler::dumper_loop, this);
+}
+
+
+void SafiHeapProfiler::dump_to(int fd, bool is_socket)
+{
+  std::lock_guard<std::mutex> guard(m_dump_mutex);
+  if (m_stream == nullptr || m_dump == nullptr) {
+    return;
+  }
+  m_out_fd = fd;
+  m_out_socket = is_socket;
+  m_dump(m_stream);
+  fflush(m_stream);
+  m_out_fd = -1;
+}
+
+
+void SafiHeapProfiler::on_signal(int)
+{
+  // sem_post() is async-signal-safe, it may still clobber errno
+  int saved_errno = errno;
+  SafiHeapProfiler* profiler = s_active;
+  if (profiler != nullptr) {
+    sem_post(&profiler->m_wakeup);
+  }
+  errno = saved_errno;
+}
+
+
+void SafiHeapProfiler::dumper_loop()
+{
+  while (true) {
+    while (sem_wait(&m_wakeup) != 0 && errno == EINTR) {
+    }
+    if (m_stop) {
+      break;
+    }
+    dump_to_file();
+  }
+}
+
+
+void SafiHeapProfiler::dump_to_file()
+{
+  char path[PATH_MAX + 32];
+  snprintf(path, sizeof(path), "%s.%d.%04d.heap", m_prefix, (int)getpid(), ++m_count);
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to open the heap profile '%s': %s\n", path, strerror(errno));
+    return;
+  }
+  dump_to(fd, false);
+  close(fd);
+  SAFI_LOG_ERROR("[MemSafi] Heap profile written to '%s'\n", path);
+}
+
+
+ssize_t SafiHeapProfiler::stream_write(void* cookie, const char* data, size_t size)
+{
+  SafiHeapProfiler* profiler = static_cast<SafiHeapProfiler*>(cookie);
+  if (profiler->m_out_fd >= 0) {
+    SafiReporter::write_all(profiler->m_out_fd, data, size, profiler->m_out_socket);
+  }
+  return size;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file safi_latency.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the allocator latency histograms
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <new>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_latency.h"
+#include "safi_mmap.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+__thread SafiLatencyShard* t_safi_latency_shard __attribute__((tls_model("initial-exec"))) = nullptr;
+
+// Table the thread-exit hook returns the shards to
+static SafiLatencyTable* s_latency_table = nullptr;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+static void __release_latency_shard(void* shard)
+{
+  s_latency_table->retire_shard(static_cast<SafiLatencyShard*>(shard));
+}
+
+
+/**
+ * @brief Print one row: number of calls, mean and quantiles of the summed buckets
+ */
+static void __print_latency_row(FILE* stream, const char* name, const int64_t* counts, int64_t ticks,
+                                double ns_per_tick)
+{
+  int64_t calls = 0;
+  for (int i = 0; i < SAFI_LATENCY_BUCKETS; i++) {
+    calls += counts[i];
+  }
+  if (calls == 0) {
+    return;
+  }
+
+  char mean[32];
+  char p50[32];
+  char p99[32];
+  char p999[32];
+  safi_format_value(mean, sizeof(mean), (uint64_t)(ticks * ns_per_tick / calls), true);
+  safi_format_value(p50, sizeof(p50), (uint64_t)(safi_hist_quantile(counts, SAFI_LATENCY_BUCKETS, 0.5) * ns_per_tick), true);
+  safi_format_value(p99, sizeof(p99), (uint64_t)(safi_hist_quantile(counts, SAFI_LATENCY_BUCKETS, 0.99) * ns_per_tick), true);
+  safi_format_value(p999, sizeof(p999), (uint64_t)(safi_hist_quantile(counts, SAFI_LATENCY_BUCKETS, 0.999) * ns_per_tick), true);
+  fprintf(stream, "  %-22s calls: %10ld mean: %8s p50 <= %8s p99 <= %8s p99.9 <= %8s\n", name, calls, mean, p50, p99,
+          p999);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiLatencyTable::init()
+{
+  s_latency_table = this;
+  return pthread_key_create(&m_key, __release_latency_shard) == 0;
+}
+
+
+SafiLatencyShard* SafiLatencyTable::acquire_shard()
+{
+  SafiLatencyShard* shard = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_free_shards != nullptr) {
+      shard = m_free_shards;
+      m_free_shards = shard->next_free;
+    }
+  }
+
+  // Shards come straight from mmap so we never re-enter the hooked malloc
+  if (shard == nullptr) {
+    void* mem = safi_mmap_alloc(sizeof(SafiLatencyShard));
+    if (mem == nullptr) {
+      return nullptr;
+    }
+    shard = new (mem) SafiLatencyShard();
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    shard->next = m_shards;
+    m_shards = shard;
+  }
+
+  t_safi_latency_shard = shard;
+  pthread_setspecific(m_key, shard);
+  return shard;
+}
+
+
+void SafiLatencyTable::retire_shard(SafiLatencyShard* shard)
+{
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    shard->next_free = m_free_shards;
+    m_free_shards = shard;
+  }
+
+  // Calls made by later thread-exit destructors get a fresh shard
+  t_safi_latency_shard = nullptr;
+}
+
+
+void SafiLatencyTable::print(FILE* stream, double ns_per_tick, double elapsed_s) const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  if (m_shards == nullptr) {
+    return;
+  }
+
+  int64_t total_ticks = 0;
+  for (const SafiLatencyShard* shard = m_shards; shard != nullptr; shard = shard->next) {
+    for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+      total_ticks += shard->call_ticks[call].load(std::memory_order_relaxed);
+    }
+  }
+  char total[32];
+  safi_format_value(total, sizeof(total), (uint64_t)(total_ticks * ns_per_tick), true);
+  fprintf(stream, "\nTime inside the original allocator: %s (%.2f%% of the run)\n", total,
+          100.0 * total_ticks * ns_per_tick / 1e9 / elapsed_s);
+
+  int64_t counts[SAFI_LATENCY_BUCKETS];
+  fprintf(stream, "Per call type:\n");
+  for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+    int64_t ticks = 0;
+    std::fill(counts, counts + SAFI_LATENCY_BUCKETS, 0);
+    for (const SafiLatencyShard* shard = m_shards; shard != nullptr; shard = shard->next) {
+      for (int i = 0; i < SAFI_LATENCY_BUCKETS; i++) {
+        counts[i] += shard->by_call[call][i].load(std::memory_order_relaxed);
+      }
+      ticks += shard->call_ticks[call].load(std::memory_order_relaxed);
+    }
+    __print_latency_row(stream, safi_call_name(call), counts, ticks, ns_per_tick);
+  }
+
+  fprintf(stream, "Per size class:\n");
+  for (int size_class = 0; size_class < SAFI_LATENCY_SIZE_CLASSES; size_class++) {
+    int64_t ticks = 0;
+    std::fill(counts, counts + SAFI_LATENCY_BUCKETS, 0);
+    for (const SafiLatencyShard* shard = m_shards; shard != nullptr; shard = shard->next) {
+      for (int i = 0; i < SAFI_LATENCY_BUCKETS; i++) {
+        counts[i] += shard->by_size[size_class][i].load(std::memory_order_relaxed);
+      }
+      ticks += shard->size_ticks[size_class].load(std::memory_order_relaxed);
+    }
+
+    char lower[32];
+    char upper[32];
+    char name[80];
+    safi_format_value(lower, sizeof(lower), size_class == 0 ? 0 : 1ull << (size_class - 1), false);
+    safi_format_value(upper, sizeof(upper), (1ull << size_class) - 1, false);
+    snprintf(name, sizeof(name), size_class == SAFI_LATENCY_SIZE_CLASSES - 1 ? "[%s, ...]" : "[%s, %s]", lower, upper);
+    __print_latency_row(stream, name, counts, ticks, ns_per_tick);
+  }
+  fprintf(stream, "\n");
+}
@@ -0,0 +1,174 @@
+/**
+ * @file safi_leaks.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the leak report
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_leaks.h"
+#include "safi_mmap.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Add the live entries of the shards [first, last) to 'sites'
+ */
+static void __walk_shards(SafiAllocTable* table, SafiWeightFnType weight, SafiLeakSite* sites,
+                          size_t first, size_t last)
+{
+  table->for_each([weight, sites] (const SafiAllocEntry& entry) {
+    double w = weight(entry.requested);
+    SafiLeakSite& site = sites[entry.site];
+    site.blocks += std::llround(w);
+    site.bytes += std::llround(entry.requested * w);
+    site.largest = std::max<uint64_t>(site.largest, entry.requested);
+  }, first, last);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiLeakTable::collect(SafiAllocTable& table, SafiWeightFnType weight, int jobs)
+{
+  if (!map()) {
+    return false;
+  }
+
+  jobs = table.size() < SAFI_LEAK_PARALLEL_BLOCKS ? 1 : std::min(std::max(jobs, 1), SAFI_MAX_LEAK_JOBS);
+  if (jobs == 1) {
+    __walk_shards(&table, weight, m_sites, 0, SAFI_TABLE_SHARDS);
+    sort();
+    return true;
+  }
+
+  // Every job fills its own sites over a contiguous range of shards, they are summed after
+  size_t sites_size = SAFI_MAX_SITES * sizeof(SafiLeakSite);
+  SafiLeakSite* partials[SAFI_MAX_LEAK_JOBS] = {nullptr};
+  std::thread workers[SAFI_MAX_LEAK_JOBS];
+  int started = 0;
+  for (int job = 0; job < jobs; job++) {
+    size_t first = SAFI_TABLE_SHARDS * job / jobs;
+    size_t last = SAFI_TABLE_SHARDS * (job + 1) / jobs;
+    partials[job] = job == 0 ? m_sites : static_cast<SafiLeakSite*>(safi_mmap_alloc(sites_size));
+    if (partials[job] == nullptr) {
+      // Out of memory, this thread walks the rest
+      __walk_shards(&table, weight, m_sites, first, SAFI_TABLE_SHARDS);
+      break;
+    }
+    workers[job] = std::thread(__walk_shards, &table, weight, partials[job], first, last);
+    started++;
+  }
+
+  for (int job = 0; job < started; job++) {
+    workers[job].join();
+  }
+  for (int job = 1; job < started; job++) {
+    for (uint32_t id = 0; id < SAFI_MAX_SITES; id++) {
+      const SafiLeakSite& partial = partials[job][id];
+      m_sites[id].blocks += partial.blocks;
+      m_sites[id].bytes += partial.bytes;
+      m_sites[id].largest = std::max(m_sites[id].largest, partial.largest);
+    }
+    safi_mmap_free(partials[job], sites_size);
+  }
+  m_jobs = started;
+  sort();
+  return true;
+}
+
+
+bool SafiLeakTable::collect(const SafiSiteTable& sites)
+{
+  if (!map()) {
+    return false;
+  }
+  for (uint32_t id = 0; id < SAFI_MAX_SITES; id++) {
+    const SafiSite* site = sites.get(id);
+    if (site != nullptr) {
+      m_sites[id].blocks = site->live_blocks.load(std::memory_order_relaxed);
+      m_sites[id].bytes = site->live_bytes.load(std::memory_order_relaxed);
+    }
+  }
+  sort();
+  return true;
+}
+
+
+void SafiLeakTable::print(FILE* stream, const SafiSiteTable& sites, size_t count, bool estimated) const
+{
+  if (m_sites == nullptr || m_order == nullptr) {
+    return;
+  }
+
+  int64_t blocks = 0, bytes = 0;
+  for (size_t rank = 0; rank < m_leaking; rank++) {
+    blocks += m_sites[m_order[rank]].blocks;
+    bytes += m_sites[m_order[rank]].bytes;
+  }
+  count = count == 0 ? m_leaking : std::min(count, m_leaking);
+
+  fprintf(stream, "Leaked at exit%s: %ld B in %ld blocks from %lu sites", estimated ? " (estimated from samples)" : "",
+          bytes, blocks, m_leaking);
+  if (m_jobs > 1) {
+    fprintf(stream, " (walked by %d threads)", m_jobs);
+  }
+  fprintf(stream, "\n\n");
+
+  for (size_t rank = 0; rank < count; rank++) {
+    uint32_t id = m_order[rank];
+    const SafiLeakSite& site = m_sites[id];
+    fprintf(stream, "#%lu leaked: %ld B in %ld blocks (%.2f%%)", rank + 1, site.bytes, site.blocks,
+            bytes > 0 ? 100.0 * site.bytes / bytes : 0.0);
+    if (site.largest > 0) {
+      fprintf(stream, ", largest block: %lu B", site.largest);
+    }
+    fprintf(stream, "\n");
+    sites.print_frames(stream, id);
+  }
+  if (count < m_leaking) {
+    fprintf(stream, "... %lu more sites, raise MEM_SAFI_TOP_LEAKS\n", m_leaking - count);
+  }
+  fprintf(stream, "\n");
+}
+
+
+bool SafiLeakTable::map()
+{
+  m_sites = static_cast<SafiLeakSite*>(safi_mmap_alloc(SAFI_MAX_SITES * sizeof(SafiLeakSite)));
+  m_order = static_cast<uint32_t*>(safi_mmap_alloc(SAFI_MAX_SITES * sizeof(uint32_t)));
+  return m_sites != nullptr && m_order != nullptr;
+}
+
+
+void SafiLeakTable::sort()
+{
+  m_leaking = 0;
+  for (uint32_t id = 0; id < SAFI_MAX_SITES; id++) {
+    if (m_sites[id].blocks > 0) {
+      m_order[m_leaking++] = id;
+    }
+  }
+  const SafiLeakSite* sites = m_sites;
+  std::sort(m_order, m_order + m_leaking, [sites] (uint32_t x, uint32_t y) {
+    return sites[x].bytes > sites[y].bytes;
+  });
+}
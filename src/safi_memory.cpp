@@ -0,0 +1,164 @@
+/**
+ * @file safi_memory.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the process memory breakdown
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_histogram.h"
+#include "safi_memory.h"
+#include "safi_mmap.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+std::atomic<int64_t> safi_own_mapped {0};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+// Bytes with their sign, the differences of counters read at different times may be negative
+static void __format_bytes(char* buffer, size_t length, int64_t bytes)
+{
+  if (bytes < 0) {
+    buffer[0] = '-';
+    safi_format_value(buffer + 1, length - 1, -bytes, false);
+  } else {
+    safi_format_value(buffer, length, bytes, false);
+  }
+}
+
+
+/**
+ * @brief Read a whole /proc file into 'buffer' from its start
+ *
+ * @return false if it could not be read
+ */
+static bool __read_proc(int fd, char* buffer, size_t size)
+{
+  ssize_t length = fd < 0 ? -1 : pread(fd, buffer, size - 1, 0);
+  if (length <= 0) {
+    return false;
+  }
+  buffer[length] = '\0';
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiMemoryStats::init(bool pss)
+{
+  m_pss = pss;
+  open_files();
+  return m_statm_fd >= 0;
+}
+
+
+void SafiMemoryStats::restart_in_child()
+{
+  if (m_statm_fd >= 0) {
+    close(m_statm_fd);
+  }
+  if (m_rollup_fd >= 0) {
+    close(m_rollup_fd);
+  }
+  open_files();
+}
+
+
+void SafiMemoryStats::open_files()
+{
+  m_statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+  m_rollup_fd = m_pss ? open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC) : -1;
+}
+
+
+void SafiMemoryStats::print(FILE* stream, int64_t live_heap) const
+{
+  // Takes the arena locks, but one report at a time is fine
+  struct mallinfo2 info = mallinfo2();
+  int64_t heap_in_use = info.uordblks + info.hblkhd;
+
+  char live[32];
+  char overhead[32];
+  char free_bytes[32];
+  char releasable[32];
+  char footprint[32];
+  char arenas[32];
+  char chunks[32];
+  __format_bytes(live, sizeof(live), live_heap);
+  __format_bytes(overhead, sizeof(overhead), heap_in_use - live_heap);
+  __format_bytes(free_bytes, sizeof(free_bytes), info.fordblks);
+  __format_bytes(releasable, sizeof(releasable), info.keepcost);
+  __format_bytes(footprint, sizeof(footprint), info.arena + info.hblkhd);
+  __format_bytes(arenas, sizeof(arenas), info.arena);
+  __format_bytes(chunks, sizeof(chunks), info.hblkhd);
+  fprintf(stream, "Memory breakdown:\n");
+  fprintf(stream, "  live heap blocks:       %10s\n", live);
+  fprintf(stream, "  allocator overhead:     %10s (chunk headers, cached blocks, blocks not seen by MemSafi)\n",
+          overhead);
+  fprintf(stream, "  free in the heap:       %10s (fragmentation, %s releasable at the top)\n", free_bytes,
+          releasable);
+  fprintf(stream, "  heap footprint:         %10s (%s in arenas, %s in mmapped chunks)\n", footprint, arenas, chunks);
+
+  char mapped[32];
+  char peak[32];
+  char brk[32];
+  char own[32];
+  __format_bytes(mapped, sizeof(mapped), m_mapped.load());
+  __format_bytes(peak, sizeof(peak), m_peak_mapped.load());
+  __format_bytes(brk, sizeof(brk), m_brk_bytes.load());
+  __format_bytes(own, sizeof(own), safi_own_mapped.load());
+  fprintf(stream, "  program's mappings:     %10s (peak: %s, mmap: %ld, munmap: %ld, mremap: %ld)\n", mapped, peak,
+          m_mmap_calls.load(), m_munmap_calls.load(), m_mremap_calls.load());
+  fprintf(stream, "  program's break:        %10s (brk/sbrk: %ld)\n", brk, m_brk_calls.load());
+  fprintf(stream, "  MemSafi's own mappings: %10s\n", own);
+
+  // Sizes in pages: total, resident, shared
+  char buffer[4096];
+  if (__read_proc(m_statm_fd, buffer, sizeof(buffer))) {
+    char* end = buffer;
+    int64_t page = sysconf(_SC_PAGESIZE);
+    int64_t size = strtoll(end, &end, 10) * page;
+    int64_t resident = strtoll(end, &end, 10) * page;
+    int64_t shared = strtoll(end, &end, 10) * page;
+    char rss[32];
+    char virt[32];
+    char file[32];
+    __format_bytes(rss, sizeof(rss), resident);
+    __format_bytes(virt, sizeof(virt), size);
+    __format_bytes(file, sizeof(file), shared);
+    fprintf(stream, "  resident (RSS):         %10s (of %s virtual, %s file-backed or shared)\n", rss, virt, file);
+  }
+  if (m_pss && __read_proc(m_rollup_fd, buffer, sizeof(buffer))) {
+    const char* line = strstr(buffer, "\nPss:");
+    if (line != nullptr) {
+      char pss[32];
+      __format_bytes(pss, sizeof(pss), strtoll(line + strlen("\nPss:"), nullptr, 10) * 1024);
+      fprintf(stream, "  proportional (PSS):     %10s\n", pss);
+    }
+  }
+  fprintf(stream, "\n");
+}
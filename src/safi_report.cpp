@@ -0,0 +1,201 @@
+/**
+ * @file safi_report.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the periodic reporter
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "library.h"
+#include "safi_mmap.h"
+#include "safi_report.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define REPORT_TRUNCATED_MSG "\n[MemSafi] Report truncated, raise MEM_SAFI_REPORT_BUFFER_KB\n"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+static void __add_ms(struct timespec& ts, int64_t ms)
+{
+  int64_t nsec = ts.tv_nsec + (ms % 1000) * 1000000;
+  ts.tv_sec += ms / 1000 + nsec / 1000000000;
+  ts.tv_nsec = nsec % 1000000000;
+}
+
+
+static bool __not_after(const struct timespec& a, const struct timespec& b)
+{
+  return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec <= b.tv_nsec);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiReporter::start(SafiReportFnType report, int fd, int64_t interval_ms, size_t buffer_size)
+{
+  m_report = report;
+  m_fd = fd;
+  m_interval_ms = interval_ms;
+
+  // fmemopen() allocates its FILE once here, never while reporting
+  m_buffer = static_cast<char*>(safi_mmap_alloc(buffer_size));
+  if (m_buffer != nullptr) {
+    m_buffer_size = buffer_size;
+    m_stream = fmemopen(m_buffer, buffer_size, "w");
+  }
+  if (m_stream == nullptr) {
+    SAFI_LOG_ERROR("[ERROR] Failed to create the report buffer, reporting to stderr!\n");
+  } else {
+    setvbuf(m_stream, nullptr, _IONBF, 0);
+  }
+
+  if (m_interval_ms > 0 || m_sample_ms > 0) {
+    spawn();
+  }
+  return m_stream != nullptr;
+}
+
+
+void SafiReporter::stop()
+{
+  if (m_thread != nullptr) {
+    pthread_mutex_lock(&m_stop_mutex);
+    m_stop = true;
+    pthread_cond_signal(&m_stop_cond);
+    pthread_mutex_unlock(&m_stop_mutex);
+
+    m_thread->join();
+    delete m_thread;
+    m_thread = nullptr;
+  }
+}
+
+
+void SafiReporter::restart_in_child(int fd)
+{
+  // Only the parent's thread object was copied, it cannot be joined
+  m_thread = nullptr;
+  m_stop = false;
+  pthread_mutex_init(&m_stop_mutex, nullptr);
+  m_fd = fd;
+  if (m_interval_ms > 0 || m_sample_ms > 0) {
+    spawn();
+  }
+}
+
+
+void SafiReporter::emit_to(int fd, SafiReportFnType report, bool is_socket)
+{
+  if (report == nullptr) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> guard(m_emit_mutex);
+  if (m_stream == nullptr) {
+    report(stderr);
+    return;
+  }
+
+  fseek(m_stream, 0, SEEK_SET);
+  report(m_stream);
+  long length = ftell(m_stream);
+  if (length <= 0) {
+    return;
+  }
+  write_all(fd, m_buffer, length, is_socket);
+  if ((size_t)length >= m_buffer_size) {
+    write_all(fd, REPORT_TRUNCATED_MSG, sizeof(REPORT_TRUNCATED_MSG) - 1, is_socket);
+  }
+}
+
+
+void SafiReporter::spawn()
+{
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&m_stop_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  m_thread = new std::thread(&SafiReporter::reporter_loop, this);
+}
+
+
+void SafiReporter::reporter_loop()
+{
+  struct timespec report_deadline;
+  clock_gettime(CLOCK_MONOTONIC, &report_deadline);
+  struct timespec sample_deadline = report_deadline;
+  __add_ms(report_deadline, m_interval_ms);
+  __add_ms(sample_deadline, m_sample_ms);
+
+  pthread_mutex_lock(&m_stop_mutex);
+  while (!m_stop) {
+    // Fixed cadences, the time taken by a report does not push the next one
+    bool sampling = m_sample_ms > 0;
+    bool reporting = m_interval_ms > 0;
+    const struct timespec& deadline =
+        !reporting || (sampling && __not_after(sample_deadline, report_deadline)) ? sample_deadline : report_deadline;
+    while (!m_stop && pthread_cond_timedwait(&m_stop_cond, &m_stop_mutex, &deadline) != ETIMEDOUT) {
+    }
+    if (m_stop) {
+      break;
+    }
+
+    pthread_mutex_unlock(&m_stop_mutex);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (sampling && __not_after(sample_deadline, now)) {
+      m_sample();
+      __add_ms(sample_deadline, m_sample_ms);
+      // The missed samples are skipped, the next one covers a longer interval
+      if (__not_after(sample_deadline, now)) {
+        sample_deadline = now;
+        __add_ms(sample_deadline, m_sample_ms);
+      }
+    }
+    if (reporting && __not_after(report_deadline, now)) {
+      emit();
+      __add_ms(report_deadline, m_interval_ms);
+    }
+    pthread_mutex_lock(&m_stop_mutex);
+  }
+  pthread_mutex_unlock(&m_stop_mutex);
+}
+
+
+void SafiReporter::write_all(int fd, const char* data, size_t size, bool is_socket)
+{
+  while (size > 0) {
+    ssize_t written = is_socket ? send(fd, data, size, MSG_NOSIGNAL) : write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    data += written;
+    size -= written;
+  }
+}
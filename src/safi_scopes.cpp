@@ -0,0 +1,119 @@
+/**
+ * @file safi_scopes.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the tag table of the profiling scopes
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <string.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_histogram.h"
+#include "safi_scopes.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define TAG_EMPTY 0
+#define TAG_BUSY 1
+#define TAG_READY 2
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+__thread SafiThreadScope t_safi_scope __attribute__((tls_model("initial-exec"))) = {};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+uint8_t SafiTagTable::intern(const char* name)
+{
+  if (name == nullptr || name[0] == '\0') {
+    return SAFI_NO_TAG;
+  }
+
+  // Names are compared on what fits in the record
+  for (uint32_t i = SAFI_OTHER_TAGS + 1; i < SAFI_MAX_TAGS; i++) {
+    SafiTag& tag = m_tags[i];
+    int state = tag.state.load(std::memory_order_acquire);
+
+    if (state == TAG_EMPTY) {
+      if (tag.state.compare_exchange_strong(state, TAG_BUSY, std::memory_order_acquire)) {
+        strncpy(tag.name, name, SAFI_TAG_NAME_SIZE - 1);
+        tag.state.store(TAG_READY, std::memory_order_release);
+        return i;
+      }
+      // Lost the race, 'state' now holds the winner's state
+    }
+
+    // Wait for a concurrent writer to publish the slot (a short copy)
+    while (state == TAG_BUSY) {
+      state = tag.state.load(std::memory_order_acquire);
+    }
+
+    if (strncmp(tag.name, name, SAFI_TAG_NAME_SIZE - 1) == 0) {
+      return i;
+    }
+  }
+
+  return SAFI_OTHER_TAGS;
+}
+
+
+void SafiTagTable::rebase()
+{
+  for (SafiTag& tag : m_tags) {
+    tag.total_bytes.store(tag.live_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    tag.total_allocs.store(tag.live_blocks.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+}
+
+
+void SafiTagTable::print(FILE* stream) const
+{
+  uint32_t order[SAFI_MAX_TAGS];
+  size_t size = 0;
+  for (uint32_t i = 0; i < SAFI_MAX_TAGS; i++) {
+    if (m_tags[i].total_allocs.load(std::memory_order_relaxed) != 0) {
+      order[size++] = i;
+    }
+  }
+
+  // Insertion sort by decreasing live bytes, there are a few dozen tags at most
+  for (size_t i = 1; i < size; i++) {
+    uint32_t id = order[i];
+    int64_t live = m_tags[id].live_bytes.load(std::memory_order_relaxed);
+    size_t j = i;
+    for (; j > 0 && m_tags[order[j - 1]].live_bytes.load(std::memory_order_relaxed) < live; j--) {
+      order[j] = order[j - 1];
+    }
+    order[j] = id;
+  }
+
+  fprintf(stream, "Scopes (only the allocations of the enabled threads and of the scopes are counted): %lu tags\n",
+          size);
+  for (size_t i = 0; i < size; i++) {
+    const SafiTag& tag = m_tags[order[i]];
+    const char* name = order[i] == SAFI_NO_TAG ? "<none>" : order[i] == SAFI_OTHER_TAGS ? "<other>" : tag.name;
+    char live[32];
+    char total[32];
+    safi_format_value(live, sizeof(live), tag.live_bytes.load(std::memory_order_relaxed), false);
+    safi_format_value(total, sizeof(total), tag.total_bytes.load(std::memory_order_relaxed), false);
+    fprintf(stream, "  %-32s live: %10s in %9ld blocks, total: %10s in %9ld allocs\n", name, live,
+            tag.live_blocks.load(std::memory_order_relaxed), total, tag.total_allocs.load(std::memory_order_relaxed));
+  }
+  fprintf(stream, "\n");
+}
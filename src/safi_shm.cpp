@@ -0,0 +1,157 @@
+/**
+ * @file safi_shm.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the shared-memory stats publisher
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "library.h"
+#include "safi_mmap.h"
+#include "safi_shm.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+static int64_t __monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiShmPublisher::start(SafiPublishFnType publish, int64_t interval_ms)
+{
+  snprintf(m_name, sizeof(m_name), SAFI_SHM_NAME_FORMAT, (int)getpid());
+  int fd = shm_open(m_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to create the shared memory segment '%s': %s\n", m_name, strerror(errno));
+    return false;
+  }
+  void* mem = MAP_FAILED;
+  if (ftruncate(fd, sizeof(SafiShmSegment)) == 0) {
+    mem = safi_sys_mmap(nullptr, sizeof(SafiShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) {
+    SAFI_LOG_ERROR("[ERROR] Failed to map the shared memory segment '%s': %s\n", m_name, strerror(errno));
+    shm_unlink(m_name);
+    return false;
+  }
+
+  m_publish = publish;
+  m_interval_ms = interval_ms;
+  m_segment = static_cast<SafiShmSegment*>(mem);
+  m_segment->version = SAFI_SHM_VERSION;
+  m_segment->size = sizeof(SafiShmSegment);
+  m_segment->pid = getpid();
+  m_segment->interval_ms = interval_ms;
+  __atomic_store_n(&m_segment->magic, SAFI_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&m_stop_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  m_thread = new std::thread(&SafiShmPublisher::publisher_loop, this);
+  return true;
+}
+
+
+void SafiShmPublisher::stop()
+{
+  if (m_thread == nullptr) {
+    return;
+  }
+  pthread_mutex_lock(&m_stop_mutex);
+  m_stop = true;
+  pthread_cond_signal(&m_stop_cond);
+  pthread_mutex_unlock(&m_stop_mutex);
+
+  m_thread->join();
+  delete m_thread;
+  m_thread = nullptr;
+
+  safi_sys_munmap(m_segment, sizeof(SafiShmSegment));
+  m_segment = nullptr;
+  shm_unlink(m_name);
+}
+
+
+void SafiShmPublisher::restart_in_child()
+{
+  if (m_thread == nullptr) {
+    return;
+  }
+  safi_sys_munmap(m_segment, sizeof(SafiShmSegment));
+  m_segment = nullptr;
+  m_thread = nullptr;
+  m_stop = false;
+  pthread_mutex_init(&m_stop_mutex, nullptr);
+  start(m_publish, m_interval_ms);
+}
+
+
+void SafiShmPublisher::publisher_loop()
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  pthread_mutex_lock(&m_stop_mutex);
+  while (!m_stop) {
+    int64_t nsec = deadline.tv_nsec + (m_interval_ms % 1000) * 1000000;
+    deadline.tv_sec += m_interval_ms / 1000 + nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+    while (!m_stop && pthread_cond_timedwait(&m_stop_cond, &m_stop_mutex, &deadline) != ETIMEDOUT) {
+    }
+    if (m_stop) {
+      break;
+    }
+
+    pthread_mutex_unlock(&m_stop_mutex);
+    publish();
+    pthread_mutex_lock(&m_stop_mutex);
+  }
+  pthread_mutex_unlock(&m_stop_mutex);
+}
+
+
+void SafiShmPublisher::publish()
+{
+  int64_t heartbeat = __atomic_load_n(&m_segment->reader_heartbeat_ns, __ATOMIC_RELAXED);
+  if (heartbeat == 0 || __monotonic_ns() - heartbeat > SAFI_SHM_READER_TIMEOUT_NS) {
+    return;
+  }
+
+  // Writer side of the sequence lock, the fences order the stores around the copy
+  uint64_t seq = m_segment->seq;
+  __atomic_store_n(&m_segment->seq, seq + 1, __ATOMIC_RELAXED);
+  std::atomic_thread_fence(std::memory_order_release);
+  m_publish(m_segment);
+  __atomic_store_n(&m_segment->seq, seq + 2, __ATOMIC_RELEASE);
+}
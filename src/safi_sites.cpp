@@ -0,0 +1,240 @@
+/**
+ * @file safi_sites.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the allocation-site table
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <dlfcn.h>
+#include <string.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_mmap.h"
+#include "safi_sites.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define SITE_EMPTY 0
+#define SITE_BUSY 1
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief FNV-1a over the return addresses, never returns SITE_EMPTY/SITE_BUSY
+ */
+static uint64_t __hash_frames(void* const* frames, int depth)
+{
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (int i = 0; i < depth; i++) {
+    h ^= (uintptr_t)frames[i];
+    h *= 0x100000001b3ull;
+  }
+  return h < 2 ? h + 2 : h;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiSiteTable::init()
+{
+  m_sites = static_cast<SafiSite*>(safi_mmap_alloc(SAFI_MAX_SITES * sizeof(SafiSite)));
+  return m_sites != nullptr;
+}
+
+
+uint32_t SafiSiteTable::intern(void* const* frames, int depth)
+{
+  if (depth <= 0) {
+    return SAFI_UNKNOWN_SITE;
+  }
+  if (depth > SAFI_MAX_STACK_DEPTH) {
+    depth = SAFI_MAX_STACK_DEPTH;
+  }
+
+  uint64_t h = __hash_frames(frames, depth);
+  const uint32_t mask = SAFI_MAX_SITES - 1;
+
+  for (uint32_t probes = 0, i = h & mask; probes < SAFI_MAX_SITES; probes++, i = (i + 1) & mask) {
+    if (i == SAFI_UNKNOWN_SITE) {
+      continue; // Reserved, never claimed
+    }
+    SafiSite& site = m_sites[i];
+    uint64_t key = site.key.load(std::memory_order_acquire);
+
+    if (key == SITE_EMPTY) {
+      if (site.key.compare_exchange_strong(key, SITE_BUSY, std::memory_order_acquire)) {
+        memcpy(site.frames, frames, depth * sizeof(void*));
+        site.depth = depth;
+        site.key.store(h, std::memory_order_release);
+        return i;
+      }
+      // Lost the race, 'key' now holds the winner's state
+    }
+
+    // Wait for a concurrent writer to publish the slot (a handful of stores)
+    while (key == SITE_BUSY) {
+      key = site.key.load(std::memory_order_acquire);
+    }
+
+    if (key == h && (int)site.depth == depth && memcmp(site.frames, frames, depth * sizeof(void*)) == 0) {
+      return i;
+    }
+  }
+
+  return SAFI_UNKNOWN_SITE;
+}
+
+
+/**
+ * @brief Keep the ids of the 'count' sites with the highest positive key in a
+ *        small sorted array, no allocation needed
+ *
+ * @return size_t Number of ids written to 'top'
+ */
+static size_t __select_top(const SafiSite* sites, size_t count, uint32_t* top, int64_t (*key)(const SafiSite&))
+{
+  size_t found = 0;
+  for (uint32_t i = 0; i < SAFI_MAX_SITES; i++) {
+    int64_t value = key(sites[i]);
+    if (value <= 0) {
+      continue;
+    }
+    size_t pos = found < count ? found++ : count;
+    while (pos > 0 && key(sites[top[pos - 1]]) < value) {
+      if (pos < count) {
+        top[pos] = top[pos - 1];
+      }
+      --pos;
+    }
+    if (pos < count) {
+      top[pos] = i;
+    }
+  }
+  return found;
+}
+
+
+/**
+ * @brief Print the symbolized frames of a site
+ */
+static void __print_frames(FILE* stream, const SafiSite& site, uint32_t id)
+{
+  if (id == SAFI_UNKNOWN_SITE) {
+    fprintf(stream, "    <unknown>\n");
+    return;
+  }
+  for (uint32_t f = 0; f < site.depth; f++) {
+    Dl_info info;
+    bool resolved = dladdr(site.frames[f], &info) != 0;
+    if (resolved && info.dli_sname != nullptr) {
+      fprintf(stream, "    %p %s+0x%lx (%s)\n", site.frames[f], info.dli_sname,
+              (uintptr_t)site.frames[f] - (uintptr_t)info.dli_saddr, info.dli_fname);
+    } else if (resolved) {
+      fprintf(stream, "    %p (%s+0x%lx)\n", site.frames[f], info.dli_fname,
+              (uintptr_t)site.frames[f] - (uintptr_t)info.dli_fbase);
+    } else {
+      fprintf(stream, "    %p\n", site.frames[f]);
+    }
+  }
+}
+
+
+void SafiSiteTable::rebase()
+{
+  if (m_sites == nullptr) {
+    return;
+  }
+  for (uint32_t i = 0; i < SAFI_MAX_SITES; i++) {
+    SafiSite& site = m_sites[i];
+    site.total_bytes.store(site.live_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    site.total_allocs.store(site.live_blocks.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    site.short_lived.store(0, std::memory_order_relaxed);
+  }
+}
+
+
+void SafiSiteTable::print_frames(FILE* stream, uint32_t site) const
+{
+  if (m_sites != nullptr && site < SAFI_MAX_SITES) {
+    __print_frames(stream, m_sites[site], site);
+  }
+}
+
+
+size_t SafiSiteTable::top_live(uint32_t* top, size_t count) const
+{
+  if (m_sites == nullptr) {
+    return 0;
+  }
+  count = count < SAFI_MAX_TOP_SITES ? count : SAFI_MAX_TOP_SITES;
+  return __select_top(m_sites, count, top, [] (const SafiSite& site) {
+    return site.live_bytes.load(std::memory_order_relaxed);
+  });
+}
+
+
+void SafiSiteTable::print_top(FILE* stream, size_t count, bool estimated) const
+{
+  if (m_sites == nullptr || count == 0) {
+    return;
+  }
+
+  uint32_t top[SAFI_MAX_TOP_SITES];
+  size_t found = top_live(top, count);
+
+  fprintf(stream, "Top %lu allocation sites by live bytes%s:\n", found, estimated ? " (estimated from samples)" : "");
+  for (size_t rank = 0; rank < found; rank++) {
+    const SafiSite& site = m_sites[top[rank]];
+    fprintf(stream, "#%lu live: %ld B in %ld blocks, total: %ld B in %ld allocs\n",
+            rank + 1, site.live_bytes.load(), site.live_blocks.load(),
+            site.total_bytes.load(), site.total_allocs.load());
+    __print_frames(stream, site, top[rank]);
+  }
+  fprintf(stream, "\n");
+}
+
+
+void SafiSiteTable::print_churn(FILE* stream, size_t count, uint64_t threshold_us, double elapsed_s,
+                                bool estimated) const
+{
+  if (m_sites == nullptr || count == 0) {
+    return;
+  }
+
+  uint32_t top[SAFI_MAX_TOP_SITES];
+  count = count < SAFI_MAX_TOP_SITES ? count : SAFI_MAX_TOP_SITES;
+  size_t found = __select_top(m_sites, count, top, [] (const SafiSite& site) {
+    return site.short_lived.load(std::memory_order_relaxed);
+  });
+  if (found == 0) {
+    return;
+  }
+
+  fprintf(stream, "Top %lu allocation sites by short-lived churn (freed within %lu us)%s:\n", found, threshold_us,
+          estimated ? " (estimated from samples)" : "");
+  for (size_t rank = 0; rank < found; rank++) {
+    const SafiSite& site = m_sites[top[rank]];
+    int64_t short_lived = site.short_lived.load();
+    int64_t allocs = site.total_allocs.load();
+    fprintf(stream, "#%lu short-lived: %ld blocks (%.0f/s, %.1f%% of %ld allocs)\n", rank + 1, short_lived,
+            short_lived / elapsed_s, allocs > 0 ? 100.0 * short_lived / allocs : 0.0, allocs);
+    __print_frames(stream, site, top[rank]);
+  }
+  fprintf(stream, "\n");
+}
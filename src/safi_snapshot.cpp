@@ -0,0 +1,251 @@
+/**
+ * @file safi_snapshot.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Formatters of the statistics snapshots
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * Every formatter only prints to the given stream, the reporter hands them
+ * a stream over its preallocated buffer (see SafiReporter).
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <string.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_snapshot.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define TIME_STR_BUFFER_SIZE 80
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Format seconds since the epoch as "YYYY-MM-DD HH:MM:SS UTC"
+ *
+ * localtime() and strftime() load the time zone (and allocate) on first use,
+ * the civil date is computed from the day count instead (days_from_civil inverse).
+ */
+static void __format_utc(char* buffer, size_t size, int64_t epoch_s)
+{
+  int64_t days = epoch_s / 86400;
+  int64_t seconds = epoch_s % 86400;
+
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  int64_t day_of_era = days - era * 146097;
+  int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+  int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  int64_t mp = (5 * day_of_year + 2) / 153;
+  int64_t day = day_of_year - (153 * mp + 2) / 5 + 1;
+  int64_t month = mp < 10 ? mp + 3 : mp - 9;
+  int64_t year = year_of_era + era * 400 + (month <= 2);
+
+  snprintf(buffer, size, "%04ld-%02ld-%02ld %02ld:%02ld:%02ld UTC", year, month, day, seconds / 3600,
+           seconds / 60 % 60, seconds % 60);
+}
+
+
+/**
+ * @brief Print a byte count in the largest unit with two decimals, then exactly
+ */
+static void __print_size(FILE* stream, const char* prefix, int64_t size)
+{
+  const char* units[] = {"B", "kB", "MB", "GB", "TB"};
+  int length = sizeof(units) / sizeof(units[0]);
+
+  double value = size;
+  int i = 0;
+  for (i = 0; (value >= 1024 || value <= -1024) && i < length - 1; i++) {
+    value /= 1024;
+  }
+  if (i == 0) {
+    fprintf(stream, "%s %ld B\n", prefix, size);
+  } else {
+    fprintf(stream, "%s %.2f %s (%ld B)\n", prefix, value, units[i], size);
+  }
+}
+
+
+// JSON object of the non-empty buckets
+static void __print_json_histogram(FILE* stream, const char* name, const int64_t* counts, int64_t sum)
+{
+  int64_t total = 0;
+  fprintf(stream, ",\"%s\":{\"buckets\":[", name);
+  for (int i = 0; i < SAFI_HIST_BUCKETS; i++) {
+    if (counts[i] != 0) {
+      fprintf(stream, "%s[%lu,%lu,%ld]", total == 0 ? "" : ",", safi_hist_lower(i), safi_hist_upper(i) - 1, counts[i]);
+      total += counts[i];
+    }
+  }
+  fprintf(stream, "],\"count\":%ld,\"sum\":%ld}", total, sum);
+}
+
+
+/**
+ * @brief Prometheus histogram with one cumulative bucket per power of two,
+ *        the same 'le' bounds on every scrape
+ */
+static void __print_prometheus_histogram(FILE* stream, const char* name, const char* help, const int64_t* counts,
+                                         int64_t sum)
+{
+  fprintf(stream, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  int64_t cumulative = 0;
+  for (int first = 0; first < SAFI_HIST_BUCKETS - SAFI_HIST_SUB_BUCKETS; first += SAFI_HIST_SUB_BUCKETS) {
+    for (int i = first; i < first + SAFI_HIST_SUB_BUCKETS; i++) {
+      cumulative += counts[i];
+    }
+    fprintf(stream, "%s_bucket{le=\"%lu\"} %ld\n", name, safi_hist_upper(first + SAFI_HIST_SUB_BUCKETS - 1) - 1,
+            cumulative);
+  }
+  for (int i = SAFI_HIST_BUCKETS - SAFI_HIST_SUB_BUCKETS; i < SAFI_HIST_BUCKETS; i++) {
+    cumulative += counts[i];
+  }
+  fprintf(stream, "%s_bucket{le=\"+Inf\"} %ld\n%s_sum %ld\n%s_count %ld\n", name, cumulative, name, sum, name,
+          cumulative);
+}
+
+
+static void __print_prometheus_metric(FILE* stream, const char* name, const char* type, const char* help,
+                                      int64_t value)
+{
+  fprintf(stream, "# HELP %s %s\n# TYPE %s %s\n%s %ld\n", name, help, name, type, name, value);
+}
+
+
+void safi_print_text(FILE* stream, const SafiSnapshot& snapshot)
+{
+  char time_buffer[TIME_STR_BUFFER_SIZE];
+  __format_utc(time_buffer, TIME_STR_BUFFER_SIZE, snapshot.timestamp_ns / 1000000000);
+
+  fprintf(stream, "\n\n>>>>>>>>>>>>> %s pid %ld <<<<<<<<<<<\n", time_buffer, snapshot.pid);
+  fprintf(stream, "Overall stats (with alignement):\n");
+
+  __print_size(stream, "Currently reserved:", snapshot.reserved);
+  fprintf(stream, "\n");
+
+  __print_size(stream, "Peak memory:", snapshot.peak);
+  if (snapshot.sharded) {
+    // Live shards may each hold up to their flush bytes not yet seen by the peak
+    __print_size(stream, "Peak accuracy: +/-", snapshot.peak_accuracy);
+  } else {
+    fprintf(stream, "Peak accuracy: exact\n");
+  }
+  __print_size(stream, "Total reserved:", snapshot.total_reserved);
+  __print_size(stream, "Total freed:", snapshot.freed);
+  fprintf(stream, "\n");
+
+  // The less common entry points are only listed once used
+  for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+    int64_t count = snapshot.num_calls[call];
+    bool core = call == SAFI_CALL_MALLOC || call == SAFI_CALL_CALLOC || call == SAFI_CALL_REALLOC || call == SAFI_CALL_FREE;
+    if (core || count != 0) {
+      fprintf(stream, "Number of %s: %ld\n", safi_call_name(call), count);
+    }
+  }
+
+  if (snapshot.track_requested) {
+    int64_t requested = snapshot.requested();
+    fprintf(stream, "\nRequested stats (before alignment):\n");
+    if (snapshot.sample_bytes != 0) {
+      fprintf(stream, "Estimated from one sample every %ld bytes allocated\n", snapshot.sample_bytes);
+    }
+    __print_size(stream, "Currently requested:", requested);
+    __print_size(stream, "Total requested:", snapshot.total_requested);
+    __print_size(stream, "Total freed:", snapshot.freed_requested);
+    if (requested > 0) {
+      fprintf(stream, "Alignment overhead (reserved / requested): %.3f\n", (double)snapshot.reserved / requested);
+    }
+  }
+
+  if (snapshot.histograms) {
+    safi_hist_print(stream, "Allocation sizes (requested bytes)", snapshot.sizes, false);
+    safi_hist_print(stream, snapshot.sample_bytes != 0 ? "Lifetimes of the sampled blocks (estimated counts)"
+                                                       : "Lifetimes (allocation to free)", snapshot.lifetimes, true);
+  }
+
+  fprintf(stream, "\n");
+  fprintf(stream, "MemSafi init time: %.1f us\n\n", snapshot.init_ns / 1000.0);
+}
+
+
+void safi_print_json(FILE* stream, const SafiSnapshot& snapshot)
+{
+  fprintf(stream, "{\"timestamp_ns\":%ld,\"pid\":%ld,\"init_ns\":%ld,\"reserved\":%ld,\"peak\":%ld,"
+          "\"peak_accuracy\":%ld,\"total_reserved\":%ld,\"freed\":%ld,\"calls\":{", snapshot.timestamp_ns,
+          snapshot.pid, snapshot.init_ns, snapshot.reserved, snapshot.peak, snapshot.peak_accuracy,
+          snapshot.total_reserved, snapshot.freed);
+  for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+    fprintf(stream, "%s\"%s\":%ld", call == 0 ? "" : ",", safi_call_key(call), snapshot.num_calls[call]);
+  }
+  fprintf(stream, "}");
+
+  if (snapshot.track_requested) {
+    fprintf(stream, ",\"requested\":{\"current\":%ld,\"total\":%ld,\"freed\":%ld,\"sample_bytes\":%ld}",
+            snapshot.requested(), snapshot.total_requested, snapshot.freed_requested, snapshot.sample_bytes);
+  }
+  if (snapshot.histograms) {
+    __print_json_histogram(stream, "size_bytes", snapshot.sizes, snapshot.sizes_sum);
+    __print_json_histogram(stream, "lifetime_ns", snapshot.lifetimes, snapshot.lifetimes_sum);
+  }
+  fprintf(stream, "}\n");
+}
+
+
+void safi_print_prometheus(FILE* stream, const SafiSnapshot& snapshot)
+{
+  __print_prometheus_metric(stream, "memsafi_reserved_bytes", "gauge", "Usable bytes of the live blocks",
+                            snapshot.reserved);
+  __print_prometheus_metric(stream, "memsafi_peak_reserved_bytes", "gauge", "Highest memsafi_reserved_bytes",
+                            snapshot.peak);
+  __print_prometheus_metric(stream, "memsafi_peak_accuracy_bytes", "gauge",
+                            "Bound of the error of memsafi_peak_reserved_bytes, 0 when exact", snapshot.peak_accuracy);
+  __print_prometheus_metric(stream, "memsafi_allocated_bytes_total", "counter", "Usable bytes ever allocated",
+                            snapshot.total_reserved);
+  __print_prometheus_metric(stream, "memsafi_freed_bytes_total", "counter", "Usable bytes ever freed", snapshot.freed);
+
+  fprintf(stream, "# HELP memsafi_calls_total Calls per hooked entry point\n# TYPE memsafi_calls_total counter\n");
+  for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+    fprintf(stream, "memsafi_calls_total{call=\"%s\"} %ld\n", safi_call_key(call), snapshot.num_calls[call]);
+  }
+
+  if (snapshot.track_requested) {
+    __print_prometheus_metric(stream, "memsafi_requested_bytes", "gauge", "Requested bytes of the live blocks",
+                              snapshot.requested());
+    __print_prometheus_metric(stream, "memsafi_allocated_requested_bytes_total", "counter", "Requested bytes ever allocated",
+                              snapshot.total_requested);
+    __print_prometheus_metric(stream, "memsafi_freed_requested_bytes_total", "counter",
+                              "Requested bytes ever freed", snapshot.freed_requested);
+  }
+  if (snapshot.histograms) {
+    __print_prometheus_histogram(stream, "memsafi_allocation_size_bytes", "Requested bytes of the allocations",
+                                 snapshot.sizes, snapshot.sizes_sum);
+    __print_prometheus_histogram(stream, "memsafi_lifetime_ns", "Time between allocation and free",
+                                 snapshot.lifetimes, snapshot.lifetimes_sum);
+  }
+}
+
+
+SafiReportFormat safi_report_format(const char* name)
+{
+  if (name != nullptr && strcmp(name, "json") == 0) {
+    return SAFI_FORMAT_JSON;
+  }
+  if (name != nullptr && strcmp(name, "prometheus") == 0) {
+    return SAFI_FORMAT_PROMETHEUS;
+  }
+  return SAFI_FORMAT_TEXT;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file safi_socket.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the command socket
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "library.h"
+#include "safi_socket.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiCommandServer::start(const char* path, SafiCommandFnType handler)
+{
+  if (strlen(path) >= sizeof(m_address.sun_path)) {
+    SAFI_LOG_ERROR("[ERROR] Socket path too long: '%s'\n", path);
+    return false;
+  }
+  m_address.sun_family = AF_UNIX;
+  strncpy(m_address.sun_path, path, sizeof(m_address.sun_path) - 1);
+
+  m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (m_fd < 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to create the command socket: %s\n", strerror(errno));
+    return false;
+  }
+  unlink(path);
+  if (bind(m_fd, (struct sockaddr*)&m_address, sizeof(m_address)) != 0 || listen(m_fd, 4) != 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to listen on '%s': %s\n", path, strerror(errno));
+    close(m_fd);
+    m_fd = -1;
+    return false;
+  }
+
+  m_handler = handler;
+  m_thread = new std::thread(&SafiCommandServer::server_loop, this);
+  return true;
+}
+
+
+void SafiCommandServer::stop()
+{
+  if (m_thread == nullptr) {
+    return;
+  }
+
+  // Fails the pending accept() of the server thread
+  m_stop = true;
+  shutdown(m_fd, SHUT_RDWR);
+  m_thread->join();
+  delete m_thread;
+  m_thread = nullptr;
+
+  close(m_fd);
+  m_fd = -1;
+  unlink(m_address.sun_path);
+}
+
+
+void SafiCommandServer::restart_in_child(const char* path)
+{
+  if (m_thread == nullptr) {
+    return;
+  }
+  close(m_fd);
+  m_fd = -1;
+  m_thread = nullptr;
+  m_stop = false;
+  if (path != nullptr) {
+    start(path, m_handler);
+  }
+}
+
+
+void SafiCommandServer::server_loop()
+{
+  while (!m_stop) {
+    int client = accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      break;
+    }
+    serve(client);
+    close(client);
+  }
+}
+
+
+void SafiCommandServer::serve(int client)
+{
+  // A silent client must not hold the server forever
+  struct timeval timeout;
+  timeout.tv_sec = SAFI_COMMAND_TIMEOUT_MS / 1000;
+  timeout.tv_usec = (SAFI_COMMAND_TIMEOUT_MS % 1000) * 1000;
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  char command[SAFI_COMMAND_SIZE];
+  size_t length = 0;
+  while (length < sizeof(command) - 1) {
+    ssize_t received = read(client, command + length, sizeof(command) - 1 - length);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      break;
+    }
+    length += received;
+    if (memchr(command, '\n', length) != nullptr) {
+      break;
+    }
+  }
+
+  // Up to the first line feed, without trailing spaces
+  command[length] = '\0';
+  length = strcspn(command, "\r\n");
+  while (length > 0 && command[length - 1] == ' ') {
+    length--;
+  }
+  command[length] = '\0';
+  m_handler(command, client);
+}
@@ -0,0 +1,162 @@
+/**
+ * @file safi_table.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the pointer side table
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <mutex>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_mmap.h"
+#include "safi_table.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiAllocTable::insert(const SafiAllocEntry& entry)
+{
+  uint64_t h = hash(entry.ptr);
+  SafiTableShard& shard = shard_of(h);
+  std::lock_guard<SafiSpinLock> guard(shard.lock);
+
+  if ((shard.size + 1) * 100 > shard.capacity * SAFI_TABLE_MAX_LOAD_PERCENT && !grow(shard)) {
+    return false;
+  }
+
+  size_t mask = shard.capacity - 1;
+  size_t i = h & mask;
+  while (shard.entries[i].ptr != 0) {
+    i = (i + 1) & mask;
+  }
+  shard.entries[i] = entry;
+  ++shard.size;
+
+  if (m_filter != nullptr) {
+    filter_of(h).fetch_add(1, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+
+bool SafiAllocTable::remove(uintptr_t ptr, SafiAllocEntry& entry)
+{
+  uint64_t h = hash(ptr);
+  if (m_filter != nullptr && filter_of(h).load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+
+  SafiTableShard& shard = shard_of(h);
+  std::lock_guard<SafiSpinLock> guard(shard.lock);
+
+  if (shard.entries == nullptr) {
+    return false;
+  }
+
+  size_t mask = shard.capacity - 1;
+  size_t i = h & mask;
+  while (shard.entries[i].ptr != ptr) {
+    if (shard.entries[i].ptr == 0) {
+      return false;
+    }
+    i = (i + 1) & mask;
+  }
+  entry = shard.entries[i];
+
+  // Backward shift: pull later entries of the cluster into the hole unless
+  // that would move them before their home slot
+  size_t hole = i;
+  for (size_t j = (i + 1) & mask; shard.entries[j].ptr != 0; j = (j + 1) & mask) {
+    size_t home = hash(shard.entries[j].ptr) & mask;
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      shard.entries[hole] = shard.entries[j];
+      hole = j;
+    }
+  }
+  shard.entries[hole].ptr = 0;
+  --shard.size;
+
+  if (m_filter != nullptr) {
+    filter_of(h).fetch_sub(1, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+
+bool SafiAllocTable::contains(uintptr_t ptr)
+{
+  uint64_t h = hash(ptr);
+  if (m_filter != nullptr && filter_of(h).load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+
+  SafiTableShard& shard = shard_of(h);
+  std::lock_guard<SafiSpinLock> guard(shard.lock);
+
+  if (shard.entries == nullptr) {
+    return false;
+  }
+
+  size_t mask = shard.capacity - 1;
+  for (size_t i = h & mask; shard.entries[i].ptr != 0; i = (i + 1) & mask) {
+    if (shard.entries[i].ptr == ptr) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+size_t SafiAllocTable::size() const
+{
+  size_t total = 0;
+  for (const SafiTableShard& shard : m_shards) {
+    total += shard.size;
+  }
+  return total;
+}
+
+
+bool SafiAllocTable::enable_filter()
+{
+  m_filter = static_cast<std::atomic<uint16_t>*>(safi_mmap_alloc(SAFI_FILTER_SIZE * sizeof(std::atomic<uint16_t>)));
+  return m_filter != nullptr;
+}
+
+
+bool SafiAllocTable::grow(SafiTableShard& shard)
+{
+  size_t capacity = shard.capacity == 0 ? SAFI_TABLE_INITIAL_CAPACITY : shard.capacity * 2;
+  SafiAllocEntry* entries = static_cast<SafiAllocEntry*>(safi_mmap_alloc(capacity * sizeof(SafiAllocEntry)));
+  if (entries == nullptr) {
+    return false;
+  }
+
+  size_t mask = capacity - 1;
+  for (size_t i = 0; i < shard.capacity; i++) {
+    if (shard.entries[i].ptr == 0) {
+      continue;
+    }
+    size_t j = hash(shard.entries[i].ptr) & mask;
+    while (entries[j].ptr != 0) {
+      j = (j + 1) & mask;
+    }
+    entries[j] = shard.entries[i];
+  }
+
+  safi_mmap_free(shard.entries, shard.capacity * sizeof(SafiAllocEntry));
+  shard.entries = entries;
+  shard.capacity = capacity;
+  return true;
+}
@@ -0,0 +1,211 @@
+/**
+ * @file safi_threads.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the per-thread memory breakdown
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <new>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_mmap.h"
+#include "safi_threads.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+
+// Threads of the same name summed up (thread pools name all their workers alike)
+struct SafiThreadGroup
+{
+ public:
+  char name[SAFI_THREAD_NAME_SIZE];
+  int64_t threads;
+  int64_t live_bytes;
+  int64_t allocated_bytes;
+  int64_t freed_by_others;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+__thread uint32_t t_safi_thread __attribute__((tls_model("initial-exec"))) = SAFI_OTHER_THREADS;
+
+// Table the thread-exit hook returns to
+static SafiThreadTable* s_thread_table = nullptr;
+
+// Report scratch space, guarded by SafiThreadTable::m_names_mutex
+static uint32_t s_top[SAFI_MAX_THREADS];
+static SafiThreadGroup s_groups[SAFI_MAX_THREADS];
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+static void __release_thread_record(void* record)
+{
+  s_thread_table->retire_thread(static_cast<SafiThreadRecord*>(record));
+}
+
+
+/**
+ * @brief Sort 'ids' (partially, the first 'count' ones) by decreasing key
+ */
+template <typename Key>
+static void __partial_sort(uint32_t* ids, size_t size, size_t count, Key key)
+{
+  for (size_t i = 0; i < count && i < size; i++) {
+    size_t best = i;
+    for (size_t j = i + 1; j < size; j++) {
+      if (key(ids[j]) > key(ids[best])) {
+        best = j;
+      }
+    }
+    uint32_t tmp = ids[i];
+    ids[i] = ids[best];
+    ids[best] = tmp;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiThreadTable::init()
+{
+  s_thread_table = this;
+  m_records = static_cast<SafiThreadRecord*>(safi_mmap_alloc(SAFI_MAX_THREADS * sizeof(SafiThreadRecord)));
+  if (m_records == nullptr) {
+    return false;
+  }
+  new (&m_records[SAFI_OTHER_THREADS]) SafiThreadRecord();
+  strncpy(m_records[SAFI_OTHER_THREADS].name, "<other>", SAFI_THREAD_NAME_SIZE - 1);
+  return pthread_key_create(&m_key, __release_thread_record) == 0;
+}
+
+
+uint32_t SafiThreadTable::register_thread()
+{
+  if (m_num_records.load(std::memory_order_relaxed) >= SAFI_MAX_THREADS) {
+    return SAFI_OTHER_THREADS;
+  }
+  uint32_t id = m_num_records.fetch_add(1);
+  if (id >= SAFI_MAX_THREADS) {
+    return SAFI_OTHER_THREADS;
+  }
+
+  SafiThreadRecord* record = new (&m_records[id]) SafiThreadRecord();
+  record->handle = pthread_self();
+  {
+    std::lock_guard<std::mutex> guard(m_names_mutex);
+    pthread_getname_np(record->handle, record->name, SAFI_THREAD_NAME_SIZE);
+  }
+  record->tid.store(syscall(SYS_gettid), std::memory_order_release);
+
+  t_safi_thread = id;
+  pthread_setspecific(m_key, record);
+  return id;
+}
+
+
+void SafiThreadTable::retire_thread(SafiThreadRecord* record)
+{
+  // Pools often name their threads after they start, keep the last name
+  std::lock_guard<std::mutex> guard(m_names_mutex);
+  pthread_getname_np(pthread_self(), record->name, SAFI_THREAD_NAME_SIZE);
+  record->exited.store(true, std::memory_order_release);
+}
+
+
+void SafiThreadTable::print(FILE* stream, size_t count, bool estimated) const
+{
+  std::lock_guard<std::mutex> guard(m_names_mutex);
+  uint32_t num_records = m_num_records.load();
+  num_records = num_records < SAFI_MAX_THREADS ? num_records : SAFI_MAX_THREADS;
+
+  // Only the records fully registered, threads without allocation never get one
+  size_t size = 0;
+  for (uint32_t id = 0; id < num_records; id++) {
+    if (id == SAFI_OTHER_THREADS ? m_records[id].allocs.load() != 0 : m_records[id].tid.load(std::memory_order_acquire) != 0) {
+      s_top[size++] = id;
+    }
+  }
+
+  // Refresh the names of the live threads
+  for (size_t i = 0; i < size; i++) {
+    SafiThreadRecord& record = m_records[s_top[i]];
+    if (s_top[i] != SAFI_OTHER_THREADS && !record.exited.load(std::memory_order_acquire)) {
+      pthread_getname_np(record.handle, record.name, SAFI_THREAD_NAME_SIZE);
+    }
+  }
+
+  int64_t remote_frees = 0;
+  int64_t remote_freed_bytes = 0;
+  size_t num_groups = 0;
+  for (size_t i = 0; i < size; i++) {
+    const SafiThreadRecord& record = m_records[s_top[i]];
+    remote_frees += record.remote_frees.load(std::memory_order_relaxed);
+    remote_freed_bytes += record.remote_freed_bytes.load(std::memory_order_relaxed);
+
+    size_t group = 0;
+    while (group < num_groups && strncmp(s_groups[group].name, record.name, SAFI_THREAD_NAME_SIZE) != 0) {
+      group++;
+    }
+    if (group == num_groups) {
+      memcpy(s_groups[group].name, record.name, SAFI_THREAD_NAME_SIZE);
+      s_groups[group].threads = 0;
+      s_groups[group].live_bytes = 0;
+      s_groups[group].allocated_bytes = 0;
+      s_groups[group].freed_by_others = 0;
+      num_groups++;
+    }
+    s_groups[group].threads++;
+    s_groups[group].live_bytes += record.live_bytes();
+    s_groups[group].allocated_bytes += record.allocated_bytes.load(std::memory_order_relaxed);
+    s_groups[group].freed_by_others += record.freed_by_others.load(std::memory_order_relaxed);
+  }
+
+  const char* suffix = estimated ? " (estimated from samples)" : "";
+  fprintf(stream, "Threads%s: %lu, cross-thread frees: %ld blocks, %ld B\n", suffix, size, remote_frees,
+          remote_freed_bytes);
+
+  __partial_sort(s_top, size, count, [this] (uint32_t id) { return m_records[id].live_bytes(); });
+  fprintf(stream, "Top %lu threads by live bytes:\n", count < size ? count : size);
+  for (size_t i = 0; i < count && i < size; i++) {
+    const SafiThreadRecord& record = m_records[s_top[i]];
+    fprintf(stream, "  tid %-7d %-16s%s live: %12ld B total: %12ld B in %9ld allocs, freed by others: %ld blocks, "
+            "frees of others: %ld blocks\n", record.tid.load(), record.name, record.exited.load() ? " (exited)" : "         ",
+            record.live_bytes(), record.allocated_bytes.load(), record.allocs.load(), record.freed_by_others.load(),
+            record.remote_frees.load());
+  }
+
+  // Reuse s_top as the group order
+  for (size_t i = 0; i < num_groups; i++) {
+    s_top[i] = i;
+  }
+  __partial_sort(s_top, num_groups, count, [] (uint32_t group) { return s_groups[group].live_bytes; });
+  fprintf(stream, "Top %lu thread names by live bytes:\n", count < num_groups ? count : num_groups);
+  for (size_t i = 0; i < count && i < num_groups; i++) {
+    const SafiThreadGroup& group = s_groups[s_top[i]];
+    fprintf(stream, "  %-16s threads: %5ld live: %12ld B total: %12ld B, freed by others: %ld blocks\n", group.name,
+            group.threads, group.live_bytes, group.allocated_bytes, group.freed_by_others);
+  }
+  fprintf(stream, "\n");
+}
@@ -0,0 +1,195 @@
+/**
+ * @file safi_timeline.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the allocation time series
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <time.h>
+
+#include <algorithm>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_histogram.h"
+#include "safi_mmap.h"
+#include "safi_timeline.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+static int64_t __monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+
+static int64_t __sum_calls(const SafiSnapshot& snapshot, int first, int last)
+{
+  int64_t calls = 0;
+  for (int call = first; call < last; call++) {
+    calls += snapshot.num_calls[call];
+  }
+  return calls;
+}
+
+
+static double __per_second(int64_t value, int64_t interval_ns)
+{
+  return interval_ns <= 0 ? 0.0 : value * 1e9 / interval_ns;
+}
+
+
+// UTC time of day with milliseconds, gmtime_r() does not load the time zone
+static void __format_time(char* buffer, size_t length, int64_t timestamp_ns)
+{
+  time_t seconds = timestamp_ns / 1000000000ll;
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  size_t used = strftime(buffer, length, "%H:%M:%S", &tm);
+  snprintf(buffer + used, length - used, ".%03ld", (long)(timestamp_ns / 1000000 % 1000));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiTimeline::init(size_t capacity)
+{
+  m_ring = static_cast<SafiTimelineSample*>(safi_mmap_alloc(capacity * sizeof(SafiTimelineSample)));
+  if (m_ring == nullptr) {
+    return false;
+  }
+  m_capacity = capacity;
+  m_last_ns = __monotonic_ns();
+  return true;
+}
+
+
+void SafiTimeline::set_origin(const SafiSnapshot& snapshot)
+{
+  m_last_allocs = __sum_calls(snapshot, 0, SAFI_CALL_FREE);
+  m_last_frees = __sum_calls(snapshot, SAFI_CALL_FREE, SAFI_NUM_CALLS);
+  m_last_alloc_bytes = snapshot.total_reserved;
+  m_last_freed_bytes = snapshot.freed;
+}
+
+
+void SafiTimeline::sample(const SafiSnapshot& snapshot, int64_t interval_peak)
+{
+  int64_t now_ns = __monotonic_ns();
+  SafiTimelineSample sample;
+  sample.timestamp_ns = snapshot.timestamp_ns;
+  sample.interval_ns = now_ns - m_last_ns;
+  sample.allocs = __sum_calls(snapshot, 0, SAFI_CALL_FREE) - m_last_allocs;
+  sample.frees = __sum_calls(snapshot, SAFI_CALL_FREE, SAFI_NUM_CALLS) - m_last_frees;
+  sample.alloc_bytes = snapshot.total_reserved - m_last_alloc_bytes;
+  sample.freed_bytes = snapshot.freed - m_last_freed_bytes;
+  sample.live_bytes = snapshot.reserved;
+  sample.peak_bytes = std::max(interval_peak, snapshot.reserved);
+  m_last_ns = now_ns;
+  set_origin(snapshot);
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_ring[m_count % m_capacity] = sample;
+  m_count++;
+}
+
+
+void SafiTimeline::restart_in_child(const SafiSnapshot& snapshot)
+{
+  m_count = 0;
+  m_last_ns = __monotonic_ns();
+  set_origin(snapshot);
+}
+
+
+const SafiTimelineSample& SafiTimeline::at(size_t i) const
+{
+  return m_ring[(m_count - size() + i) % m_capacity];
+}
+
+
+void SafiTimeline::print_text(FILE* stream) const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  size_t samples = size();
+  if (samples == 0) {
+    return;
+  }
+
+  fprintf(stream, "Timeline (%lu of %lu samples kept, times in UTC):\n", samples, m_count);
+  fprintf(stream, "  %-12s %12s %12s %12s %10s %10s\n", "time", "allocs/s", "frees/s", "bytes/s", "live", "peak");
+  size_t busiest = 0;
+  for (size_t i = 0; i < samples; i++) {
+    const SafiTimelineSample& sample = at(i);
+    if (__per_second(sample.alloc_bytes, sample.interval_ns) >
+        __per_second(at(busiest).alloc_bytes, at(busiest).interval_ns)) {
+      busiest = i;
+    }
+    if (i + SAFI_TIMELINE_REPORT_ROWS < samples) {
+      continue;
+    }
+    char time_str[32];
+    char rate[32];
+    char live[32];
+    char peak[32];
+    __format_time(time_str, sizeof(time_str), sample.timestamp_ns);
+    safi_format_value(rate, sizeof(rate), __per_second(sample.alloc_bytes, sample.interval_ns), false);
+    safi_format_value(live, sizeof(live), sample.live_bytes, false);
+    safi_format_value(peak, sizeof(peak), sample.peak_bytes, false);
+    fprintf(stream, "  %-12s %12.0f %12.0f %12s %10s %10s\n", time_str,
+            __per_second(sample.allocs, sample.interval_ns), __per_second(sample.frees, sample.interval_ns), rate,
+            live, peak);
+  }
+
+  const SafiTimelineSample& sample = at(busiest);
+  char time_str[32];
+  char rate[32];
+  __format_time(time_str, sizeof(time_str), sample.timestamp_ns);
+  safi_format_value(rate, sizeof(rate), __per_second(sample.alloc_bytes, sample.interval_ns), false);
+  fprintf(stream, "  busiest interval: %s, %s/s in %.0f allocs/s\n\n", time_str, rate,
+          __per_second(sample.allocs, sample.interval_ns));
+}
+
+
+void SafiTimeline::print_json(FILE* stream) const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  for (size_t i = 0; i < size(); i++) {
+    const SafiTimelineSample& sample = at(i);
+    fprintf(stream, "{\"timestamp_ns\":%ld,\"interval_ns\":%ld,\"allocs\":%ld,\"frees\":%ld,\"alloc_bytes\":%ld,"
+            "\"freed_bytes\":%ld,\"live_bytes\":%ld,\"peak_bytes\":%ld}\n", sample.timestamp_ns, sample.interval_ns,
+            sample.allocs, sample.frees, sample.alloc_bytes, sample.freed_bytes, sample.live_bytes,
+            sample.peak_bytes);
+  }
+}
+
+
+void SafiTimeline::print_comments(FILE* stream) const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  if (size() == 0) {
+    return;
+  }
+  fprintf(stream, "# timeline: timestamp_ns interval_ns allocs frees alloc_bytes freed_bytes live_bytes peak_bytes\n");
+  for (size_t i = 0; i < size(); i++) {
+    const SafiTimelineSample& sample = at(i);
+    fprintf(stream, "# timeline %ld %ld %ld %ld %ld %ld %ld %ld\n", sample.timestamp_ns, sample.interval_ns,
+            sample.allocs, sample.frees, sample.alloc_bytes, sample.freed_bytes, sample.live_bytes,
+            sample.peak_bytes);
+  }
+}
@@ -0,0 +1,535 @@
+/**
+ * @file safi_trace.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Implementation of the binary event trace writer
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "library.h"
+#include "safi_mmap.h"
+#include "safi_trace.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define MIN_TRACE_RING_EVENTS 64
+#define MIN_STAGING_EVENTS (1 << 16)
+
+// How long encoded events may wait in the block buffer while the writer is idle
+#define TRACE_IDLE_FLUSH_MS 100
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global Variables
+////////////////////////////////////////////////////////////////////////////////
+__thread SafiTraceRing* t_safi_trace_ring __attribute__((tls_model("initial-exec"))) = nullptr;
+__thread bool t_safi_no_trace __attribute__((tls_model("initial-exec"))) = false;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Thread-exit hook (pthread key destructor)
+ */
+static void __retire_trace_ring(void* ring)
+{
+  SafiTracer::retire_ring(static_cast<SafiTraceRing*>(ring));
+}
+
+
+static uint64_t __monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/**
+ * @brief Open and lock a trace file, truncating it only once it is ours
+ *
+ * @return int The descriptor, -1 if the file cannot be opened or another
+ *         process holds its lock (it has the file mapped: truncating it would
+ *         crash that process with SIGBUS on its next write)
+ */
+static int __open_locked(const char* path)
+{
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(fd, 0) != 0) {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  return fd;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Classes
+////////////////////////////////////////////////////////////////////////////////
+
+bool SafiTracer::start(const char* path, bool block_when_full, uint64_t ring_events, const SafiSiteTable* sites)
+{
+  // An exec'd child inherits MEM_SAFI_TRACE, while its parent still traces to the path it gets its own file
+  char pid_path[PATH_MAX];
+  m_fd = __open_locked(path);
+  if (m_fd < 0 && errno == EWOULDBLOCK) {
+    snprintf(pid_path, sizeof(pid_path), "%s.%d", path, (int)getpid());
+    m_fd = __open_locked(pid_path);
+    if (m_fd >= 0) {
+      SAFI_LOG_ERROR("[MemSafi] '%s' is traced by another process, tracing to '%s'\n", path, pid_path);
+    }
+    path = pid_path;
+  }
+  if (m_fd < 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to open the trace file '%s': %s\n", path, strerror(errno));
+    return false;
+  }
+
+  m_block = static_cast<uint8_t*>(safi_mmap_alloc(TRACE_BLOCK_TARGET_SIZE + SAFI_EV_MAX_ENCODED_SIZE));
+  m_commit = sizeof(SafiTraceHeader);
+  if (m_block == nullptr || !reserve_file(0) || pthread_key_create(&m_ring_key, __retire_trace_ring) != 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to allocate the trace buffers!\n");
+    close(m_fd);
+    return false;
+  }
+
+  void* header = safi_sys_mmap(nullptr, sizeof(SafiTraceHeader), PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (header == MAP_FAILED) {
+    SAFI_LOG_ERROR("[ERROR] Failed to map the trace header: %s\n", strerror(errno));
+    close(m_fd);
+    return false;
+  }
+
+  m_block_when_full = block_when_full;
+  m_sites = sites;
+  m_ring_events = MIN_TRACE_RING_EVENTS;
+  while (m_ring_events < ring_events) {
+    m_ring_events <<= 1;
+  }
+
+  struct timespec realtime;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  m_pid = getpid();
+  m_header = new (header) SafiTraceHeader();
+  m_header->pid = m_pid;
+  m_header->start_tsc = safi_tsc();
+  m_header->start_realtime_ns = (uint64_t)realtime.tv_sec * 1000000000ull + realtime.tv_nsec;
+  __atomic_store_n(&m_header->commit_offset, m_commit, __ATOMIC_RELEASE);
+  m_start_ns = m_last_flush_ns = __monotonic_ns();
+
+  m_active = true;
+  m_writer = new std::thread(&SafiTracer::writer_loop, this);
+  return true;
+}
+
+
+void SafiTracer::stop()
+{
+  if (!active()) {
+    return;
+  }
+  m_active = false;
+  m_stop = true;
+  wake_writer();
+  m_writer->join();
+  delete m_writer;
+  m_writer = nullptr;
+
+  // Drop the unused tail of the last chunk
+  safi_sys_munmap(m_window, m_window_size);
+  safi_sys_munmap(m_header, sizeof(SafiTraceHeader));
+  if (ftruncate(m_fd, m_commit) != 0) {
+    SAFI_LOG_ERROR("[ERROR] Failed to truncate the trace file!\n");
+  }
+  close(m_fd);
+  m_fd = -1;
+
+  int64_t dropped = 0;
+  for (SafiTraceRing* ring = m_rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next) {
+    dropped += ring->dropped.load(std::memory_order_relaxed);
+  }
+  if (dropped != 0) {
+    SAFI_LOG_ERROR("[MemSafi] %ld trace events were dropped (full rings), raise MEM_SAFI_TRACE_RING_EVENTS or set "
+                   "MEM_SAFI_TRACE_FULL=block\n", dropped);
+  }
+}
+
+
+void SafiTracer::print(FILE* stream) const
+{
+  int64_t dropped = 0;
+  for (SafiTraceRing* ring = m_rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next) {
+    dropped += ring->dropped.load(std::memory_order_relaxed);
+  }
+  fprintf(stream, "Trace: %lu events written, %ld dropped (full rings)\n\n", m_written.load(std::memory_order_relaxed),
+          dropped);
+}
+
+
+void SafiTracer::retire_ring(SafiTraceRing* ring)
+{
+  ring->state.store(SafiTraceRing::RETIRED, std::memory_order_release);
+
+  // Events recorded by later thread-exit destructors go to a fresh ring
+  t_safi_trace_ring = nullptr;
+}
+
+
+SafiTraceRing* SafiTracer::acquire_ring()
+{
+  SafiTraceRing* ring = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(m_rings_mutex);
+    if (m_free_rings != nullptr) {
+      ring = m_free_rings;
+      m_free_rings = ring->next_free;
+    }
+  }
+
+  if (ring == nullptr) {
+    size_t header_size = (sizeof(SafiTraceRing) + 63) & ~(size_t)63;
+    void* mem = safi_mmap_alloc(header_size + m_ring_events * sizeof(SafiTraceEvent));
+    if (mem == nullptr) {
+      return nullptr;
+    }
+    ring = new (mem) SafiTraceRing();
+    ring->capacity = m_ring_events;
+    ring->events = reinterpret_cast<SafiTraceEvent*>(static_cast<char*>(mem) + header_size);
+
+    std::lock_guard<std::mutex> guard(m_rings_mutex);
+    ring->next = m_rings.load(std::memory_order_relaxed);
+    m_rings.store(ring, std::memory_order_release);
+  }
+
+  // A recycled ring is fully drained, head == tail
+  ring->tid = (uint32_t)syscall(SYS_gettid);
+  ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+  ring->state.store(SafiTraceRing::ACTIVE, std::memory_order_release);
+
+  t_safi_trace_ring = ring;
+  pthread_setspecific(m_ring_key, ring);
+  return ring;
+}
+
+
+bool SafiTracer::wait_for_space(SafiTraceRing* ring, uint64_t head)
+{
+  // Give the writer the CPU once before dropping, with fewer cores than busy threads it may not have run yet
+  ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+  if (head - ring->cached_tail >= ring->capacity) {
+    wake_writer();
+    sched_yield();
+    ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+  }
+  while (head - ring->cached_tail >= ring->capacity) {
+    // A forked child has no writer thread, waiting would hang it
+    if (!m_block_when_full || !active() || getpid() != m_pid) {
+      return false;
+    }
+    sched_yield();
+    ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+  }
+  return true;
+}
+
+
+void SafiTracer::half_full(SafiTraceRing* ring, uint64_t head)
+{
+  ring->cached_tail = ring->tail.load(std::memory_order_acquire);
+  if (head - ring->cached_tail >= ring->capacity / 2) {
+    wake_writer();
+  }
+}
+
+
+void SafiTracer::wake_writer()
+{
+  m_wake.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, &m_wake, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+
+void SafiTracer::writer_loop()
+{
+  t_safi_no_trace = true;
+  bool calibrated = false;
+
+  while (!m_stop.load(std::memory_order_acquire)) {
+    // Read before draining: a wake-up during the round makes the wait return at once
+    uint32_t wake = m_wake.load(std::memory_order_acquire);
+    size_t written = drain_round(false);
+    uint64_t now = __monotonic_ns();
+
+    if (!calibrated && now - m_start_ns >= TRACE_CALIBRATION_MS * 1000000ull) {
+      calibrate();
+      calibrated = true;
+    }
+
+    if (written == 0) {
+      if (now - m_last_flush_ns >= TRACE_IDLE_FLUSH_MS * 1000000ull) {
+        flush_block();
+      }
+      struct timespec timeout = {0, TRACE_WRITER_SLEEP_MS * 1000000l};
+      syscall(SYS_futex, &m_wake, FUTEX_WAIT_PRIVATE, wake, &timeout, nullptr, 0);
+    }
+  }
+
+  drain_round(true);
+  flush_block();
+  write_sites();
+  write_maps();
+  calibrate();
+}
+
+
+size_t SafiTracer::drain_round(bool final)
+{
+  uint64_t watermark = final ? UINT64_MAX : safi_tsc();
+
+  for (SafiTraceRing* ring = m_rings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next) {
+    int state = ring->state.load(std::memory_order_acquire);
+    if (state == SafiTraceRing::FREE) {
+      continue;
+    }
+
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    if (head > tail && reserve_staging(head - tail)) {
+      for (; tail < head; tail++) {
+        m_staging[m_staging_size++] = ring->events[tail & (ring->capacity - 1)];
+      }
+      ring->tail.store(tail, std::memory_order_release);
+    }
+
+    int64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+    if (dropped != ring->dropped_reported && reserve_staging(1)) {
+      SafiTraceEvent& ev = m_staging[m_staging_size++];
+      ev = SafiTraceEvent();
+      ev.type = SAFI_EV_DROPPED;
+      ev.tid = ring->tid;
+      ev.tsc = final ? safi_tsc() : watermark - 1;
+      ev.size = dropped - ring->dropped_reported;
+      ring->dropped_reported = dropped;
+    }
+
+    if (state == SafiTraceRing::RETIRED && tail == head) {
+      std::lock_guard<std::mutex> guard(m_rings_mutex);
+      ring->state.store(SafiTraceRing::FREE, std::memory_order_relaxed);
+      ring->next_free = m_free_rings;
+      m_free_rings = ring;
+    }
+  }
+
+  // Events newer than the watermark may still be missing older peers that
+  // were being recorded while we drained, keep them for the next round
+  std::sort(m_staging, m_staging + m_staging_size, [] (const SafiTraceEvent& a, const SafiTraceEvent& b) {
+    return a.tsc < b.tsc;
+  });
+
+  size_t count = 0;
+  while (count < m_staging_size && m_staging[count].tsc < watermark) {
+    emit(m_staging[count++]);
+  }
+  memmove(m_staging, m_staging + count, (m_staging_size - count) * sizeof(SafiTraceEvent));
+  m_staging_size -= count;
+  return count;
+}
+
+
+bool SafiTracer::reserve_staging(size_t count)
+{
+  if (m_staging_size + count <= m_staging_capacity) {
+    return true;
+  }
+
+  size_t capacity = std::max({m_staging_capacity * 2, m_staging_size + count, (size_t)MIN_STAGING_EVENTS});
+  SafiTraceEvent* staging = static_cast<SafiTraceEvent*>(safi_mmap_alloc(capacity * sizeof(SafiTraceEvent)));
+  if (staging == nullptr) {
+    return false;
+  }
+  memcpy(staging, m_staging, m_staging_size * sizeof(SafiTraceEvent));
+  safi_mmap_free(m_staging, m_staging_capacity * sizeof(SafiTraceEvent));
+  m_staging = staging;
+  m_staging_capacity = capacity;
+  return true;
+}
+
+
+void SafiTracer::emit(const SafiTraceEvent& ev)
+{
+  if (m_block_events == 0) {
+    m_block_header.base_tsc = ev.tsc;
+    m_codec.reset(ev.tsc);
+  }
+
+  m_block_size = m_codec.encode(ev, m_block + m_block_size) - m_block;
+  ++m_block_events;
+  if (ev.type != SAFI_EV_DROPPED) {
+    m_written.store(m_written.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  if (m_block_size >= TRACE_BLOCK_TARGET_SIZE) {
+    flush_block();
+  }
+}
+
+
+void SafiTracer::flush_block(uint32_t magic)
+{
+  m_last_flush_ns = __monotonic_ns();
+  if (m_block_events == 0) {
+    return;
+  }
+
+  m_block_header.magic = magic;
+  m_block_header.payload_size = m_block_size;
+  m_block_header.num_events = m_block_events;
+  uint64_t size = sizeof(m_block_header) + m_block_size;
+
+  if (reserve_file(size)) {
+    uint8_t* out = m_window + (m_commit - m_window_offset);
+    memcpy(out, &m_block_header, sizeof(m_block_header));
+    memcpy(out + sizeof(m_block_header), m_block, m_block_size);
+
+    // Publish the block only once it is complete
+    m_commit += size;
+    __atomic_store_n(&m_header->commit_offset, m_commit, __ATOMIC_RELEASE);
+  }
+
+  m_block_size = 0;
+  m_block_events = 0;
+}
+
+
+bool SafiTracer::reserve_file(uint64_t size)
+{
+  if (m_window != nullptr && m_commit + size <= m_window_offset + m_window_size) {
+    return true;
+  }
+
+  uint64_t file_size = m_file_size;
+  while (file_size < m_commit + size) {
+    file_size += TRACE_FILE_CHUNK_SIZE;
+  }
+
+  // Allocate the blocks up front, a full disk must fail here and not SIGBUS
+  // on the memcpy into the mapping
+  if (file_size != m_file_size) {
+    int ret = fallocate(m_fd, 0, m_file_size, file_size - m_file_size);
+    if (ret != 0 && errno == EOPNOTSUPP) {
+      ret = ftruncate(m_fd, file_size);
+    }
+    if (ret != 0) {
+      SAFI_LOG_ERROR("[ERROR] Failed to extend the trace file: %s\n", strerror(errno));
+      return false;
+    }
+    m_file_size = file_size;
+  }
+
+  uint64_t window_offset = m_commit & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+  void* window = safi_sys_mmap(nullptr, m_file_size - window_offset, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd,
+                               window_offset);
+  if (window == MAP_FAILED) {
+    SAFI_LOG_ERROR("[ERROR] Failed to map the trace file: %s\n", strerror(errno));
+    return false;
+  }
+
+  if (m_window != nullptr) {
+    safi_sys_munmap(m_window, m_window_size);
+  }
+  m_window = static_cast<uint8_t*>(window);
+  m_window_offset = window_offset;
+  m_window_size = m_file_size - window_offset;
+  return true;
+}
+
+
+void SafiTracer::write_sites()
+{
+  if (m_sites == nullptr) {
+    return;
+  }
+
+  // Same buffer as the events, up to TRACE_BLOCK_TARGET_SIZE per block
+  const size_t max_site_size = (SAFI_MAX_STACK_DEPTH + 2) * 10;
+  for (uint32_t id = 0; id < SAFI_MAX_SITES; id++) {
+    const SafiSite* site = m_sites->get(id);
+    if (site == nullptr) {
+      continue;
+    }
+    uint8_t* out = safi_put_varint(m_block + m_block_size, id);
+    out = safi_put_varint(out, site->depth);
+    for (uint32_t f = 0; f < site->depth; f++) {
+      out = safi_put_varint(out, (uintptr_t)site->frames[f]);
+    }
+    m_block_size = out - m_block;
+    ++m_block_events;
+
+    if (m_block_size + max_site_size > TRACE_BLOCK_TARGET_SIZE) {
+      flush_block(SAFI_TRACE_SITES_MAGIC);
+    }
+  }
+  flush_block(SAFI_TRACE_SITES_MAGIC);
+}
+
+
+void SafiTracer::write_maps()
+{
+  int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+
+  ssize_t ret = 0;
+  while ((ret = read(fd, m_block + m_block_size, TRACE_BLOCK_TARGET_SIZE - m_block_size)) > 0) {
+    m_block_size += ret;
+    m_block_events = 1;
+    if (m_block_size == TRACE_BLOCK_TARGET_SIZE) {
+      flush_block(SAFI_TRACE_MAPS_MAGIC);
+    }
+  }
+  close(fd);
+
+  flush_block(SAFI_TRACE_MAPS_MAGIC);
+}
+
+
+void SafiTracer::calibrate()
+{
+  uint64_t elapsed_ns = __monotonic_ns() - m_start_ns;
+  uint64_t elapsed_tsc = safi_tsc() - m_header->start_tsc;
+  if (elapsed_ns > 0) {
+    m_header->tsc_hz = (uint64_t)((double)elapsed_tsc * 1e9 / elapsed_ns);
+  }
+}
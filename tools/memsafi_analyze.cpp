@@ -0,0 +1,617 @@
+/**
+ * @file memsafi_analyze.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Offline analyzer of MemSafi event traces (MEM_SAFI_TRACE=<path>)
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * The trace is streamed in chunks of whole blocks. Chunks are decoded in
+ * parallel into partial results (net bytes, max prefix, unmatched allocations
+ * and frees, histograms) that are merged in file order, so the peak is exact
+ * and the memory used is bounded by the chunk size and the live heap, not by
+ * the trace size.
+ *
+ * Memory: each job holds one raw chunk (chunk_mb) and its decoded result,
+ * about 60 bytes per allocation the chunk does not free, so up to about
+ * 12 x chunk_mb for a chunk of small allocations only. The jobs are capped at
+ * DEFAULT_MAX_JOBS whatever the core count: 512 MB of raw chunks by default,
+ * plus the results, plus the merged live heap (about 80 bytes per live block).
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_trace_format.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define DEFAULT_CHUNK_MB 64
+
+// Default jobs, it runs on the production boxes: more cores must not mean more memory
+#define DEFAULT_MAX_JOBS 8
+#define DEFAULT_TOP 10
+#define DEFAULT_TIMELINE_POINTS 50
+
+// Events between two timeline checkpoints of a chunk
+#define TIMELINE_STRIDE 4096
+
+// Power-of-two size classes, bucket i holds sizes in [2^(i-1), 2^i)
+#define SIZE_CLASSES 65
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+struct Options
+{
+  int jobs = 0;
+  size_t chunk_bytes = (size_t)DEFAULT_CHUNK_MB << 20;
+  size_t top = DEFAULT_TOP;
+  size_t timeline_points = DEFAULT_TIMELINE_POINTS;
+  const char* path = nullptr;
+};
+
+
+struct LiveBlock
+{
+  uint64_t size = 0;
+  uint32_t site = 0;
+};
+
+
+struct SiteStats
+{
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+  uint64_t leaked_blocks = 0;
+  uint64_t leaked_bytes = 0;
+};
+
+
+struct Checkpoint
+{
+  uint64_t tsc = 0;
+  int64_t live = 0;
+};
+
+
+/**
+ * @brief What one chunk contributes, 'live' values are relative to the chunk start
+ */
+struct ChunkResult
+{
+  uint64_t events[SAFI_EV_DROPPED + 1] = {0};
+  uint64_t dropped = 0;
+  uint64_t first_tsc = 0;
+  uint64_t last_tsc = 0;
+
+  int64_t net = 0;
+  int64_t max_prefix = 0;
+  uint64_t max_prefix_tsc = 0;
+  std::vector<Checkpoint> timeline;
+
+  std::unordered_map<uintptr_t, LiveBlock> allocs; // Not freed within the chunk
+  std::vector<uintptr_t> frees; // Of blocks allocated before the chunk
+  uint64_t size_classes[SIZE_CLASSES] = {0};
+  std::unordered_map<uint32_t, SiteStats> sites;
+
+  std::string error;
+};
+
+
+struct Chunk
+{
+  std::vector<uint8_t> data; // Whole event blocks
+  ChunkResult result;
+};
+
+
+struct Mapping
+{
+  uintptr_t start = 0;
+  uintptr_t end = 0;
+  uintptr_t offset = 0;
+  std::string path;
+};
+
+
+/**
+ * @brief Result of the merge, in file order
+ */
+struct Analysis
+{
+  uint64_t events[SAFI_EV_DROPPED + 1] = {0};
+  uint64_t dropped = 0;
+  uint64_t first_tsc = 0;
+  uint64_t last_tsc = 0;
+
+  int64_t live = 0;
+  int64_t peak = 0;
+  uint64_t peak_tsc = 0;
+  std::vector<Checkpoint> timeline;
+
+  std::unordered_map<uintptr_t, LiveBlock> live_blocks;
+  uint64_t unknown_frees = 0; // Blocks allocated before the trace started
+  uint64_t size_classes[SIZE_CLASSES] = {0};
+  std::unordered_map<uint32_t, SiteStats> sites;
+
+  std::unordered_map<uint32_t, std::vector<uintptr_t>> site_frames;
+  std::string maps;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+static int __size_class(uint64_t size)
+{
+  return size == 0 ? 0 : 64 - __builtin_clzll(size);
+}
+
+
+/**
+ * @brief Decode the blocks of a chunk into its partial result
+ */
+static void __process_chunk(Chunk& chunk)
+{
+  ChunkResult& r = chunk.result;
+  const uint8_t* p = chunk.data.data();
+  const uint8_t* end = p + chunk.data.size();
+  int64_t prefix = 0;
+  uint64_t count = 0;
+
+  auto alloc = [&r] (const SafiTraceEvent& ev) {
+    r.allocs[ev.ptr] = LiveBlock{ev.size, ev.site};
+    r.size_classes[__size_class(ev.size)]++;
+    SiteStats& site = r.sites[ev.site];
+    site.allocs++;
+    site.bytes += ev.size;
+  };
+
+  auto release = [&r] (uintptr_t ptr) {
+    if (r.allocs.erase(ptr) == 0) {
+      r.frees.push_back(ptr);
+    }
+  };
+
+  while (p < end) {
+    SafiTraceBlockHeader header;
+    memcpy(&header, p, sizeof(header));
+    p += sizeof(header);
+    const uint8_t* block_end = p + header.payload_size;
+
+    SafiTraceCodec codec;
+    codec.reset(header.base_tsc);
+    for (uint32_t i = 0; i < header.num_events; i++) {
+      SafiTraceEvent ev;
+      if (!codec.decode(p, block_end, ev)) {
+        r.error = "corrupted block";
+        return;
+      }
+      if (r.first_tsc == 0) {
+        r.first_tsc = ev.tsc;
+        r.max_prefix_tsc = ev.tsc;
+      }
+      r.last_tsc = std::max(r.last_tsc, ev.tsc);
+      r.events[ev.type]++;
+
+      switch (ev.type) {
+        case SAFI_EV_MALLOC:
+        case SAFI_EV_CALLOC:
+          prefix += ev.size;
+          alloc(ev);
+          break;
+        case SAFI_EV_REALLOC:
+          prefix += (int64_t)ev.size - (int64_t)ev.old_size;
+          if (ev.old_ptr != 0) {
+            release(ev.old_ptr);
+          }
+          if (ev.ptr != 0) {
+            alloc(ev);
+          }
+          break;
+        case SAFI_EV_FREE:
+          prefix -= ev.size;
+          release(ev.ptr);
+          break;
+        case SAFI_EV_DROPPED:
+          r.dropped += ev.size;
+          break;
+      }
+
+      if (prefix > r.max_prefix) {
+        r.max_prefix = prefix;
+        r.max_prefix_tsc = ev.tsc;
+      }
+      if (++count % TIMELINE_STRIDE == 0) {
+        r.timeline.push_back(Checkpoint{ev.tsc, prefix});
+      }
+    }
+    p = block_end;
+  }
+
+  r.net = prefix;
+  r.timeline.push_back(Checkpoint{r.last_tsc, prefix});
+}
+
+
+/**
+ * @brief Halve the timeline resolution, keeping the highest point of each pair
+ */
+static void __decimate(std::vector<Checkpoint>& timeline)
+{
+  size_t out = 0;
+  for (size_t i = 0; i < timeline.size(); i += 2) {
+    Checkpoint c = timeline[i];
+    if (i + 1 < timeline.size() && timeline[i + 1].live >= c.live) {
+      c = timeline[i + 1];
+    }
+    timeline[out++] = c;
+  }
+  timeline.resize(out);
+}
+
+
+/**
+ * @brief Fold a chunk result into the analysis, chunks must come in file order
+ */
+static void __merge_chunk(Analysis& a, ChunkResult& r, size_t timeline_points)
+{
+  for (int t = 0; t <= SAFI_EV_DROPPED; t++) {
+    a.events[t] += r.events[t];
+  }
+  a.dropped += r.dropped;
+  if (a.first_tsc == 0) {
+    a.first_tsc = r.first_tsc;
+  }
+  a.last_tsc = std::max(a.last_tsc, r.last_tsc);
+
+  if (a.live + r.max_prefix > a.peak) {
+    a.peak = a.live + r.max_prefix;
+    a.peak_tsc = r.max_prefix_tsc;
+  }
+  for (const Checkpoint& c : r.timeline) {
+    a.timeline.push_back(Checkpoint{c.tsc, a.live + c.live});
+    if (a.timeline.size() >= 2 * timeline_points) {
+      __decimate(a.timeline);
+    }
+  }
+  a.live += r.net;
+
+  // Frees first: a chunk may free an older block and get its address back
+  for (uintptr_t ptr : r.frees) {
+    if (a.live_blocks.erase(ptr) == 0) {
+      a.unknown_frees++;
+    }
+  }
+  for (const auto& entry : r.allocs) {
+    a.live_blocks[entry.first] = entry.second;
+  }
+
+  for (int i = 0; i < SIZE_CLASSES; i++) {
+    a.size_classes[i] += r.size_classes[i];
+  }
+  for (const auto& entry : r.sites) {
+    SiteStats& site = a.sites[entry.first];
+    site.allocs += entry.second.allocs;
+    site.bytes += entry.second.bytes;
+  }
+}
+
+
+static void __parse_sites(Analysis& a, const uint8_t* p, const uint8_t* end, uint32_t count)
+{
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t id = 0, depth = 0, frame = 0;
+    if (!safi_get_varint(p, end, id) || !safi_get_varint(p, end, depth)) {
+      return;
+    }
+    std::vector<uintptr_t>& frames = a.site_frames[(uint32_t)id];
+    for (uint64_t f = 0; f < depth && safi_get_varint(p, end, frame); f++) {
+      frames.push_back(frame);
+    }
+  }
+}
+
+
+static std::vector<Mapping> __parse_maps(const std::string& maps)
+{
+  std::vector<Mapping> mappings;
+  size_t pos = 0;
+  while (pos < maps.size()) {
+    size_t eol = maps.find('\n', pos);
+    std::string line = maps.substr(pos, eol == std::string::npos ? std::string::npos : eol - pos);
+    pos = eol == std::string::npos ? maps.size() : eol + 1;
+
+    Mapping m;
+    char perms[8] = {0};
+    int path_pos = 0;
+    if (sscanf(line.c_str(), "%lx-%lx %7s %lx %*s %*s %n", &m.start, &m.end, perms, &m.offset, &path_pos) >= 4) {
+      if (path_pos > 0 && path_pos < (int)line.size()) {
+        m.path = line.substr(path_pos);
+      }
+      mappings.push_back(m);
+    }
+  }
+  return mappings;
+}
+
+
+static std::string __resolve(const std::vector<Mapping>& mappings, uintptr_t address)
+{
+  char buffer[64];
+  for (const Mapping& m : mappings) {
+    if (address >= m.start && address < m.end && !m.path.empty()) {
+      snprintf(buffer, sizeof(buffer), "+0x%lx", address - m.start + m.offset);
+      return m.path + buffer;
+    }
+  }
+  snprintf(buffer, sizeof(buffer), "0x%lx", address);
+  return buffer;
+}
+
+
+static double __seconds(const SafiTraceHeader& header, uint64_t tsc)
+{
+  if (header.tsc_hz == 0 || tsc < header.start_tsc) {
+    return 0.0;
+  }
+  return (double)(tsc - header.start_tsc) / header.tsc_hz;
+}
+
+
+static void __print_sites(const Analysis& a, const std::vector<Mapping>& mappings, size_t top, bool leaked)
+{
+  std::vector<std::pair<uint32_t, SiteStats>> sites(a.sites.begin(), a.sites.end());
+  auto key = [leaked] (const SiteStats& s) { return leaked ? s.leaked_bytes : s.bytes; };
+  std::sort(sites.begin(), sites.end(), [&key] (const std::pair<uint32_t, SiteStats>& x, const std::pair<uint32_t, SiteStats>& y) {
+    return key(x.second) > key(y.second);
+  });
+
+  printf("Top allocation sites by %s:\n", leaked ? "leaked bytes" : "allocated bytes");
+  for (size_t i = 0; i < sites.size() && i < top && key(sites[i].second) > 0; i++) {
+    const SiteStats& s = sites[i].second;
+    printf("#%lu allocated: %lu B in %lu allocs, leaked: %lu B in %lu blocks\n",
+           i + 1, s.bytes, s.allocs, s.leaked_bytes, s.leaked_blocks);
+
+    auto frames = a.site_frames.find(sites[i].first);
+    if (sites[i].first == 0 || frames == a.site_frames.end()) {
+      printf("    <unknown>\n");
+      continue;
+    }
+    for (uintptr_t frame : frames->second) {
+      printf("    %s\n", __resolve(mappings, frame).c_str());
+    }
+  }
+  printf("\n");
+}
+
+
+static void __print_report(const SafiTraceHeader& header, Analysis& a, const Options& options)
+{
+  // Leaks per site
+  for (const auto& entry : a.live_blocks) {
+    SiteStats& site = a.sites[entry.second.site];
+    site.leaked_blocks++;
+    site.leaked_bytes += entry.second.size;
+  }
+  std::vector<Mapping> mappings = __parse_maps(a.maps);
+
+  printf("Trace of pid %lu, %.3f s\n", header.pid, __seconds(header, a.last_tsc));
+  printf("Events: %lu mallocs, %lu callocs, %lu reallocs, %lu frees\n",
+         a.events[SAFI_EV_MALLOC], a.events[SAFI_EV_CALLOC], a.events[SAFI_EV_REALLOC], a.events[SAFI_EV_FREE]);
+  if (a.dropped > 0) {
+    printf("WARNING: %lu events were dropped (full rings), the numbers below are approximate\n", a.dropped);
+  }
+  printf("\n");
+
+  time_t wall = (header.start_realtime_ns / 1000000000ull) + (time_t)__seconds(header, a.peak_tsc);
+  char wall_str[64];
+  strftime(wall_str, sizeof(wall_str), "%F %T", localtime(&wall));
+  printf("Peak live heap: %ld B at +%.6f s (%s)\n", a.peak, __seconds(header, a.peak_tsc), wall_str);
+  printf("Live heap at exit: %ld B in %lu blocks\n", a.live, a.live_blocks.size());
+  if (a.unknown_frees > 0) {
+    printf("Frees of blocks allocated before the trace started: %lu\n", a.unknown_frees);
+  }
+  printf("\n");
+
+  printf("Live heap timeline:\n");
+  for (const Checkpoint& c : a.timeline) {
+    printf("  +%10.6f s %15ld B\n", __seconds(header, c.tsc), c.live);
+  }
+  printf("\n");
+
+  printf("Size classes (usable bytes):\n");
+  for (int i = 0; i < SIZE_CLASSES; i++) {
+    if (a.size_classes[i] > 0) {
+      uint64_t low = i == 0 ? 0 : 1ull << (i - 1);
+      printf("  [%lu, %lu) %lu\n", low, i == 0 ? 1 : low * 2, a.size_classes[i]);
+    }
+  }
+  printf("\n");
+
+  std::vector<std::pair<uintptr_t, LiveBlock>> leaks(a.live_blocks.begin(), a.live_blocks.end());
+  std::sort(leaks.begin(), leaks.end(), [] (const std::pair<uintptr_t, LiveBlock>& x, const std::pair<uintptr_t, LiveBlock>& y) {
+    return x.second.size > y.second.size;
+  });
+  printf("Largest blocks leaked at exit:\n");
+  for (size_t i = 0; i < leaks.size() && i < options.top; i++) {
+    printf("  0x%lx %lu B (site %u)\n", leaks[i].first, leaks[i].second.size, leaks[i].second.site);
+  }
+  printf("\n");
+
+  __print_sites(a, mappings, options.top, false);
+  __print_sites(a, mappings, options.top, true);
+}
+
+
+static void __usage(const char* name)
+{
+  fprintf(stderr, "Usage: %s [-j jobs] [-c chunk_mb] [-n top] [-p timeline_points] <trace>\n", name);
+  fprintf(stderr, "  -j defaults to one job per CPU, at most %d, each holds one raw chunk of -c MB (default %d)\n",
+          DEFAULT_MAX_JOBS, DEFAULT_CHUNK_MB);
+  fprintf(stderr, "     and its decoded result, about 60 bytes per allocation the chunk does not free (up to about\n"
+          "     12 x -c MB), the live heap adds about 80 bytes per live block\n");
+}
+
+
+int main(int argc, char** argv)
+{
+  Options options;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "j:c:n:p:h")) != -1) {
+    switch (opt) {
+      case 'j': options.jobs = atoi(optarg); break;
+      case 'c': options.chunk_bytes = (size_t)std::max(1, atoi(optarg)) << 20; break;
+      case 'n': options.top = atoi(optarg); break;
+      case 'p': options.timeline_points = std::max(1, atoi(optarg)); break;
+      default: __usage(argv[0]); return 1;
+    }
+  }
+  if (optind >= argc) {
+    __usage(argv[0]);
+    return 1;
+  }
+  options.path = argv[optind];
+  if (options.jobs <= 0) {
+    options.jobs = std::min(std::max(1u, std::thread::hardware_concurrency()), (unsigned)DEFAULT_MAX_JOBS);
+  }
+
+  int fd = open(options.path, O_RDONLY);
+  struct stat st;
+  SafiTraceHeader header;
+  if (fd < 0 || fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+    fprintf(stderr, "[ERROR] Failed to read '%s'\n", options.path);
+    return 1;
+  }
+  if (header.magic != SAFI_TRACE_MAGIC || header.version != SAFI_TRACE_VERSION) {
+    fprintf(stderr, "[ERROR] '%s' is not a MemSafi trace (version %d)\n", options.path, SAFI_TRACE_VERSION);
+    return 1;
+  }
+
+  uint64_t end = header.commit_offset;
+  if (end == 0 || end > (uint64_t)st.st_size) {
+    fprintf(stderr, "[WARNING] Invalid commit offset, reading up to the end of the file\n");
+    end = st.st_size;
+  }
+
+  Analysis analysis;
+  uint64_t offset = header.header_size;
+  bool done = false;
+
+  while (!done) {
+    // Read one wave of chunks, each made of whole blocks
+    std::vector<Chunk> wave(options.jobs);
+    size_t used = 0;
+    for (; used < wave.size() && offset < end; used++) {
+      std::vector<uint8_t>& data = wave[used].data;
+      size_t size = std::min<uint64_t>(options.chunk_bytes, end - offset);
+      data.resize(size);
+      if (pread(fd, data.data(), size, offset) != (ssize_t)size) {
+        fprintf(stderr, "[ERROR] Read failed at offset %lu\n", offset);
+        return 1;
+      }
+
+      size_t pos = 0;
+      while (pos + sizeof(SafiTraceBlockHeader) <= data.size()) {
+        SafiTraceBlockHeader block;
+        memcpy(&block, data.data() + pos, sizeof(block));
+        size_t block_size = sizeof(block) + block.payload_size;
+
+        if (block.magic != SAFI_TRACE_BLOCK_MAGIC && block.magic != SAFI_TRACE_SITES_MAGIC &&
+            block.magic != SAFI_TRACE_MAPS_MAGIC) {
+          fprintf(stderr, "[WARNING] Truncated or corrupted trace at offset %lu\n", offset + pos);
+          done = true;
+          break;
+        }
+        if (pos + block_size > data.size()) {
+          if (pos == 0 && offset + block_size <= end) {
+            // Block larger than the chunk
+            data.resize(block_size);
+            if (pread(fd, data.data(), block_size, offset) != (ssize_t)block_size) {
+              done = true;
+              break;
+            }
+            continue;
+          }
+          if (offset + pos + block_size > end) {
+            fprintf(stderr, "[WARNING] Truncated final block at offset %lu\n", offset + pos);
+            done = true;
+          }
+          break;
+        }
+
+        // Metadata blocks are tiny, keep them and cut them out of the chunk
+        if (block.magic != SAFI_TRACE_BLOCK_MAGIC) {
+          const uint8_t* payload = data.data() + pos + sizeof(block);
+          if (block.magic == SAFI_TRACE_SITES_MAGIC) {
+            __parse_sites(analysis, payload, payload + block.payload_size, block.num_events);
+          } else {
+            analysis.maps.append((const char*)payload, block.payload_size);
+          }
+          data.erase(data.begin() + pos, data.begin() + pos + block_size);
+          offset += block_size;
+          continue;
+        }
+        pos += block_size;
+      }
+
+      data.resize(pos);
+      offset += pos;
+      if (pos == 0) {
+        done = done || offset >= end;
+        break;
+      }
+    }
+    if (offset >= end) {
+      done = true;
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < used; i++) {
+      workers.emplace_back(__process_chunk, std::ref(wave[i]));
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    for (size_t i = 0; i < used; i++) {
+      if (!wave[i].result.error.empty()) {
+        fprintf(stderr, "[WARNING] %s, the rest of the chunk is ignored\n", wave[i].result.error.c_str());
+      }
+      __merge_chunk(analysis, wave[i].result, options.timeline_points);
+    }
+    if (used == 0) {
+      done = true;
+    }
+  }
+  close(fd);
+
+  while (analysis.timeline.size() > options.timeline_points) {
+    __decimate(analysis.timeline);
+  }
+  __print_report(header, analysis, options);
+  return 0;
+}
@@ -0,0 +1,319 @@
+/**
+ * @file memsafi_top.cpp
+ * @author Osama Attia (osama.gma@gmail.com)
+ * @brief Live viewer of a process profiled with MEM_SAFI_SHM=1
+ * @version 0.1
+ * @date Wed Oct 14 2026
+ *
+ * @copyright Copyright (c) 2021
+ *
+ * The viewer maps "/memsafi.<pid>", refreshes the reader heartbeat so that
+ * the library keeps publishing, and takes a consistent copy of the stats
+ * under the sequence lock. Nothing is asked of the profiled process.
+ */
+
+////////////////////////////////////////////////////////////////////////////////
+// Includes
+////////////////////////////////////////////////////////////////////////////////
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local Includes
+////////////////////////////////////////////////////////////////////////////////
+#include "safi_shm_format.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Pre-processor constants
+////////////////////////////////////////////////////////////////////////////////
+#define DEFAULT_INTERVAL_MS 1000
+
+// Attempts at a consistent copy before giving up on one refresh
+#define COPY_RETRIES 1000
+
+// The library only starts publishing once it sees the heartbeat
+#define FIRST_COPY_TIMEOUT_MS 2000
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Type definitions
+////////////////////////////////////////////////////////////////////////////////
+struct Options
+{
+  int64_t interval_ms = DEFAULT_INTERVAL_MS;
+  int64_t iterations = 0; // 0: until the process exits
+  int pid = 0;
+};
+
+
+struct Mapping
+{
+  uintptr_t start = 0;
+  uintptr_t end = 0;
+  uintptr_t offset = 0;
+  std::string path;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+////////////////////////////////////////////////////////////////////////////////
+
+static int64_t __monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+
+static void __sleep_ms(int64_t ms)
+{
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000;
+  while (nanosleep(&ts, &ts) != 0) {
+  }
+}
+
+
+/**
+ * @brief Reader side of the sequence lock
+ *
+ * @return false if no consistent copy was published yet, or the writer kept it busy
+ */
+static bool __copy_segment(const SafiShmSegment* shared, SafiShmSegment& copy)
+{
+  for (int attempt = 0; attempt < COPY_RETRIES; attempt++) {
+    uint64_t begin = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+    if (begin == 0) {
+      return false;
+    }
+    if (begin & 1) {
+      continue;
+    }
+    memcpy(&copy, shared, sizeof(copy));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == begin) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static std::vector<Mapping> __read_maps(int pid)
+{
+  std::vector<Mapping> mappings;
+  std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    Mapping m;
+    char perms[8] = {0};
+    int path_pos = 0;
+    if (sscanf(line.c_str(), "%lx-%lx %7s %lx %*s %*s %n", &m.start, &m.end, perms, &m.offset, &path_pos) >= 4) {
+      if (path_pos > 0 && path_pos < (int)line.size()) {
+        m.path = line.substr(path_pos);
+      }
+      mappings.push_back(m);
+    }
+  }
+  return mappings;
+}
+
+
+static std::string __resolve(const std::vector<Mapping>& mappings, uintptr_t address)
+{
+  char buffer[64];
+  for (const Mapping& m : mappings) {
+    if (address >= m.start && address < m.end && !m.path.empty()) {
+      const char* name = strrchr(m.path.c_str(), '/');
+      snprintf(buffer, sizeof(buffer), "+0x%lx", address - m.start + m.offset);
+      return std::string(name == nullptr ? m.path.c_str() : name + 1) + buffer;
+    }
+  }
+  snprintf(buffer, sizeof(buffer), "0x%lx", address);
+  return buffer;
+}
+
+
+static std::string __human(int64_t bytes)
+{
+  static const char* const units[] = {"B", "KB", "MB", "GB", "TB"};
+  double value = bytes;
+  size_t unit = 0;
+  while ((value >= 1024 || value <= -1024) && unit + 1 < sizeof(units) / sizeof(units[0])) {
+    value /= 1024;
+    unit++;
+  }
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), unit == 0 ? "%.0f %s" : "%.2f %s", value, units[unit]);
+  return buffer;
+}
+
+
+static void __print_screen(const SafiShmSegment& now, const SafiShmSegment& before, bool has_before,
+                           const std::vector<Mapping>& mappings)
+{
+  double elapsed_s = has_before ? (now.publish_ns - before.publish_ns) / 1e9 : 0.0;
+  char time_str[64];
+  time_t wall = now.publish_ns / 1000000000ll;
+  strftime(time_str, sizeof(time_str), "%F %T", localtime(&wall));
+
+  printf("memsafi-top - pid %ld - %s\n\n", now.pid, time_str);
+  printf("Live:        %s\n", __human(now.reserved).c_str());
+  if (now.peak_accuracy != 0) {
+    printf("Peak:        %s (+/- %s)\n", __human(now.peak).c_str(), __human(now.peak_accuracy).c_str());
+  } else {
+    printf("Peak:        %s\n", __human(now.peak).c_str());
+  }
+  if (now.requested >= 0) {
+    printf("Requested:   %s%s\n", __human(now.requested).c_str(), now.sample_bytes != 0 ? " (estimated)" : "");
+  }
+  printf("Allocated:   %s, freed: %s\n", __human(now.total_reserved).c_str(), __human(now.freed).c_str());
+  if (elapsed_s > 0) {
+    printf("Alloc rate:  %s/s, free rate: %s/s\n",
+           __human((now.total_reserved - before.total_reserved) / elapsed_s).c_str(),
+           __human((now.freed - before.freed) / elapsed_s).c_str());
+  }
+  printf("\n");
+
+  printf("%-20s %15s %12s\n", "Call", "Total", "Per second");
+  for (int call = 0; call < SAFI_NUM_CALLS; call++) {
+    if (now.num_calls[call] == 0) {
+      continue;
+    }
+    if (elapsed_s > 0) {
+      printf("%-20s %15ld %12.0f\n", safi_call_key(call), now.num_calls[call],
+             (now.num_calls[call] - before.num_calls[call]) / elapsed_s);
+    } else {
+      printf("%-20s %15ld %12s\n", safi_call_key(call), now.num_calls[call], "-");
+    }
+  }
+  printf("\n");
+
+  if (now.num_sites == 0) {
+    printf("No allocation sites, profile with MEM_SAFI_SITES=1 to see them\n");
+    return;
+  }
+  printf("Top %u allocation sites by live bytes%s:\n", now.num_sites,
+         now.sample_bytes != 0 ? " (estimated from samples)" : "");
+  for (uint32_t rank = 0; rank < now.num_sites && rank < SAFI_SHM_TOP_SITES; rank++) {
+    const SafiShmSite& site = now.sites[rank];
+    printf("#%-3u %12s in %ld blocks, total: %s in %ld allocs\n", rank + 1, __human(site.live_bytes).c_str(),
+           site.live_blocks, __human(site.total_bytes).c_str(), site.total_allocs);
+    std::ostringstream frames;
+    for (uint32_t f = 0; f < site.depth && f < SAFI_SHM_SITE_FRAMES; f++) {
+      frames << (f == 0 ? "     " : " < ") << __resolve(mappings, site.frames[f]);
+    }
+    printf("%s\n", frames.str().c_str());
+  }
+}
+
+
+static void __usage(const char* name)
+{
+  fprintf(stderr, "Usage: %s [-i interval_ms] [-n iterations] <pid>\n", name);
+}
+
+
+int main(int argc, char** argv)
+{
+  Options options;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "i:n:h")) != -1) {
+    switch (opt) {
+      case 'i': options.interval_ms = std::max(10, atoi(optarg)); break;
+      case 'n': options.iterations = atoi(optarg); break;
+      default: __usage(argv[0]); return 1;
+    }
+  }
+  if (optind >= argc) {
+    __usage(argv[0]);
+    return 1;
+  }
+  options.pid = atoi(argv[optind]);
+
+  char name[32];
+  snprintf(name, sizeof(name), SAFI_SHM_NAME_FORMAT, options.pid);
+  int fd = shm_open(name, O_RDWR, 0);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SafiShmSegment)) {
+    fprintf(stderr, "[ERROR] No stats for pid %d, is it running with MEM_SAFI_SHM=1?\n", options.pid);
+    return 1;
+  }
+  void* mem = mmap(nullptr, sizeof(SafiShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "[ERROR] Failed to map '%s'\n", name);
+    return 1;
+  }
+  SafiShmSegment* shared = static_cast<SafiShmSegment*>(mem);
+  if (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != SAFI_SHM_MAGIC ||
+      shared->version != SAFI_SHM_VERSION || shared->size != sizeof(SafiShmSegment)) {
+    fprintf(stderr, "[ERROR] '%s' is not a MemSafi segment (version %d)\n", name, SAFI_SHM_VERSION);
+    return 1;
+  }
+
+  bool clear = isatty(STDOUT_FILENO);
+  SafiShmSegment now = {};
+  SafiShmSegment before = {};
+  bool has_before = false;
+  int64_t waited_ms = 0;
+
+  for (int64_t iteration = 0; options.iterations == 0 || iteration < options.iterations; ) {
+    __atomic_store_n(&shared->reader_heartbeat_ns, __monotonic_ns(), __ATOMIC_RELAXED);
+    if (kill(options.pid, 0) != 0) {
+      fprintf(stderr, "Process %d exited\n", options.pid);
+      break;
+    }
+
+    if (!__copy_segment(shared, now)) {
+      // Give the library a few publishing periods to notice the heartbeat
+      if (waited_ms >= FIRST_COPY_TIMEOUT_MS + shared->interval_ms) {
+        fprintf(stderr, "[ERROR] Process %d does not publish its stats\n", options.pid);
+        return 1;
+      }
+      __sleep_ms(10);
+      waited_ms += 10;
+      continue;
+    }
+
+    if (clear) {
+      printf("\033[H\033[2J");
+    }
+    __print_screen(now, before, has_before, __read_maps(options.pid));
+    if (!clear) {
+      printf("\n");
+    }
+    fflush(stdout);
+
+    before = now;
+    has_before = true;
+    waited_ms = 0;
+    iteration++;
+    if (options.iterations == 0 || iteration < options.iterations) {
+      __sleep_ms(options.interval_ms);
+    }
+  }
+
+  munmap(mem, sizeof(SafiShmSegment));
+  return 0;
+}